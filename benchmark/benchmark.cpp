@@ -0,0 +1,539 @@
+// benchmark of the QF functions on synthetic tables, without Excel
+//
+// QFBenchmark [--rows 1000,10000,100000,1000000] [--cardinality 1000] [--repeat 3] [--filter QFPivot] [--stats 1]
+//
+// for every row count and function it reports the best time over the repeats, the throughput in input cells
+// and the peak memory of the call above the memory held before it; --stats 1 then prints the QFStats table of the whole run
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include "cppinterface.h"
+
+namespace {
+
+    struct Options {
+        std::vector<size_t> rows{1000, 10000, 100000, 1000000};
+        size_t cardinality{1000};
+        size_t repeat{3};
+        std::string filter;
+        bool stats{false};
+    };
+
+    std::vector<size_t> ParseSizes(const std::string& text) {
+        std::vector<size_t> sizes;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            sizes.push_back(size_t(std::stoull(item)));
+        }
+        return sizes;
+    }
+
+    Options ParseOptions(int argc, char* argv[]) {
+        Options options;
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string name = argv[i];
+            std::string value = argv[i + 1];
+            if (name == "--rows") {
+                options.rows = ParseSizes(value);
+            } else if (name == "--cardinality") {
+                options.cardinality = size_t(std::stoull(value));
+            } else if (name == "--repeat") {
+                options.repeat = std::max<size_t>(size_t(std::stoull(value)), 1);
+            } else if (name == "--filter") {
+                options.filter = value;
+            } else if (name == "--stats") {
+                options.stats = value != "0";
+            } else {
+                std::fprintf(stderr, "unknown option %s\n", name.c_str());
+                std::exit(1);
+            }
+        }
+        return options;
+    }
+
+    /*************************************
+    memory usage
+    *************************************/
+
+#if defined(__linux__)
+    size_t StatusBytes(const char* field) {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        size_t length = std::strlen(field);
+        while (std::getline(status, line)) {
+            if (line.compare(0, length, field) == 0) {
+                return size_t(std::stoull(line.substr(length + 1))) * 1024;
+            }
+        }
+        return 0;
+    }
+
+    // the peak can be reset on linux, so each call gets its own
+    void ResetPeakMemory() { std::ofstream("/proc/self/clear_refs") << "5"; }
+    size_t CurrentMemory() { return StatusBytes("VmRSS"); }
+    size_t PeakMemory() { return StatusBytes("VmHWM"); }
+#elif defined(_WIN32)
+    void ResetPeakMemory() {}
+    size_t CurrentMemory() {
+        PROCESS_MEMORY_COUNTERS counters;
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.WorkingSetSize;
+    }
+    size_t PeakMemory() {
+        PROCESS_MEMORY_COUNTERS counters;
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize;
+    }
+#else
+    void ResetPeakMemory() {}
+    size_t CurrentMemory() { return 0; }
+    size_t PeakMemory() { return 0; }
+#endif
+
+    /*************************************
+    synthetic tables
+    *************************************/
+
+    class TableGenerator {
+      public:
+        explicit TableGenerator(uint64_t seed) : random_(seed) {}
+
+        // the cell of item id: mostly numbers and strings, some booleans, errors and empty cells
+        static CellValue MixedItem(size_t id) {
+            switch (id % 20) {
+            case 7:
+                return CellValue(bool(id % 40 == 7));
+            case 13:
+                return (id % 60 == 13) ? CellValue() : CellValue(xlw::CellValue::error_type{id % 120 == 13 ? 42ul : 15ul});
+            case 2:
+            case 5:
+            case 11:
+            case 17: {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "ID%010zu", id);
+                return CellValue(std::string(buffer));
+            }
+            default:
+                return CellValue(double(id));
+            }
+        }
+
+        // items drawn uniformly from about cardinality distinct mixed values
+        CellMatrix MixedKeys(size_t rows, size_t columns, size_t cardinality) {
+            std::uniform_int_distribution<size_t> pick(0, std::max<size_t>(cardinality, 1) - 1);
+            CellMatrix result{rows, columns};
+            for (size_t row = 0; row < rows; ++row) {
+                for (size_t col = 0; col < columns; ++col) {
+                    result(row, col) = MixedItem(pick(random_));
+                }
+            }
+            return result;
+        }
+
+        CellMatrix Numbers(size_t rows, size_t columns, size_t cardinality) {
+            std::uniform_int_distribution<size_t> pick(0, std::max<size_t>(cardinality, 1) - 1);
+            CellMatrix result{rows, columns};
+            for (size_t row = 0; row < rows; ++row) {
+                for (size_t col = 0; col < columns; ++col) {
+                    result(row, col) = double(pick(random_));
+                }
+            }
+            return result;
+        }
+
+        CellMatrix SortedNumbers(size_t rows) {
+            CellMatrix result{rows, 1};
+            double value = 0.0;
+            for (size_t row = 0; row < rows; ++row) {
+                value += double(random_() % 4);
+                result(row, 0) = value;
+            }
+            return result;
+        }
+
+        // rows of the table, with one in five replaced by a key the table most likely does not hold
+        CellMatrix Sample(const CellMatrix& table, size_t rows) {
+            std::uniform_int_distribution<size_t> pick(0, std::max<size_t>(table.RowsInStructure(), 1) - 1);
+            CellMatrix result{rows, table.ColumnsInStructure()};
+            for (size_t row = 0; row < rows; ++row) {
+                bool miss = random_() % 5 == 0;
+                size_t source = pick(random_);
+                for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
+                    result(row, col) = miss ? MixedItem(table.RowsInStructure() * 4 + pick(random_)) : table(source, col);
+                }
+            }
+            return result;
+        }
+
+        // company like names: one or two made up words and a suffix most names share
+        CellMatrix Names(size_t rows) {
+            static const char consonants[] = "bcdfghjklmnprstvwxyz";
+            static const char vowels[] = "aeiou";
+            static const char* suffixes[] = {" Inc", " Ltd", " Group", " Holdings", " Capital", " Partners"};
+            auto word = [&] {
+                std::string result;
+                for (size_t i = 2 + random_() % 3; i > 0; --i) {
+                    result += consonants[random_() % (sizeof(consonants) - 1)];
+                    result += vowels[random_() % (sizeof(vowels) - 1)];
+                }
+                result[0] = char(result[0] - 'a' + 'A');
+                return result;
+            };
+            CellMatrix result{rows, 1};
+            for (size_t row = 0; row < rows; ++row) {
+                std::string name = word();
+                if (random_() % 2 == 0) {
+                    name += " " + word();
+                }
+                result(row, 0) = name + suffixes[random_() % std::size(suffixes)];
+            }
+            return result;
+        }
+
+        // the strings with one character in most of them replaced, dropped or doubled, as with typing errors; other cells as they are
+        CellMatrix Misspell(const CellMatrix& names) {
+            CellMatrix result{names.RowsInStructure(), 1};
+            for (size_t row = 0; row < names.RowsInStructure(); ++row) {
+                if (!names(row, 0).IsString() || names(row, 0).StringValue().empty()) {
+                    result(row, 0) = names(row, 0);
+                    continue;
+                }
+                std::string name = names(row, 0).StringValue();
+                size_t at = random_() % name.size();
+                switch (random_() % 4) {
+                case 0:
+                    name[at] = char('a' + random_() % 26);
+                    break;
+                case 1:
+                    name.erase(at, 1);
+                    break;
+                case 2:
+                    name.insert(at, 1, name[at]);
+                    break;
+                default:
+                    break;
+                }
+                result(row, 0) = name;
+            }
+            return result;
+        }
+
+      private:
+        std::mt19937_64 random_;
+    };
+
+    /*************************************
+    timings
+    *************************************/
+
+    struct Case {
+        std::string name;
+        size_t cells; // input cells
+        std::function<CellMatrix()> run;
+        size_t repeat{0}; // 0 for the default, 1 for calls whose later runs would hit a cache
+    };
+
+    void PrintHeader() {
+        std::printf("%-18s %10s %12s %12s %12s %12s %10s\n", "function", "rows", "input cells", "best ms", "Mcells/s", "output rows", "peak MB");
+    }
+
+    // the columns of the tables side by side as a CSV file with a header record, strings quoted
+    void WriteCsv(const std::string& path, const std::vector<const CellMatrix*>& tables) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::string separator;
+        for (size_t i = 0; i < tables.size(); ++i) {
+            for (size_t col = 0; col < tables[i]->ColumnsInStructure(); ++col) {
+                file << separator << "t" << i << "c" << col;
+                separator = ",";
+            }
+        }
+        file << "\n";
+        char buffer[32];
+        for (size_t row = 0; row < tables[0]->RowsInStructure(); ++row) {
+            separator.clear();
+            for (auto table : tables) {
+                for (size_t col = 0; col < table->ColumnsInStructure(); ++col) {
+                    const CellValue& item = (*table)(row, col);
+                    file << separator;
+                    if (item.IsString()) {
+                        file << '"';
+                        for (char c : item.StringValue()) {
+                            file << ((c == '"') ? "\"\"" : std::string(1, c));
+                        }
+                        file << '"';
+                    } else if (item.IsANumber()) {
+                        std::snprintf(buffer, sizeof(buffer), "%.17g", item.NumericValue());
+                        file << buffer;
+                    } else if (item.IsBoolean()) {
+                        file << (item.BooleanValue() ? "TRUE" : "FALSE");
+                    } else if (item.IsError()) {
+                        file << (item.ErrorValue() == 42 ? "#N/A" : "#VALUE!");
+                    }
+                    separator = ",";
+                }
+            }
+            file << "\n";
+        }
+    }
+
+    void RunCase(const Case& item, size_t rows, const Options& options) {
+        if (!options.filter.empty() && item.name.find(options.filter) == std::string::npos) {
+            return;
+        }
+
+        double best = 0.0;
+        size_t outputRows = 0;
+        size_t peak = 0;
+        size_t repeat = item.repeat ? item.repeat : options.repeat;
+        for (size_t i = 0; i < repeat; ++i) {
+            ResetPeakMemory();
+            size_t before = CurrentMemory();
+            auto start = std::chrono::steady_clock::now();
+            try {
+                CellMatrix result = item.run();
+                outputRows = result.RowsInStructure();
+            } catch (const char* error) {
+                std::printf("%-18s %10zu failed: %s\n", item.name.c_str(), rows, error);
+                return;
+            }
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            size_t after = PeakMemory();
+            best = (i == 0) ? elapsed : std::min(best, elapsed);
+            peak = std::max(peak, after > before ? after - before : 0);
+        }
+
+        double throughput = best > 0.0 ? double(item.cells) / (best * 1000.0) : 0.0;
+        std::printf("%-18s %10zu %12zu %12.3f %12.2f %12zu %10.1f\n", item.name.c_str(), rows, item.cells, best, throughput, outputRows,
+                    double(peak) / (1024.0 * 1024.0));
+    }
+
+    void RunSize(size_t rows, const Options& options) {
+        TableGenerator generator(42 + rows);
+
+        // sets
+        CellMatrix keys = generator.MixedKeys(rows, 1, options.cardinality);
+        CellMatrix other = generator.MixedKeys(rows, 1, options.cardinality);
+        // lookups against a table of mostly distinct two field keys
+        CellMatrix table = generator.MixedKeys(rows, 2, rows);
+        CellMatrix lookup = generator.Sample(table, rows);
+        CellMatrix output = generator.Numbers(rows, 2, rows);
+        // pivots
+        CellMatrix values = generator.Numbers(rows, 1, 1000);
+        CellMatrix horizontal = generator.MixedKeys(rows, 1, options.cardinality);
+        CellMatrix vertical = generator.MixedKeys(rows, 1, 10);
+        // sorted lookups
+        CellMatrix sorted = generator.SortedNumbers(rows);
+        CellMatrix sortedLookup = generator.Numbers(rows, 1, rows * 2);
+        CellMatrix lower = generator.Numbers(std::max<size_t>(rows / 100, 1), 1, rows * 2);
+        CellMatrix upper{lower.RowsInStructure(), 1};
+        // keys of numbers only, taking the typed paths
+        CellMatrix numberKeys = generator.Numbers(rows, 1, options.cardinality);
+        CellMatrix numberTable = generator.Numbers(rows, 1, rows * 2);
+        CellMatrix numberLookup = generator.Numbers(rows, 1, rows * 2);
+        // fuzzy matches of misspelt names
+        CellMatrix names = generator.Names(rows);
+        CellMatrix misspelt = generator.Misspell(generator.Sample(names, rows));
+        for (size_t row = 0; row < lower.RowsInStructure(); ++row) {
+            upper(row, 0) = double(lower(row, 0)) + 10.0;
+        }
+
+        // blotter: trader, book and pnl
+        CellMatrix blotter{rows, 3};
+        {
+            CellMatrix traders = generator.MixedKeys(rows, 2, 100);
+            CellMatrix pnl = generator.Numbers(rows, 1, rows);
+            for (size_t row = 0; row < rows; ++row) {
+                blotter(row, 0) = traders(row, 0);
+                blotter(row, 1) = traders(row, 1);
+                blotter(row, 2) = double(pnl(row, 0)) - double(rows / 2);
+            }
+        }
+        CellMatrix traderPnl{1, 2};
+        traderPnl(0, 0) = 1.0;
+        traderPnl(0, 1) = 3.0;
+        CellMatrix ascDesc{1, 2};
+        ascDesc(0, 0) = "asc";
+        ascDesc(0, 1) = "desc";
+        CellMatrix pnlColumn(3.0);
+        CellMatrix descending("desc");
+        CellMatrix hundred(100.0);
+        CellMatrix three(3.0);
+
+        CellMatrix one(1.0);
+        CellMatrix empty;
+        CellMatrix aggregates{1, 5};
+        aggregates(0, 0) = "sum";
+        aggregates(0, 1) = "count";
+        aggregates(0, 2) = "min";
+        aggregates(0, 3) = "max";
+        aggregates(0, 4) = "mean";
+        CellMatrix sketchAggregates{1, 3};
+        sketchAggregates(0, 0) = "approxdistinct";
+        sketchAggregates(0, 1) = "median";
+        sketchAggregates(0, 2) = "p90";
+        CellMatrix havingCount("count >= 2");
+        CellMatrix sumDescending("sum desc");
+        CellMatrix quantiles{1, 3};
+        quantiles(0, 0) = 0.5;
+        quantiles(0, 1) = 0.9;
+        quantiles(0, 2) = 0.99;
+        CellMatrix liveValues = values;
+        size_t tick = 0;
+        std::string index;
+        auto indexHandle = [&] {
+            if (index.empty()) {
+                index = QFBuildIndex(table);
+            }
+            return index;
+        };
+
+        // the lookup and pivot inputs again, as a table file: columns 1-2 table, 3-4 output, 5 values, 6 horizontal, 7 vertical
+        std::string csvPath = (std::filesystem::temp_directory_path() / "QFBenchmark.csv").string();
+        std::string tablePath = (std::filesystem::temp_directory_path() / "QFBenchmark.qft").string();
+        bool csvWritten = false;
+        auto csvFile = [&] {
+            if (!csvWritten) {
+                WriteCsv(csvPath, {&table, &output, &values, &horizontal, &vertical});
+                csvWritten = true;
+            }
+            return csvPath;
+        };
+        auto tableFile = [&] {
+            if (!std::filesystem::exists(tablePath)) {
+                QFConvertCsv(csvFile(), tablePath);
+            }
+            return tablePath;
+        };
+        std::string fileHandle;
+        auto fileColumns = [&](const char* columns) {
+            if (fileHandle.empty()) {
+                fileHandle = QFOpenTable(tableFile());
+            }
+            return CellMatrix(fileHandle + columns);
+        };
+
+        std::vector<Case> cases{
+            {"QFSort", rows, [&] { return QFSort(keys); }},
+            {"QFUnique", rows, [&] { return QFUnique(keys); }},
+            {"QFUnion", 2 * rows, [&] { return QFUnion(keys, other, empty, empty, empty, empty); }},
+            {"QFIntersection", 2 * rows, [&] { return QFIntersection(keys, other, empty, empty, empty, empty); }},
+            {"QFExcept", 2 * rows, [&] { return QFExcept(keys, other, empty, empty, empty, empty); }},
+            {"QFUnique num", rows, [&] { return QFUnique(numberKeys); }},
+            {"QFUnion num", 2 * rows, [&] { return QFUnion(numberTable, numberLookup, empty, empty, empty, empty); }},
+            {"QFExactMatch", 4 * rows, [&] { return QFExactMatch(lookup, table, one); }},
+            {"QFExactVLookup", 6 * rows, [&] { return QFExactVLookup(lookup, table, output); }},
+            {"QFExactVLookup num", 4 * rows, [&] { return QFExactVLookup(numberLookup, numberTable, output); }},
+            {"QFFilter", 6 * rows, [&] { return QFFilter(lookup, table, output, one); }},
+            {"QFIn", 4 * rows, [&] { return QFIn(lookup, table); }},
+            {"QFNotIn", 4 * rows, [&] { return QFNotIn(lookup, table); }},
+            {"QFIn num", 2 * rows, [&] { return QFIn(numberLookup, numberTable); }},
+            {"QFFuzzyMatch", 2 * rows, [&] { return QFFuzzyMatch(misspelt, names, empty, three, one); }},
+            {"QFBuildIndex", 2 * rows, [&] { return CellMatrix(index = QFBuildIndex(table)); }, 1},
+            {"QFIndexLookup", 4 * rows, [&] { return QFIndexLookup(lookup, indexHandle(), output); }},
+            {"QFIndexMatch", 2 * rows, [&] { return QFIndexMatch(lookup, indexHandle(), one); }},
+            {"QFIndexFilter", 4 * rows, [&] { return QFIndexFilter(lookup, indexHandle(), output, one); }},
+            {"QFPivotCount", 2 * rows, [&] { return QFPivotCount(horizontal, vertical); }},
+            {"QFPivotSum", 3 * rows, [&] { return QFPivotSum(values, horizontal, vertical); }},
+            {"QFPivotSum num", 3 * rows, [&] { return QFPivotSum(values, numberKeys, vertical); }},
+            {"QFPivotMax", 3 * rows, [&] { return QFPivotMax(values, horizontal, vertical); }},
+            {"QFPivotMin", 3 * rows, [&] { return QFPivotMin(values, horizontal, vertical); }},
+            {"QFPivot", 3 * rows, [&] { return QFPivot(values, horizontal, vertical, aggregates); }},
+            {"QFLivePivot tick", 3 * rows,
+             [&] {
+                 // one value changes per call, as with a live feed; the first call builds the state
+                 ++tick;
+                 liveValues(tick % rows, 0) = double(tick);
+                 return QFLivePivot("QFBenchmark", liveValues, horizontal, vertical, aggregates);
+             }},
+            {"QFPivot sketches", 3 * rows, [&] { return QFPivot(values, horizontal, vertical, sketchAggregates); }},
+            {"QFGroupBy", 4 * rows, [&] { return QFGroupBy(table, output, aggregates, empty, empty); }},
+            {"QFGroupBy having", 4 * rows, [&] { return QFGroupBy(table, output, aggregates, havingCount, sumDescending); }},
+            {"QFGroupBy num", 2 * rows, [&] { return QFGroupBy(numberKeys, values, aggregates, empty, empty); }},
+            {"QFWindow sum", 3 * rows, [&] { return QFWindow(values, horizontal, numberLookup, "sum"); }},
+            {"QFWindow rank", 3 * rows, [&] { return QFWindow(values, horizontal, numberLookup, "rank"); }},
+            {"QFWindow mavg", 3 * rows, [&] { return QFWindow(values, horizontal, numberLookup, "movingaverage 20"); }},
+            {"QFApproxDistinct", rows, [&] { return CellMatrix(QFApproxDistinct(keys, empty)); }},
+            {"QFApproxQuantile", rows, [&] { return QFApproxQuantile(values, quantiles, empty); }},
+            {"QFApproxTopK", rows, [&] { return QFApproxTopK(keys, 10.0, empty); }},
+            {"QFSortBy", 3 * rows, [&] { return QFSortBy(blotter, traderPnl, ascDesc, empty); }},
+            {"QFSortBy pnl", 3 * rows, [&] { return QFSortBy(blotter, pnlColumn, descending, empty); }},
+            {"QFSortBy top 100", 3 * rows, [&] { return QFSortBy(blotter, pnlColumn, descending, hundred); }},
+            {"QFConvertCsv", 7 * rows, [&] { return CellMatrix(QFConvertCsv(csvFile(), tablePath)); }, 1},
+            {"QFOpenTable", 7 * rows, [&] { return CellMatrix(fileHandle = QFOpenTable(tableFile())); }},
+            {"QFExactVLookup map", 6 * rows, [&] { return QFExactVLookup(lookup, fileColumns(":1,2"), fileColumns(":3,4")); }},
+            {"QFPivotSum map", 3 * rows, [&] { return QFPivotSum(fileColumns(":5"), fileColumns(":6"), fileColumns(":7")); }},
+            {"QFJoin", 8 * rows, [&] { return QFJoin(lookup, output, table, output, "inner"); }},
+            {"QFSortedMatch", 2 * rows, [&] { return QFSortedMatch(sortedLookup, sorted, one, one); }},
+            {"QFSortedLookup", 3 * rows, [&] { return QFSortedLookup(sortedLookup, sorted, sortedLookup, one); }},
+            {"QFRangeLookup", 2 * rows, [&] { return QFRangeLookup(lower, upper, sorted, sorted); }},
+            {"QFSubmitPivotSum", 3 * rows,
+             [&] {
+                 // submit, poll the job as a sheet would, fetch its result, then drop the job so the next repetition runs it again
+                 std::string job = QFSubmitPivotSum(values, horizontal, vertical);
+                 for (std::string state = "queued"; state == "queued" || state == "running"; state = std::string(QFJobStatus(job)(1, 0))) {
+                     std::this_thread::sleep_for(std::chrono::microseconds(100));
+                 }
+                 CellMatrix result = QFJobResult(job);
+                 QFJobCancel(job);
+                 return result;
+             }},
+            // last, as the result cache stays on until all cases have run: the first call fills it, the others are answered from it
+            {"QFPivotSum cached", 3 * rows,
+             [&] {
+                 QFSetCacheBudget(256.0);
+                 return QFPivotSum(values, horizontal, vertical);
+             }},
+        };
+
+        for (auto& item : cases) {
+            RunCase(item, rows, options);
+        }
+        QFSetCacheBudget(0.0);
+        std::remove(csvPath.c_str());
+        std::remove(tablePath.c_str());
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options = ParseOptions(argc, argv);
+
+    PrintHeader();
+    for (size_t rows : options.rows) {
+        RunSize(rows, options);
+    }
+
+    if (options.stats) {
+        CellMatrix stats = QFStats();
+        std::printf("\n");
+        for (size_t row = 0; row < stats.RowsInStructure(); ++row) {
+            for (size_t col = 0; col < stats.ColumnsInStructure(); ++col) {
+                if (stats(row, col).IsString()) {
+                    std::printf(col == 0 ? "%-18s" : " %12s", stats(row, col).StringValue().c_str());
+                } else {
+                    std::printf(" %12.6g", stats(row, col).NumericValue());
+                }
+            }
+            std::printf("\n");
+        }
+    }
+    return 0;
+}
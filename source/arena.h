@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*************************************
+bump allocator: memory is handed out from large blocks and only released all at once, when the arena goes away
+*************************************/
+
+class Arena {
+  public:
+    explicit Arena(size_t blockSize = size_t(64) << 10) : blockSize_(blockSize) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& other) noexcept
+        : blockSize_(other.blockSize_), blocks_(std::move(other.blocks_)), next_(std::exchange(other.next_, nullptr)),
+          left_(std::exchange(other.left_, 0)), reserved_(std::exchange(other.reserved_, 0)) {}
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        // large requests get a block of their own, so the current one keeps serving small ones
+        if (size + alignment > blockSize_ / 4) {
+            char* block = NewBlock(size + alignment);
+            return block + Padding(block, alignment);
+        }
+        if (next_ == nullptr || Padding(next_, alignment) + size > left_) {
+            next_ = NewBlock(blockSize_);
+            left_ = blockSize_;
+        }
+        char* result = next_ + Padding(next_, alignment);
+        left_ -= size_t(result + size - next_);
+        next_ = result + size;
+        return result;
+    }
+
+    // a copy of the text that lives as long as the arena
+    std::string_view Copy(std::string_view text) {
+        if (text.empty()) {
+            return std::string_view();
+        }
+        char* data = static_cast<char*>(Allocate(text.size(), 1));
+        std::memcpy(data, text.data(), text.size());
+        return std::string_view(data, text.size());
+    }
+
+    size_t MemoryUsage() const { return reserved_ + blocks_.capacity() * sizeof(blocks_[0]); }
+
+  private:
+    static size_t Padding(const char* data, size_t alignment) { return (alignment - reinterpret_cast<uintptr_t>(data) % alignment) % alignment; }
+
+    // uninitialized memory, unlike std::make_unique<char[]>
+    char* NewBlock(size_t capacity) {
+        blocks_.push_back(std::unique_ptr<char[]>(new char[capacity]));
+        reserved_ += capacity;
+        return blocks_.back().get();
+    }
+
+    size_t blockSize_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* next_{nullptr};
+    size_t left_{0};
+    size_t reserved_{0};
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cellitem.h"
+
+/*************************************
+hash functions, consistent with the equality implied by operator< on QFCellValue
+*************************************/
+
+// finalizer of MurmurHash3
+inline uint64_t HashMix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline uint64_t HashCombine(uint64_t seed, uint64_t value) { return HashMix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2))); }
+
+inline uint64_t HashBytes(const char* data, size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (size * 0xc2b2ae3d27d4eb4fULL);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t chunk;
+        std::memcpy(&chunk, data + i, 8);
+        hash = (hash ^ HashMix(chunk)) * 0x9fb21c651e98df25ULL;
+    }
+    if (i < size) {
+        uint64_t chunk{0};
+        std::memcpy(&chunk, data + i, size - i);
+        hash = (hash ^ HashMix(chunk)) * 0x9fb21c651e98df25ULL;
+    }
+    return HashMix(hash);
+}
+
+inline uint64_t DoubleBits(double value) {
+    // -0.0 and 0.0 are equivalent under operator<
+    if (!(value < 0.0) && !(0.0 < value)) {
+        value = 0.0;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline uint64_t HashDouble(double value) { return HashMix(DoubleBits(value)); }
+
+template <typename T> uint64_t HashCell(const T& item) {
+    CellValueType type = GetType(item);
+    switch (type) {
+    case CVT_NUMBER:
+        return HashCombine(type, HashDouble(double(item)));
+    case CVT_STRING: {
+        std::string scratch;
+        std::string_view value = CellText(item, scratch);
+        return HashCombine(type, HashBytes(value.data(), value.size()));
+    }
+    case CVT_BOOLEAN:
+        return HashCombine(type, bool(item) ? 1 : 0);
+    case CVT_ERROR:
+        return HashCombine(type, item.ErrorValue());
+    default:
+        // all empty (and unknown) cells are equivalent
+        return HashMix(type);
+    }
+}
+
+template <typename L, typename R> bool EqualCell(const L& lhs, const R& rhs) {
+    CellValueType type = GetType(lhs);
+    if (type != GetType(rhs)) {
+        return false;
+    }
+    switch (type) {
+    case CVT_NUMBER: {
+        double lValue = double(lhs);
+        double rValue = double(rhs);
+        return !(lValue < rValue) && !(rValue < lValue);
+    }
+    case CVT_STRING: {
+        std::string lScratch, rScratch;
+        return CellText(lhs, lScratch) == CellText(rhs, rScratch);
+    }
+    case CVT_BOOLEAN:
+        return bool(lhs) == bool(rhs);
+    case CVT_ERROR:
+        return lhs.ErrorValue() == rhs.ErrorValue();
+    default:
+        return true;
+    }
+}
+
+// content fingerprint of a whole table, shape included
+template <class Matrix> uint64_t HashMatrix(const Matrix& x) {
+    uint64_t hash = HashCombine(x.RowsInStructure(), x.ColumnsInStructure());
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            hash = HashCombine(hash, HashCell(x(row, col)));
+        }
+    }
+    return hash;
+}
+
+/*************************************
+a second hash, from other constants and another combining step than the hash above, so that content on which one collides is
+told apart by the other; a cache keyed by one hash checks its hits with the other
+*************************************/
+
+// finalizer of SplitMix64
+inline uint64_t CheckMix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+inline uint64_t CheckCombine(uint64_t seed, uint64_t value) { return CheckMix((seed << 23 | seed >> 41) + value * 0xd6e8feb86659fd93ULL); }
+
+inline uint64_t CheckBytes(const char* data, size_t size) {
+    uint64_t hash = CheckMix(size + 0x2545f4914f6cdd1dULL);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t chunk;
+        std::memcpy(&chunk, data + i, 8);
+        hash = CheckCombine(hash, chunk);
+    }
+    if (i < size) {
+        uint64_t chunk{0};
+        std::memcpy(&chunk, data + i, size - i);
+        hash = CheckCombine(hash, chunk);
+    }
+    return hash;
+}
+
+// the hash and the check hash of a cell, from one read of its content
+template <typename T> std::pair<uint64_t, uint64_t> DigestCell(const T& item, std::string& scratch) {
+    CellValueType type = GetType(item);
+    uint64_t value{0};
+    switch (type) {
+    case CVT_NUMBER:
+        value = DoubleBits(double(item));
+        break;
+    case CVT_STRING: {
+        std::string_view text = CellText(item, scratch);
+        return {HashCombine(type, HashBytes(text.data(), text.size())), CheckCombine(type, CheckBytes(text.data(), text.size()))};
+    }
+    case CVT_BOOLEAN:
+        value = bool(item) ? 1 : 0;
+        break;
+    case CVT_ERROR:
+        value = item.ErrorValue();
+        break;
+    default:
+        break;
+    }
+    return {HashCombine(type, HashMix(value)), CheckCombine(type, value)};
+}
+
+// the hash and the check hash of a whole table, shape included
+template <class Matrix> std::pair<uint64_t, uint64_t> DigestMatrix(const Matrix& x) {
+    std::pair<uint64_t, uint64_t> digest{HashCombine(x.RowsInStructure(), x.ColumnsInStructure()),
+                                         CheckCombine(x.RowsInStructure(), x.ColumnsInStructure())};
+    std::string scratch;
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            auto cell = DigestCell(x(row, col), scratch);
+            digest.first = HashCombine(digest.first, cell.first);
+            digest.second = CheckCombine(digest.second, cell.second);
+        }
+    }
+    return digest;
+}
+
+struct HashCellValue {
+    template <typename T> uint64_t operator()(const T& item) const { return HashCell(item); }
+};
+
+struct EqualCellValue {
+    template <typename L, typename R> bool operator()(const L& lhs, const R& rhs) const { return EqualCell(lhs, rhs); }
+};
+
+struct HashInteger {
+    uint64_t operator()(uint64_t value) const { return HashMix(value); }
+};
+
+struct EqualInteger {
+    bool operator()(uint64_t lhs, uint64_t rhs) const { return lhs == rhs; }
+};
+
+/*************************************
+open addressing hash set, mapping each distinct key to a dense id (its insertion order)
+*************************************/
+
+template <class Key, class Hash, class Equal> class FlatHashSet {
+  public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit FlatHashSet(Hash hash = Hash(), Equal equal = Equal()) : hash_(hash), equal_(equal) {}
+
+    size_t size() const { return items_.size(); }
+    bool empty() const { return items_.empty(); }
+    const Key& operator[](size_t id) const { return items_[id]; }
+    const std::vector<Key>& items() const { return items_; }
+    std::vector<Key> release() {
+        slots_.clear();
+        bits_ = 0;
+        return std::move(items_);
+    }
+
+    void reserve(size_t count) {
+        items_.reserve(count);
+        Grow(count);
+    }
+
+    // the id of the probe, or npos if absent; the probe may be any type that Hash and Equal accept
+    template <class K> size_t find(const K& probe) const { return slots_.empty() ? npos : find(probe, hash_(probe)); }
+
+    // as find, with hash the value of Hash for the probe
+    template <class K> size_t find(const K& probe, uint64_t hash) const {
+        if (slots_.empty()) {
+            return npos;
+        }
+        uint32_t tag = uint32_t(hash >> 32);
+        for (size_t slot = tag >> (32 - bits_);; slot = (slot + 1) & (slots_.size() - 1)) {
+            uint64_t entry = slots_[slot];
+            if (entry == 0) {
+                return npos;
+            }
+            if (uint32_t(entry >> 32) == tag && equal_(items_[size_t(uint32_t(entry)) - 1], probe)) {
+                return size_t(uint32_t(entry)) - 1;
+            }
+        }
+    }
+
+    // returns the id of the probe and whether it was new; make(probe) builds the stored key and is only called for new items
+    template <class K, class Factory> std::pair<size_t, bool> find_or_insert(const K& probe, Factory make) {
+        return find_or_insert(probe, hash_(probe), make);
+    }
+
+    template <class K, class Factory> std::pair<size_t, bool> find_or_insert(const K& probe, uint64_t hash, Factory make) {
+        Grow(items_.size() + 1);
+        uint32_t tag = uint32_t(hash >> 32);
+        size_t slot = tag >> (32 - bits_);
+        for (;; slot = (slot + 1) & (slots_.size() - 1)) {
+            uint64_t entry = slots_[slot];
+            if (entry == 0) {
+                break;
+            }
+            if (uint32_t(entry >> 32) == tag && equal_(items_[size_t(uint32_t(entry)) - 1], probe)) {
+                return {size_t(uint32_t(entry)) - 1, false};
+            }
+        }
+        items_.emplace_back(make(probe));
+        slots_[slot] = (uint64_t(tag) << 32) | uint64_t(items_.size());
+        return {items_.size() - 1, true};
+    }
+
+    std::pair<size_t, bool> insert(const Key& key) {
+        return find_or_insert(key, [](const Key& item) { return item; });
+    }
+
+  private:
+    // keep the load factor at or below one half
+    void Grow(size_t count) {
+        if (count * 2 <= slots_.size()) {
+            return;
+        }
+        size_t bits = std::max<size_t>(bits_, 4);
+        while ((size_t(1) << bits) < count * 2) {
+            ++bits;
+        }
+        if (bits > 32) {
+            throw("Too many distinct items.");
+        }
+        std::vector<uint64_t> slots(size_t(1) << bits, 0);
+        for (uint64_t entry : slots_) {
+            if (entry != 0) {
+                size_t slot = uint32_t(entry >> 32) >> (32 - bits);
+                while (slots[slot] != 0) {
+                    slot = (slot + 1) & (slots.size() - 1);
+                }
+                slots[slot] = entry;
+            }
+        }
+        slots_ = std::move(slots);
+        bits_ = bits;
+    }
+
+    Hash hash_;
+    Equal equal_;
+    std::vector<uint64_t> slots_; // hash tag in the upper half, id + 1 in the lower half, 0 when empty
+    size_t bits_{0};
+    std::vector<Key> items_;
+};
@@ -1,8 +1,13 @@
 #pragma once
 
-#include <xlw/xlw.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
-using QFCellValue = xlw::impl::MJCellValue;
+#include <xlw/xlw.h>
 
 const auto EXCEL_ERROR_DIV_0 = xlw::CellValue::error_type{7};
 const auto EXCEL_ERROR_NA = xlw::CellValue::error_type{42};
@@ -29,29 +34,170 @@ template <typename T> CellValueType GetType(const T& item) {
         return CVT_UNKNOWN;
 }
 
-bool operator<(const QFCellValue& lhs, const QFCellValue& rhs) {
-    CellValueType lType = GetType(lhs);
-    CellValueType rType = GetType(rhs);
+// the text of a string cell: no copy when the cell type hands out its string by reference or as a view, otherwise it goes through scratch
+template <typename SourceType> std::string_view CellText(const SourceType& item, std::string& scratch) {
+    using Text = decltype(item.StringValue());
+    if constexpr (std::is_reference_v<Text> || std::is_same_v<Text, std::string_view>) {
+        return item.StringValue();
+    } else {
+        scratch = item.StringValue();
+        return scratch;
+    }
+}
+
+/*************************************
+compact cell: any cell value in 16 bytes, the type in the last byte; strings of up to 14 characters are held inline, longer ones in
+a heap block of their own
+*************************************/
 
-    if (lType < rType)
-        return true;
-    else if (rType < lType)
+class alignas(8) QFCellValue {
+  public:
+    static constexpr size_t SMALL_STRING = 14;
+
+    QFCellValue() : size_(0), tag_(CVT_EMPTY) {}
+    QFCellValue(double value) : size_(0), tag_(CVT_NUMBER) { std::memcpy(data_, &value, sizeof(value)); }
+    QFCellValue(bool value) : size_(0), tag_(CVT_BOOLEAN) { data_[0] = value ? 1 : 0; }
+    QFCellValue(unsigned long errorCode, bool) : size_(0), tag_(CVT_ERROR) {
+        uint64_t code = errorCode;
+        std::memcpy(data_, &code, sizeof(code));
+    }
+    explicit QFCellValue(std::string_view value) : size_(0), tag_(CVT_STRING) { Assign(value); }
+
+    QFCellValue(const QFCellValue& other) : size_(0), tag_(CVT_EMPTY) { *this = other; }
+    QFCellValue(QFCellValue&& other) noexcept : size_(0), tag_(CVT_EMPTY) { *this = std::move(other); }
+    ~QFCellValue() { Release(); }
+
+    QFCellValue& operator=(const QFCellValue& other) {
+        if (this != &other) {
+            Release();
+            if (other.IsLong()) {
+                tag_ = CVT_STRING;
+                Assign(other.StringValue());
+            } else {
+                std::memcpy(data_, other.data_, sizeof(data_));
+                size_ = other.size_;
+                tag_ = other.tag_;
+            }
+        }
+        return *this;
+    }
+
+    // the heap block of a long string moves with the cell
+    QFCellValue& operator=(QFCellValue&& other) noexcept {
+        if (this != &other) {
+            Release();
+            std::memcpy(data_, other.data_, sizeof(data_));
+            size_ = other.size_;
+            tag_ = std::exchange(other.tag_, uint8_t(CVT_EMPTY));
+        }
+        return *this;
+    }
+
+    CellValueType Type() const { return CellValueType(tag_ & ~LONG_STRING); }
+
+    bool IsANumber() const { return tag_ == CVT_NUMBER; }
+    bool IsString() const { return Type() == CVT_STRING; }
+    bool IsBoolean() const { return tag_ == CVT_BOOLEAN; }
+    bool IsError() const { return tag_ == CVT_ERROR; }
+    bool IsEmpty() const { return tag_ == CVT_EMPTY; }
+
+    explicit operator std::string() const { return std::string(StringValue()); }
+    operator double() const { return NumericValue(); }
+    operator bool() const { return BooleanValue(); }
+
+    std::string_view StringValue() const {
+        if (!IsString())
+            throw("non string requested");
+        if (!IsLong())
+            return {data_, size_};
+        const char* text;
+        uint32_t size;
+        std::memcpy(&text, data_, sizeof(text));
+        std::memcpy(&size, data_ + sizeof(text), sizeof(size));
+        return {text, size};
+    }
+
+    double NumericValue() const {
+        if (!IsANumber())
+            throw("non number requested");
+        double value;
+        std::memcpy(&value, data_, sizeof(value));
+        return value;
+    }
+
+    bool BooleanValue() const {
+        if (!IsBoolean())
+            throw("non boolean requested");
+        return data_[0] != 0;
+    }
+
+    unsigned long ErrorValue() const {
+        if (!IsError())
+            throw("non error requested");
+        uint64_t code;
+        std::memcpy(&code, data_, sizeof(code));
+        return (unsigned long)code;
+    }
+
+  private:
+    static constexpr uint8_t LONG_STRING = 0x80;
+
+    bool IsLong() const { return (tag_ & LONG_STRING) != 0; }
+
+    // the cell holds no heap block when called
+    void Assign(std::string_view value) {
+        if (value.size() <= SMALL_STRING) {
+            std::memcpy(data_, value.data(), value.size());
+            size_ = uint8_t(value.size());
+            return;
+        }
+        char* text = new char[value.size()];
+        std::memcpy(text, value.data(), value.size());
+        uint32_t size = uint32_t(value.size());
+        std::memcpy(data_, &text, sizeof(text));
+        std::memcpy(data_ + sizeof(text), &size, sizeof(size));
+        size_ = 0;
+        tag_ = uint8_t(CVT_STRING | LONG_STRING);
+    }
+
+    void Release() {
+        if (IsLong()) {
+            char* text;
+            std::memcpy(&text, data_, sizeof(text));
+            delete[] text;
+        }
+        tag_ = CVT_EMPTY;
+    }
+
+    char data_[SMALL_STRING]; // number, boolean, error code, inline string, or pointer and size of a long string
+    uint8_t size_;            // size of an inline string
+    uint8_t tag_;             // CellValueType, with LONG_STRING for a string on the heap
+};
+
+static_assert(sizeof(QFCellValue) == 16, "QFCellValue must stay 16 bytes");
+
+// the type of a compact cell is read from its tag, not found by asking each type in turn
+inline CellValueType GetType(const QFCellValue& item) { return item.Type(); }
+
+inline bool operator<(const QFCellValue& lhs, const QFCellValue& rhs) {
+    CellValueType lType = lhs.Type();
+    CellValueType rType = rhs.Type();
+
+    if (lType != rType) {
+        return lType < rType;
+    }
+    switch (lType) {
+    case CVT_NUMBER:
+        return lhs.NumericValue() < rhs.NumericValue();
+    case CVT_STRING:
+        return lhs.StringValue() < rhs.StringValue();
+    case CVT_BOOLEAN:
+        return lhs.BooleanValue() < rhs.BooleanValue();
+    case CVT_ERROR:
+        return lhs.ErrorValue() < rhs.ErrorValue();
+    default:
+        // all empty cells are equivalent
         return false;
-    else {
-        if (lType == CVT_NUMBER)
-            return lhs.NumericValue() < rhs.NumericValue();
-        else if (lType == CVT_STRING)
-            return lhs.StringValue() < rhs.StringValue();
-        else if (lType == CVT_BOOLEAN)
-            return lhs.BooleanValue() < rhs.BooleanValue();
-        else if (lType == CVT_ERROR)
-            return lhs.ErrorValue() < rhs.ErrorValue();
-        else if (lType == CVT_EMPTY)
-            return false;
-        else if (lType == CVT_UNKNOWN) // for blank cells ???
-            return false;
-        else
-            return true;
     }
 }
 
@@ -59,9 +205,10 @@ template <typename SourceType> QFCellValue Convert2QFCellValue(const SourceType&
 
     if (item.IsANumber())
         return QFCellValue(double(item));
-    else if (item.IsString())
-        return QFCellValue(std::string(item));
-    else if (item.IsBoolean())
+    else if (item.IsString()) {
+        std::string scratch;
+        return QFCellValue(CellText(item, scratch));
+    } else if (item.IsBoolean())
         return QFCellValue(bool(item));
     else if (item.IsError())
         return QFCellValue(item.ErrorValue(), true);
@@ -92,7 +239,7 @@ template <typename SourceType> bool CheckCellValue(const SourceType& item, std::
         return false;
 }
 
-void Convert2CellValue(const QFCellValue& item, xlw::CellValue& result) {
+inline void Convert2CellValue(const QFCellValue& item, xlw::CellValue& result) {
 
     if (item.IsANumber())
         result = double(item);
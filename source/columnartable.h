@@ -0,0 +1,581 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "cellhash.h"
+#include "cellitem.h"
+#include "parallel.h"
+
+/*************************************
+cell codes: every cell is one 64 bit integer, so keys hash and compare as integers
+numbers are stored as their bits (-0.0 and NaN made canonical), the other types as negative quiet NaNs tagged with the type
+*************************************/
+
+using CellCode = uint64_t;
+
+constexpr uint64_t CELL_CODE_TAG = 0xfff8;
+constexpr uint32_t MISSING_STRING = 0xffffffff; // id of a string that is not in the pool
+
+inline CellCode TaggedCode(CellValueType type, uint32_t payload) { return ((CELL_CODE_TAG + type) << 48) | payload; }
+
+inline CellCode NumberCode(double value) {
+    if (std::isnan(value)) {
+        return 0x7ff8000000000000ULL;
+    }
+    if (!(value < 0.0) && !(0.0 < value)) {
+        value = 0.0;
+    }
+    CellCode code;
+    std::memcpy(&code, &value, sizeof(code));
+    return code;
+}
+
+inline CellValueType CodeType(CellCode code) {
+    uint64_t tag = code >> 48;
+    if (tag > CELL_CODE_TAG && tag <= CELL_CODE_TAG + CVT_UNKNOWN) {
+        return CellValueType(tag - CELL_CODE_TAG);
+    }
+    return CVT_NUMBER;
+}
+
+inline double CodeNumber(CellCode code) {
+    double value;
+    std::memcpy(&value, &code, sizeof(value));
+    return value;
+}
+
+inline uint32_t CodePayload(CellCode code) { return uint32_t(code); }
+
+// the number of a code known to hold one, throws otherwise
+inline double NumericCode(CellCode code) {
+    if (CodeType(code) != CVT_NUMBER) {
+        throw("The values must be numbers.");
+    }
+    return CodeNumber(code);
+}
+
+/*************************************
+string pool: interned strings with dense ids
+the strings are views, probed straight from the cells; only the distinct ones are copied, into the arena of the pool
+*************************************/
+
+struct HashString {
+    uint64_t operator()(std::string_view value) const { return HashBytes(value.data(), value.size()); }
+};
+
+struct EqualString {
+    bool operator()(std::string_view lhs, std::string_view rhs) const { return lhs == rhs; }
+};
+
+class StringPool {
+  public:
+    uint32_t Intern(std::string_view value) {
+        return uint32_t(strings_.find_or_insert(value, [&](std::string_view item) { return arena_.Copy(item); }).first);
+    }
+
+    // MISSING_STRING if the value has never been interned
+    uint32_t Find(std::string_view value) const {
+        size_t id = strings_.find(value);
+        return id == Strings::npos ? MISSING_STRING : uint32_t(id);
+    }
+
+    std::string_view operator[](uint32_t id) const { return strings_[id]; }
+    size_t Size() const { return strings_.size(); }
+
+    size_t MemoryUsage() const { return strings_.items().capacity() * (sizeof(std::string_view) + 2 * sizeof(uint64_t)) + arena_.MemoryUsage(); }
+
+  private:
+    using Strings = FlatHashSet<std::string_view, HashString, EqualString>;
+    Arena arena_; // declared before strings_, which points into it
+    Strings strings_;
+};
+
+// string encoders: interning adds new strings to the pool, finding encodes them as MISSING_STRING, which matches no table cell
+struct InternStrings {
+    StringPool& pool;
+    uint32_t operator()(std::string_view value) const { return pool.Intern(value); }
+};
+
+struct FindStrings {
+    const StringPool& pool;
+    uint32_t operator()(std::string_view value) const { return pool.Find(value); }
+};
+
+// scratch holds the text of a string cell when the cell type cannot hand it out by reference
+template <typename SourceType, class StringEncoder> CellCode EncodeCell(const SourceType& item, StringEncoder& encodeString, std::string& scratch) {
+    CellValueType type = GetType(item);
+    switch (type) {
+    case CVT_NUMBER:
+        return NumberCode(double(item));
+    case CVT_STRING:
+        return TaggedCode(type, encodeString(CellText(item, scratch)));
+    case CVT_BOOLEAN:
+        return TaggedCode(type, bool(item) ? 1 : 0);
+    case CVT_ERROR:
+        return TaggedCode(type, uint32_t(item.ErrorValue()));
+    default:
+        return TaggedCode(type, 0);
+    }
+}
+
+inline void DecodeCell(CellCode code, const StringPool& pool, xlw::CellValue& result) {
+    switch (CodeType(code)) {
+    case CVT_NUMBER:
+        result = CodeNumber(code);
+        break;
+    case CVT_STRING:
+        result = std::string(pool[CodePayload(code)]);
+        break;
+    case CVT_BOOLEAN:
+        result = CodePayload(code) != 0;
+        break;
+    case CVT_ERROR:
+        result = xlw::CellValue::error_type{CodePayload(code)};
+        break;
+    default:
+        result.clear();
+    }
+}
+
+// same order as operator< on QFCellValue
+inline bool LessCode(CellCode lhs, CellCode rhs, const StringPool& pool) {
+    CellValueType lType = CodeType(lhs);
+    CellValueType rType = CodeType(rhs);
+
+    if (lType != rType) {
+        return lType < rType;
+    }
+    switch (lType) {
+    case CVT_NUMBER:
+        return CodeNumber(lhs) < CodeNumber(rhs);
+    case CVT_STRING:
+        return pool[CodePayload(lhs)] < pool[CodePayload(rhs)];
+    case CVT_BOOLEAN:
+    case CVT_ERROR:
+        return CodePayload(lhs) < CodePayload(rhs);
+    default:
+        return false;
+    }
+}
+
+/*************************************
+normalized keys: the cells of a key as one byte string, whose memcmp order is the operator< order of the cells column by column
+each cell is its type byte, then a number as 8 big endian bytes of its ordered bits, a string with its zero bytes escaped and two
+zero bytes at its end, a boolean as one byte, an error as 4 big endian bytes; no cell encoding is the prefix of another
+*************************************/
+
+// flips the bits of a double so that unsigned integer order is numeric order
+inline uint64_t OrderedDoubleBits(double value) {
+    uint64_t bits = NumberCode(value);
+    return (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+}
+
+inline void AppendBigEndian(uint64_t value, size_t bytes, std::string& key) {
+    for (size_t i = bytes; i-- > 0;) {
+        key.push_back(char((value >> (8 * i)) & 0xff));
+    }
+}
+
+inline void AppendNormalizedCell(CellCode code, const StringPool& pool, std::string& key) {
+    CellValueType type = CodeType(code);
+    key.push_back(char(type));
+    switch (type) {
+    case CVT_NUMBER:
+        AppendBigEndian(OrderedDoubleBits(CodeNumber(code)), 8, key);
+        break;
+    case CVT_STRING:
+        for (char c : pool[CodePayload(code)]) {
+            key.push_back(c);
+            if (c == 0) {
+                key.push_back(char(0xff));
+            }
+        }
+        key.append(2, char(0));
+        break;
+    case CVT_BOOLEAN:
+        key.push_back(char(CodePayload(code)));
+        break;
+    case CVT_ERROR:
+        AppendBigEndian(CodePayload(code), 4, key);
+        break;
+    default:
+        break;
+    }
+}
+
+// the normalized keys of many rows, packed in one buffer
+class NormalizedKeys {
+  public:
+    // key(i) is the i-th key, as width cell codes
+    template <class KeyCodes> NormalizedKeys(size_t count, size_t width, const StringPool& pool, KeyCodes key) : offsets_(count + 1, 0) {
+        bytes_.reserve(count * width * 9);
+        for (size_t i = 0; i < count; ++i) {
+            const CellCode* codes = key(i);
+            for (size_t col = 0; col < width; ++col) {
+                AppendNormalizedCell(codes[col], pool, bytes_);
+            }
+            offsets_[i + 1] = bytes_.size();
+        }
+    }
+
+    std::string_view operator[](size_t i) const { return std::string_view(bytes_).substr(offsets_[i], offsets_[i + 1] - offsets_[i]); }
+
+    // one memcmp, as the keys are prefix free
+    bool Less(size_t lhs, size_t rhs) const { return (*this)[lhs] < (*this)[rhs]; }
+
+    // the first 8 bytes of the key as a big endian number, zero padded; keys with different prefixes are in the order of their
+    // prefixes, as no key is the prefix of another
+    uint64_t Prefix(size_t i) const {
+        uint64_t prefix = 0;
+        size_t size = offsets_[i + 1] - offsets_[i];
+        for (size_t byte = 0; byte < 8; ++byte) {
+            prefix = (prefix << 8) | (byte < size ? uint8_t(bytes_[offsets_[i] + byte]) : 0);
+        }
+        return prefix;
+    }
+
+  private:
+    std::string bytes_;
+    std::vector<size_t> offsets_;
+};
+
+/*************************************
+columnar table of cell codes
+*************************************/
+
+class ColumnarTable {
+  public:
+    ColumnarTable() = default;
+
+    template <class Matrix, class StringEncoder>
+    ColumnarTable(const Matrix& x, StringEncoder encodeString)
+        : rows_(x.RowsInStructure()), columns_(x.ColumnsInStructure()), types_(x.ColumnsInStructure(), 0) {
+        for (size_t col = 0; col < columns_.size(); ++col) {
+            columns_[col].resize(rows_);
+        }
+        // read the matrix row by row, as it is stored
+        std::string scratch;
+        for (size_t row = 0; row < rows_; ++row) {
+            JobCheckpoint(row);
+            for (size_t col = 0; col < columns_.size(); ++col) {
+                CellCode code = EncodeCell(x(row, col), encodeString, scratch);
+                columns_[col][row] = code;
+                types_[col] |= 1u << CodeType(code);
+            }
+        }
+    }
+
+    size_t Rows() const { return rows_; }
+    size_t Columns() const { return columns_.size(); }
+    CellCode operator()(size_t row, size_t col) const { return columns_[col][row]; }
+    const std::vector<CellCode>& Column(size_t col) const { return columns_[col]; }
+
+    // bit mask of the CellValueTypes present in the column
+    unsigned ColumnTypes(size_t col) const { return types_[col]; }
+
+    size_t MemoryUsage() const { return sizeof(*this) + rows_ * columns_.size() * sizeof(CellCode); }
+
+  private:
+    size_t rows_{0};
+    std::vector<std::vector<CellCode>> columns_;
+    std::vector<unsigned> types_;
+};
+
+/*************************************
+distinct multi column keys, stored as fixed width tuples of cell codes and mapped to dense ids
+*************************************/
+
+class KeyIndex {
+  public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit KeyIndex(size_t width)
+        : width_(width), codes_(std::make_unique<std::vector<CellCode>>()), ids_(KeyHash{width}, KeyEqual{width, codes_.get()}) {}
+
+    size_t Width() const { return width_; }
+    size_t Size() const { return ids_.size(); }
+    const CellCode* Key(size_t id) const { return codes_->data() + id * width_; }
+
+    // the id of the key held by a row of the table, and whether it is new
+    std::pair<size_t, bool> Insert(const ColumnarTable& table, size_t row) {
+        return ids_.find_or_insert(TableRow{table, row}, [&](const TableRow& item) {
+            for (size_t col = 0; col < width_; ++col) {
+                codes_->push_back(item.table(item.row, col));
+            }
+            return ids_.size();
+        });
+    }
+
+    // the id of the key held by a row of the table, or npos
+    size_t Find(const ColumnarTable& table, size_t row) const { return ids_.find(TableRow{table, row}); }
+
+    // room for count keys without growing
+    void Reserve(size_t count) {
+        codes_->reserve(count * width_);
+        ids_.reserve(count);
+    }
+
+    // ids in the order of their keys
+    // the prefixes sit next to the ids, so most comparisons do not read the keys
+    std::vector<size_t> SortedIds(const StringPool& pool) const {
+        NormalizedKeys keys(Size(), width_, pool, [&](size_t id) { return Key(id); });
+        std::vector<std::pair<uint64_t, size_t>> items(Size());
+        for (size_t id = 0; id < items.size(); ++id) {
+            items[id] = {keys.Prefix(id), id};
+        }
+        std::sort(begin(items), end(items), [&](const auto& lhs, const auto& rhs) {
+            return lhs.first != rhs.first ? lhs.first < rhs.first : keys.Less(lhs.second, rhs.second);
+        });
+        std::vector<size_t> ids(items.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = items[i].second;
+        }
+        return ids;
+    }
+
+    size_t MemoryUsage() const { return sizeof(*this) + codes_->capacity() * sizeof(CellCode) + Size() * (2 * sizeof(uint64_t) + sizeof(size_t)); }
+
+  private:
+    struct TableRow {
+        const ColumnarTable& table;
+        size_t row;
+    };
+
+    struct KeyHash {
+        size_t width;
+        uint64_t operator()(const TableRow& item) const {
+            uint64_t hash = width;
+            for (size_t col = 0; col < width; ++col) {
+                hash = HashCombine(hash, item.table(item.row, col));
+            }
+            return hash;
+        }
+    };
+
+    struct KeyEqual {
+        size_t width;
+        const std::vector<CellCode>* codes;
+        bool operator()(size_t id, const TableRow& item) const {
+            const CellCode* key = codes->data() + id * width;
+            for (size_t col = 0; col < width; ++col) {
+                if (key[col] != item.table(item.row, col)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    size_t width_;
+    std::unique_ptr<std::vector<CellCode>> codes_; // on the heap, so the functors stay valid when the index moves
+    FlatHashSet<size_t, KeyHash, KeyEqual> ids_;
+};
+
+/*************************************
+rows of a table grouped by key, keeping the table order inside each key
+*************************************/
+
+// the rows of every group id, bucketed in one array
+class RowBuckets {
+  public:
+    using RowRange = std::pair<const size_t*, const size_t*>;
+
+    RowBuckets() = default;
+
+    // groups[row] is the id of the group of each row, below count
+    RowBuckets(const std::vector<size_t>& groups, size_t count) : offsets_(count + 1, 0), rows_(groups.size()) {
+        for (size_t group : groups) {
+            ++offsets_[group + 1];
+        }
+        for (size_t id = 0; id < count; ++id) {
+            offsets_[id + 1] += offsets_[id];
+        }
+        std::vector<size_t> next(begin(offsets_), end(offsets_) - 1);
+        for (size_t row = 0; row < groups.size(); ++row) {
+            rows_[next[groups[row]]++] = row;
+        }
+    }
+
+    // the rows of the group, in table order
+    RowRange Rows(size_t id) const { return {rows_.data() + offsets_[id], rows_.data() + offsets_[id + 1]}; }
+
+    size_t MemoryUsage() const { return (offsets_.capacity() + rows_.capacity()) * sizeof(size_t); }
+
+  private:
+    std::vector<size_t> offsets_; // offsets_[id] .. offsets_[id + 1] is the slice of rows_ holding the group id
+    std::vector<size_t> rows_;    // rows bucketed by group
+};
+
+class KeyGroups {
+  public:
+    using RowRange = RowBuckets::RowRange;
+
+    explicit KeyGroups(const ColumnarTable& keys) : keys_(keys.Columns()) {
+        std::vector<size_t> groups(keys.Rows());
+        for (size_t row = 0; row < keys.Rows(); ++row) {
+            groups[row] = keys_.Insert(keys, row).first;
+        }
+        buckets_ = RowBuckets(groups, keys_.Size());
+    }
+
+    const KeyIndex& Keys() const { return keys_; }
+
+    // the key id of a row of another table, or KeyIndex::npos
+    size_t Find(const ColumnarTable& table, size_t row) const { return keys_.Find(table, row); }
+
+    // the rows holding the key, in table order
+    RowRange Rows(size_t id) const { return buckets_.Rows(id); }
+
+    size_t MemoryUsage() const { return keys_.MemoryUsage() + buckets_.MemoryUsage(); }
+
+  private:
+    KeyIndex keys_;
+    RowBuckets buckets_;
+};
+
+/*************************************
+distinct keys of one column holding numbers only, with the interface of KeyIndex
+the codes are held in the hash slots, so a probe reads one slot instead of the slot and the key, and the keys sort as doubles
+*************************************/
+
+class NumberKeyIndex {
+  public:
+    static constexpr size_t npos = size_t(-1);
+
+    struct Slot {
+        CellCode code;
+        uint32_t id;
+        uint32_t last; // last row inserted with the key
+    };
+
+    explicit NumberKeyIndex(size_t width = 1) { (void)width; }
+
+    // a single key column of numbers only, with 32 bit row numbers
+    static bool Accepts(const ColumnarTable& keys) {
+        return keys.Columns() == 1 && keys.ColumnTypes(0) == (1u << CVT_NUMBER) && keys.Rows() < EMPTY_ID;
+    }
+
+    size_t Width() const { return 1; }
+    size_t Size() const { return codes_.size(); }
+    const CellCode* Key(size_t id) const { return codes_.data() + id; }
+
+    std::pair<size_t, bool> Insert(const ColumnarTable& table, size_t row) {
+        CellCode code = table(row, 0);
+        Grow(codes_.size() + 1);
+        Slot& slot = slots_[Probe(code)];
+        bool inserted = slot.code == EMPTY_SLOT;
+        if (inserted) {
+            slot = Slot{code, uint32_t(codes_.size()), 0};
+            codes_.push_back(code);
+        }
+        slot.last = uint32_t(row);
+        return {slot.id, inserted};
+    }
+
+    // room for count keys without growing
+    void Reserve(size_t count) {
+        codes_.reserve(count);
+        Grow(count);
+    }
+
+    // the slot of the number, or nullptr
+    const Slot* Find(double value) const {
+        if (slots_.empty()) {
+            return nullptr;
+        }
+        const Slot& slot = slots_[Probe(NumberCode(value))];
+        return slot.code == EMPTY_SLOT ? nullptr : &slot;
+    }
+
+    // ids in the order of their keys
+    std::vector<size_t> SortedIds(const StringPool&) const {
+        std::vector<std::pair<double, size_t>> keys(codes_.size());
+        for (size_t id = 0; id < keys.size(); ++id) {
+            keys[id] = {CodeNumber(codes_[id]), id};
+        }
+        std::sort(begin(keys), end(keys));
+        std::vector<size_t> ids(keys.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = keys[i].second;
+        }
+        return ids;
+    }
+
+    size_t MemoryUsage() const { return sizeof(*this) + slots_.capacity() * sizeof(Slot) + codes_.capacity() * sizeof(CellCode); }
+
+  private:
+    static constexpr CellCode EMPTY_SLOT = ~CellCode(0); // a NaN that NumberCode never returns
+    static constexpr size_t EMPTY_ID = 0xffffffff;
+
+    // the slot holding the code, or the empty slot where it would go
+    size_t Probe(CellCode code) const {
+        size_t slot = size_t(HashMix(code) >> shift_);
+        while (slots_[slot].code != code && slots_[slot].code != EMPTY_SLOT) {
+            slot = (slot + 1) & (slots_.size() - 1);
+        }
+        return slot;
+    }
+
+    // keep the load factor at or below one half
+    void Grow(size_t count) {
+        if (count * 2 <= slots_.size()) {
+            return;
+        }
+        std::vector<Slot> slots = std::move(slots_);
+        size_t size = std::max<size_t>(16, 2 * slots.size());
+        while (count * 2 > size) {
+            size *= 2;
+        }
+        slots_.assign(size, Slot{EMPTY_SLOT, 0, 0});
+        shift_ = 64;
+        for (size_t size = slots_.size(); size > 1; size >>= 1) {
+            --shift_;
+        }
+        for (const Slot& slot : slots) {
+            if (slot.code != EMPTY_SLOT) {
+                slots_[Probe(slot.code)] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    unsigned shift_{64};
+    std::vector<CellCode> codes_; // key of each id
+};
+
+// rows of a table grouped by a NumberKeyIndex; the slot of a key also has its last row
+class NumberKeyGroups {
+  public:
+    using RowRange = RowBuckets::RowRange;
+
+    // keys must pass NumberKeyIndex::Accepts
+    explicit NumberKeyGroups(const ColumnarTable& keys) {
+        std::vector<size_t> groups(keys.Rows());
+        for (size_t row = 0; row < keys.Rows(); ++row) {
+            groups[row] = keys_.Insert(keys, row).first;
+        }
+        buckets_ = RowBuckets(groups, keys_.Size());
+    }
+
+    const NumberKeyIndex& Keys() const { return keys_; }
+
+    // the slot of the number with its key id and last row, or nullptr
+    const NumberKeyIndex::Slot* Find(double value) const { return keys_.Find(value); }
+
+    RowRange Rows(size_t id) const { return buckets_.Rows(id); }
+
+    size_t MemoryUsage() const { return keys_.MemoryUsage() + buckets_.MemoryUsage(); }
+
+  private:
+    NumberKeyIndex keys_;
+    RowBuckets buckets_;
+};
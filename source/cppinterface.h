@@ -31,6 +31,14 @@ QFUnion(const CellMatrix& x1, // 1st item
         const CellMatrix& x5, // 5th item
         const CellMatrix& x6); // 6th item
 
+CellMatrix // get the items of the first table which are not in the other tables
+QFExcept(const CellMatrix& x1, // 1st item
+         const CellMatrix& x2, // 2nd item
+         const CellMatrix& x3, // 3rd item
+         const CellMatrix& x4, // 4th item
+         const CellMatrix& x5, // 5th item
+         const CellMatrix& x6); // 6th item
+
 CellMatrix // match function
 QFExactMatch(const CellMatrix& lookup,   // items to look up
              const CellMatrix& table,    // table to be looked up against
@@ -47,6 +55,74 @@ QFFilter(const CellMatrix& lookup, // items to look up
     const CellMatrix& outputTable,  // table values to be printed out
     const CellMatrix& includeLookup); // non zero/false value to output the lookup values
 
+CellMatrix // whether each lookup row is a row of the table, true or false
+QFIn(const CellMatrix& lookup, // items to look up
+     const CellMatrix& table); // table to be looked up against
+
+CellMatrix // whether each lookup row is not a row of the table, true or false
+QFNotIn(const CellMatrix& lookup, // items to look up
+        const CellMatrix& table); // table to be looked up against
+
+CellMatrix // best fuzzy matches of each lookup string as pairs of table index and similarity score, #N/A where there are none
+QFFuzzyMatch(const CellMatrix& lookup,    // strings to look up
+             const CellMatrix& table,     // strings to be looked up against
+             const CellMatrix& threshold, // least similarity, 1 - edit distance / longer length, 0.8 when empty
+             const CellMatrix& topK,      // number of matches per lookup string, 1 when empty
+             const CellMatrix& oneIndex); // 0, false or empty to have 0-based index, otherwise 1-based index
+
+std::string // build a lookup index of a table, kept between calls, and return its handle
+QFBuildIndex(const CellMatrix& table); // table to be looked up against
+
+CellMatrix // VLookup function against an index
+QFIndexLookup(const CellMatrix& lookup, // items to look up
+              const std::string& index, // handle returned by QFBuildIndex
+              const CellMatrix& outputTable); // table values to be printed out
+
+CellMatrix // match function against an index
+QFIndexMatch(const CellMatrix& lookup,   // items to look up
+             const std::string& index,   // handle returned by QFBuildIndex
+             const CellMatrix& oneIndex); // 0, false or empty to have 0-based index, otherwise 1-based index
+
+CellMatrix // multi lookup function against an index
+QFIndexFilter(const CellMatrix& lookup, // items to look up
+              const std::string& index, // handle returned by QFBuildIndex
+              const CellMatrix& outputTable,  // table values to be printed out
+              const CellMatrix& includeLookup); // non zero/false value to output the lookup values
+
+double // set the memory budget of the lookup indices in megabytes, returns the previous budget
+QFSetIndexBudget(double megabytes); // new budget
+
+CellMatrix // match function against a table sorted in ascending order
+QFSortedMatch(const CellMatrix& lookup,    // items to look up
+              const CellMatrix& table,     // sorted table to be looked up against
+              const CellMatrix& matchType, // 1 or empty: largest key <= item, -1: smallest key >= item, 0: exact
+              const CellMatrix& oneIndex); // 0, false or empty to have 0-based index, otherwise 1-based index
+
+CellMatrix // VLookup function against a table sorted in ascending order
+QFSortedLookup(const CellMatrix& lookup,      // items to look up
+               const CellMatrix& table,       // sorted table to be looked up against
+               const CellMatrix& outputTable, // table values to be printed out
+               const CellMatrix& matchType);  // 1 or empty: largest key <= item, -1: smallest key >= item, 0: exact
+
+CellMatrix // all the records of a sorted table with keys in [lower, upper]
+QFRangeLookup(const CellMatrix& lower,        // lower bounds
+              const CellMatrix& upper,        // upper bounds
+              const CellMatrix& table,        // sorted table to be looked up against
+              const CellMatrix& outputTable); // table values to be printed out
+
+CellMatrix // sort the records of a table on key columns, keeping the table order of equal keys
+QFSortBy(const CellMatrix& table,      // table to be sorted
+         const CellMatrix& keyColumns, // 1-based key columns, all columns if empty
+         const CellMatrix& directions, // asc or desc (1 or -1) per key column, or one for all; ascending if empty
+         const CellMatrix& topN);      // number of records to keep, all if empty or 0
+
+CellMatrix // join two tables on their keys, keeping every match
+QFJoin(const CellMatrix& leftKeys,    // keys of the left table
+       const CellMatrix& leftValues,  // values of the left table, can be empty
+       const CellMatrix& rightKeys,   // keys of the right table
+       const CellMatrix& rightValues, // values of the right table, can be empty
+       const std::string& joinType);  // inner (default), left, right, full, semi or anti
+
 CellMatrix
 QFPivotCount(const CellMatrix& horizontal,
             const CellMatrix& vertical);
@@ -66,3 +142,112 @@ QFPivotMin(const CellMatrix& value,
            const CellMatrix& horizontal,
            const CellMatrix& vertical);
 
+CellMatrix // several aggregates of a pivot table in one pass over the records
+QFPivot(const CellMatrix& value,       // values to be aggregated
+        const CellMatrix& horizontal,  // row keys
+        const CellMatrix& vertical,    // column keys, can be empty
+        const CellMatrix& aggregates); // sum, count, min, max, mean, variance, first, last, distinct, approxdistinct, approxtop, median, p0 to p100; the approximate ones may end with their error, as in p99@0.005
+
+CellMatrix // QFPivot kept up to date between calls: only the pivot cells of records that changed since the last call are aggregated again
+QFLivePivot(const std::string& name,      // name of the kept state, one per live pivot
+            const CellMatrix& value,      // values to be aggregated
+            const CellMatrix& horizontal, // row keys
+            const CellMatrix& vertical,   // column keys, can be empty
+            const CellMatrix& aggregates); // sum, count, min, max, mean, variance, first, last, distinct, approxdistinct, approxtop, median, p0 to p100; the approximate ones may end with their error, as in p99@0.005
+
+CellMatrix // one row per distinct key with several aggregates of every value column, below a header row with the aggregate names
+QFGroupBy(const CellMatrix& keys,       // group keys, any number of columns
+          const CellMatrix& values,     // values to be aggregated, any number of columns
+          const CellMatrix& aggregates, // sum, count, min, max, mean, variance, first, last, distinct, approxdistinct, approxtop, median, p0 to p100; the approximate ones may end with their error, as in p99@0.005
+          const CellMatrix& having,     // conditions the groups must meet, as "count >= 10" or "sum 2 > 0", can be empty
+          const CellMatrix& orderBy);   // aggregate the groups are sorted on, as "sum desc", key order if empty
+
+CellMatrix // a window function of each record over the records of its partition, in the order of the order keys, aligned with the records
+QFWindow(const CellMatrix& value,            // values, one column
+         const CellMatrix& partition,        // partition keys, a single partition if empty
+         const CellMatrix& order,            // order keys, ascending, table order if empty; ranks rank the values if empty
+         const std::string& windowFunction); // sum, min, max, rownumber, rank, denserank, lag N, lead N or movingaverage N
+
+double // approximate number of distinct items, HyperLogLog
+QFApproxDistinct(const CellMatrix& x,      // items
+                 const CellMatrix& error); // relative standard error, 0.01 by default
+
+CellMatrix // approximate quantiles of the numbers, KLL sketch
+QFApproxQuantile(const CellMatrix& x,         // items, only numbers are counted
+                 const CellMatrix& quantiles, // fractions between 0 and 1
+                 const CellMatrix& error);    // rank error as a fraction of the count, 0.01 by default
+
+CellMatrix // approximate most frequent items with their counts, most frequent first
+QFApproxTopK(const CellMatrix& x,      // items
+             double k,                 // number of items
+             const CellMatrix& error); // count error as a fraction of the number of items, 0.01 by default
+
+std::string // map a table file, kept between calls, and return its handle; lookups and pivots take the handle in place of a range
+QFOpenTable(const std::string& path); // file written by QFConvertCsv
+
+std::string // handle of some columns of a table file, so that only those are read
+QFTableColumns(const std::string& table, // handle returned by QFOpenTable
+               const CellMatrix& columns); // column names or 1-based numbers
+
+double // convert a CSV file with a header record into a table file, returns the number of records
+QFConvertCsv(const std::string& csvPath,    // comma separated file
+             const std::string& tablePath); // table file to be written
+
+double // set the memory budget of the result cache in megabytes, 0 to turn it off, returns the previous budget; off by default
+QFSetCacheBudget(double megabytes); // new budget
+
+double // drop every cached result, returns the number of results dropped
+QFCacheClear();
+
+std::string // submit QFPivotSum to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitPivotSum(const CellMatrix& value,     // values to be summed
+                 const CellMatrix& horizontal, // row keys
+                 const CellMatrix& vertical);  // column keys, can be empty
+
+std::string // submit QFPivot to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitPivot(const CellMatrix& value,       // values to be aggregated
+              const CellMatrix& horizontal,  // row keys
+              const CellMatrix& vertical,    // column keys, can be empty
+              const CellMatrix& aggregates); // aggregates, as for QFPivot
+
+std::string // submit QFExactVLookup to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitVLookup(const CellMatrix& lookup,       // items to look up
+                const CellMatrix& table,        // table to be looked up against
+                const CellMatrix& outputTable); // table values to be printed out
+
+std::string // submit QFFilter to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitFilter(const CellMatrix& lookup,         // items to look up
+               const CellMatrix& table,          // table to be looked up against
+               const CellMatrix& outputTable,    // table values to be printed out
+               const CellMatrix& includeLookup); // non zero/false value to output the lookup values
+
+std::string // submit QFSortBy to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitSortBy(const CellMatrix& table,      // table to be sorted
+               const CellMatrix& keyColumns, // 1-based key columns, all columns if empty
+               const CellMatrix& directions, // asc or desc (1 or -1) per key column, or one for all; ascending if empty
+               const CellMatrix& topN);      // number of records to keep, all if empty or 0
+
+std::string // submit QFJoin to run in the background, returns the job handle at once; an identical call gets the same job
+QFSubmitJoin(const CellMatrix& leftKeys,    // keys of the left table
+             const CellMatrix& leftValues,  // values of the left table, can be empty
+             const CellMatrix& rightKeys,   // keys of the right table
+             const CellMatrix& rightValues, // values of the right table, can be empty
+             const std::string& joinType);  // inner (default), left, right, full, semi or anti
+
+CellMatrix // state, progress, elapsed seconds, rows scanned and error of a background job, under a header row
+//<xlw:volatile
+QFJobStatus(const std::string& handle); // job handle from a QFSubmit function
+
+CellMatrix // result of a background job once it is done, an error until then
+//<xlw:volatile
+QFJobResult(const std::string& handle); // job handle from a QFSubmit function
+
+double // cancel a queued or running job, or drop a finished one with its result; returns 1, or 0 for an unknown handle
+QFJobCancel(const std::string& handle); // job handle from a QFSubmit function
+
+CellMatrix // calls, latencies and input sizes of every QF function since the last reset, the most time consuming first
+//<xlw:volatile
+QFStats();
+
+double // clear the statistics of QFStats, returns the number of calls cleared
+QFStatsReset();
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cellitem.h"
+#include "columnartable.h"
+#include "mappedtable.h"
+
+/*************************************
+CSV to table file conversion, streamed: the CSV is read in blocks and never held in memory
+*************************************/
+
+// reads RFC 4180 records: separated fields, double quoted ones may hold separators, line breaks and doubled quotes
+class CsvReader {
+  public:
+    CsvReader(const std::string& path, char separator) : file_(path, std::ios::binary), separator_(separator), buffer_(size_t(1) << 20) {
+        if (!file_) {
+            throw("Cannot open the CSV file.");
+        }
+    }
+
+    // the fields of the next record, false at the end of the file
+    bool Next(std::vector<std::string>& fields, std::vector<bool>& quoted) {
+        fields.clear();
+        quoted.clear();
+        int c = Get();
+        if (c == EOF) {
+            return false;
+        }
+        fields.emplace_back();
+        quoted.push_back(false);
+        bool inQuotes = false;
+        for (;; c = Get()) {
+            if (inQuotes) {
+                if (c == EOF) {
+                    throw("A quoted CSV field is not closed.");
+                } else if (c == '"') {
+                    if (Peek() == '"') {
+                        Get();
+                        fields.back() += '"';
+                    } else {
+                        inQuotes = false;
+                    }
+                } else {
+                    fields.back() += char(c);
+                }
+            } else if (c == '"' && fields.back().empty() && !quoted.back()) {
+                inQuotes = true;
+                quoted.back() = true;
+            } else if (c == separator_) {
+                fields.emplace_back();
+                quoted.push_back(false);
+            } else if (c == '\n' || c == EOF) {
+                return true;
+            } else if (c == '\r') {
+                if (Peek() == '\n') {
+                    Get();
+                }
+                return true;
+            } else {
+                fields.back() += char(c);
+            }
+        }
+    }
+
+  private:
+    int Peek() {
+        if (next_ == end_ && !Fill()) {
+            return EOF;
+        }
+        return static_cast<unsigned char>(buffer_[next_]);
+    }
+
+    int Get() {
+        int c = Peek();
+        if (c != EOF) {
+            ++next_;
+        }
+        return c;
+    }
+
+    bool Fill() {
+        file_.read(buffer_.data(), std::streamsize(buffer_.size()));
+        next_ = 0;
+        end_ = size_t(file_.gcount());
+        return end_ > 0;
+    }
+
+    std::ifstream file_;
+    char separator_;
+    std::vector<char> buffer_;
+    size_t next_{0};
+    size_t end_{0};
+};
+
+// the cell a CSV field stands for: quoted fields are strings, others may be empty, numbers, TRUE, FALSE or Excel errors
+template <class StringEncoder> CellCode CsvFieldCode(const std::string& field, bool quoted, StringEncoder& encodeString) {
+    if (quoted) {
+        return TaggedCode(CVT_STRING, encodeString(field));
+    }
+    if (field.empty()) {
+        return TaggedCode(CVT_EMPTY, 0);
+    }
+
+    char first = field[0];
+    if (std::isdigit(static_cast<unsigned char>(first)) || first == '-' || first == '+' || first == '.') {
+        char* end;
+        double value = std::strtod(field.c_str(), &end);
+        if (end == field.c_str() + field.size() && std::isfinite(value)) {
+            return NumberCode(value);
+        }
+    } else if (first == '#') {
+        // the codes of the EXCEL_ERROR constants
+        static const std::pair<const char*, uint32_t> errors[] = {{"#NULL!", 0}, {"#DIV/0!", 7}, {"#VALUE!", 15}, {"#REF!", 23},
+                                                                  {"#NAME?", 29}, {"#NUM!", 36},  {"#N/A", 42}};
+        for (auto& error : errors) {
+            if (field == error.first) {
+                return TaggedCode(CVT_ERROR, error.second);
+            }
+        }
+    } else if (field.size() == 4 || field.size() == 5) {
+        std::string upper = field;
+        for (auto& c : upper) {
+            c = char(std::toupper(static_cast<unsigned char>(c)));
+        }
+        if (upper == "TRUE" || upper == "FALSE") {
+            return TaggedCode(CVT_BOOLEAN, upper == "TRUE" ? 1 : 0);
+        }
+    }
+    return TaggedCode(CVT_STRING, encodeString(field));
+}
+
+// converts a CSV file, whose first record names the columns, into a table file; returns the number of records
+inline size_t ConvertCsvTable(const std::string& csvPath, const std::string& tablePath, char separator) {
+    CsvReader reader(csvPath, separator);
+    std::vector<std::string> fields;
+    std::vector<bool> quoted;
+    if (!reader.Next(fields, quoted)) {
+        throw("The CSV file is empty.");
+    }
+
+    TableWriter writer(tablePath, fields);
+    auto intern = [&](const std::string& text) { return writer.Intern(text); };
+    std::vector<CellCode> codes(writer.Columns());
+    while (reader.Next(fields, quoted)) {
+        // blank lines are skipped
+        if (fields.size() == 1 && fields[0].empty() && !quoted[0]) {
+            continue;
+        }
+        if (fields.size() > codes.size()) {
+            throw("A CSV record has more fields than the header.");
+        }
+        for (size_t col = 0; col < codes.size(); ++col) {
+            codes[col] = (col < fields.size()) ? CsvFieldCode(fields[col], quoted[col], intern) : TaggedCode(CVT_EMPTY, 0);
+        }
+        writer.AppendRow(codes.data());
+    }
+    writer.Finish();
+    return writer.Rows();
+}
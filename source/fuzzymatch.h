@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "cellitem.h"
+#include "columnartable.h"
+
+/*************************************
+fuzzy string matching: the similarity of two strings is 1 - edit distance / length of the longer one, on their ASCII lower case text
+candidates come from a pigeonhole filter, as in Pass-Join: a table string cut into more segments than the edits it may be apart from a
+match keeps the others intact in the match, near where they were; the candidates left by cheaper filters are verified with a
+bit-parallel edit distance
+*************************************/
+
+constexpr double DEFAULT_FUZZY_THRESHOLD = 0.8;
+constexpr size_t FUZZY_SPARE_SEGMENTS = 4;          // segments beyond the edits: as many are intact in a match, to count and to leave unprobed
+constexpr size_t FUZZY_CHEAP_POSTINGS = 64;         // segments with as few postings are always probed, as each one sharpens the count
+constexpr size_t FUZZY_MAX_REACH = size_t(1) << 52; // longest length taken to be within reach, exact in doubles
+
+inline void FoldCase(std::string_view text, std::string& folded) {
+    folded.assign(text.data(), text.size());
+    for (char& c : folded) {
+        if (c >= 'A' && c <= 'Z') {
+            c = char(c - 'A' + 'a');
+        }
+    }
+}
+
+// the most edits two strings of these lengths may be apart with a similarity of at least threshold
+inline size_t MaxEdits(size_t lhs, size_t rhs, double threshold) {
+    return size_t(std::floor((1.0 - threshold) * double(std::max(lhs, rhs)) + 1e-9));
+}
+
+// whether strings of these lengths may be at least threshold similar
+inline bool LengthsWithinReach(size_t lhs, size_t rhs, double threshold) {
+    return (lhs > rhs ? lhs - rhs : rhs - lhs) <= MaxEdits(lhs, rhs, threshold);
+}
+
+// Levenshtein distance from one pattern to many texts: Myers' bit-parallel algorithm when the pattern fits in a machine word, a row of
+// the table otherwise
+class EditDistance {
+  public:
+    void Pattern(std::string_view pattern) {
+        for (char c : pattern_) {
+            peq_[uint8_t(c)] = 0;
+        }
+        pattern_.assign(pattern.data(), pattern.size());
+        if (pattern_.size() <= 64) {
+            for (size_t i = 0; i < pattern_.size(); ++i) {
+                peq_[uint8_t(pattern_[i])] |= uint64_t(1) << i;
+            }
+        }
+    }
+
+    size_t operator()(std::string_view text) {
+        if (pattern_.empty()) {
+            return text.size();
+        }
+        if (pattern_.size() > 64) {
+            return Table(text);
+        }
+
+        uint64_t pv = ~uint64_t(0), mv = 0, last = uint64_t(1) << (pattern_.size() - 1);
+        size_t score = pattern_.size();
+        for (char c : text) {
+            uint64_t eq = peq_[uint8_t(c)];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            score += (ph & last) ? 1 : 0;
+            score -= (mh & last) ? 1 : 0;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+  private:
+    size_t Table(std::string_view text) {
+        row_.resize(pattern_.size() + 1);
+        for (size_t i = 0; i <= pattern_.size(); ++i) {
+            row_[i] = i;
+        }
+        for (size_t j = 1; j <= text.size(); ++j) {
+            size_t diagonal = row_[0];
+            row_[0] = j;
+            for (size_t i = 1; i <= pattern_.size(); ++i) {
+                size_t above = row_[i];
+                row_[i] = std::min({row_[i] + 1, row_[i - 1] + 1, diagonal + (pattern_[i - 1] == text[j - 1] ? 0 : 1)});
+                diagonal = above;
+            }
+        }
+        return row_[pattern_.size()];
+    }
+
+    std::string pattern_;
+    uint64_t peq_[256]{}; // bit i of peq_[c] is set when the pattern has c at i
+    std::vector<size_t> row_;
+};
+
+// the characters of a text, folded into 64 bits: an edit adds or drops at most one character of either string, so strings d edits apart
+// have at most d bits of one and not the other; the lower six bits keep letters and digits apart
+inline uint64_t CharacterMask(std::string_view text) {
+    uint64_t mask = 0;
+    for (char c : text) {
+        mask |= uint64_t(1) << (uint8_t(c) & 63);
+    }
+    return mask;
+}
+
+inline bool MasksWithinEdits(uint64_t lhs, uint64_t rhs, size_t edits) {
+    return size_t(std::bitset<64>(lhs & ~rhs).count()) <= edits && size_t(std::bitset<64>(rhs & ~lhs).count()) <= edits;
+}
+
+// the trigrams of a pattern padded with two marks at each end, hashed into a bitmap: an edit changes at most three trigrams of either
+// string, so strings d edits apart share at least all but 3 d of them; a text counted short of that is rejected before its distance
+class TrigramFilter {
+  public:
+    void Pattern(std::string_view pattern) {
+        std::fill(std::begin(bits_), std::end(bits_), 0);
+        ForEach(pattern, [&](uint32_t bit) { bits_[bit >> 6] |= uint64_t(1) << (bit & 63); });
+        grams_ = pattern.size() + 2;
+    }
+
+    // whether the text may be within edits of the pattern; hash collisions only let more texts through
+    bool MayMatch(std::string_view text, size_t edits) const {
+        size_t grams = std::max(grams_, text.size() + 2);
+        if (3 * edits >= grams) {
+            return true;
+        }
+        size_t shared = 0;
+        ForEach(text, [&](uint32_t bit) { shared += (bits_[bit >> 6] >> (bit & 63)) & 1; });
+        return shared + 3 * edits >= grams;
+    }
+
+  private:
+    template <class Visit> static void ForEach(std::string_view text, Visit visit) {
+        uint32_t gram = 0;
+        for (char c : text) {
+            gram = ((gram << 8) | uint8_t(c)) & 0xffffff;
+            visit(Bit(gram));
+        }
+        visit(Bit((gram << 8) & 0xffffff));
+        visit(Bit((gram << 16) & 0xffffff));
+    }
+
+    static uint32_t Bit(uint32_t gram) { return (gram * 0x9e3779b1U) >> 20; }
+
+    uint64_t bits_[64]{};
+    size_t grams_{0};
+};
+
+struct FuzzyMatch {
+    double score;
+    size_t row;
+};
+
+// distinct non-empty strings of one table column, indexed by their segments for one threshold
+class FuzzyIndex {
+  public:
+    template <class Table> FuzzyIndex(const Table& table, double threshold) : threshold_(threshold) {
+        StringPool pool;
+        std::vector<std::vector<size_t>> rows;
+        std::string scratch, folded;
+        for (size_t row = 0; row < table.RowsInStructure(); ++row) {
+            if (GetType(table(row, 0)) != CVT_STRING) {
+                continue;
+            }
+            FoldCase(CellText(table(row, 0), scratch), folded);
+            if (folded.empty()) {
+                continue;
+            }
+            uint32_t id = pool.Intern(folded);
+            if (id == rows.size()) {
+                rows.emplace_back();
+            }
+            rows[id].push_back(row);
+        }
+
+        // strings are numbered by length, so that those a posting list holds are close together
+        std::vector<uint32_t> byLength(rows.size());
+        for (uint32_t id = 0; id < byLength.size(); ++id) {
+            byLength[id] = id;
+        }
+        std::stable_sort(begin(byLength), end(byLength), [&](uint32_t lhs, uint32_t rhs) { return pool[lhs].size() < pool[rhs].size(); });
+        starts_.push_back(0);
+        for (uint32_t id : byLength) {
+            text_.append(pool[id]);
+            starts_.push_back(text_.size());
+            rows_.push_back(std::move(rows[id]));
+            masks_.push_back(CharacterMask(pool[id]));
+        }
+
+        std::vector<std::pair<uint64_t, uint32_t>> postings; // segment key, string id
+        for (uint32_t id = 0; id < rows_.size();) {
+            size_t size = Text(id).size();
+            Length length{size, Edits(size) + FUZZY_SPARE_SEGMENTS, id, id, false};
+            while (length.end < rows_.size() && Text(length.end).size() == size) {
+                ++length.end;
+            }
+            // too short to cut into non-empty segments: the strings of this length are all candidates
+            length.scan = length.segments > size;
+            for (uint32_t other = id; other < length.end && !length.scan; ++other) {
+                for (size_t segment = 0; segment < length.segments; ++segment) {
+                    auto [offset, count] = Segment(size, length.segments, segment);
+                    postings.emplace_back(SegmentKey(size, segment, Text(other).substr(offset, count)), other);
+                }
+            }
+            id = length.end;
+            lengths_.push_back(length);
+        }
+
+        std::sort(begin(postings), end(postings));
+        postings.erase(std::unique(begin(postings), end(postings)), end(postings));
+        ids_.reserve(postings.size());
+        for (auto& posting : postings) {
+            if (segments_.insert(posting.first).second) {
+                offsets_.push_back(ids_.size());
+            }
+            ids_.push_back(posting.second);
+        }
+        offsets_.push_back(ids_.size());
+    }
+
+    size_t Strings() const { return rows_.size(); }
+
+    // what one thread needs to probe the index
+    struct Workspace {
+        std::string folded;
+        struct Tally {
+            uint32_t stamp;    // last lookup that made the string a candidate
+            uint32_t segments; // intact segments found
+            uint32_t last;     // the last one
+        };
+        std::vector<Tally> tallies; // of each string
+        std::vector<uint32_t> candidates;
+        std::vector<std::pair<uint32_t, uint32_t>> probes; // segment, and the id of the segment text found at a position
+        std::vector<size_t> costs;                         // postings of each segment over its positions
+        std::vector<uint32_t> order;
+        uint32_t stamp{0};
+        TrigramFilter trigrams;
+        EditDistance distance;
+    };
+
+    // the table rows of the strings at least threshold similar to the text, most similar first, at most top of them
+    std::vector<FuzzyMatch> Match(std::string_view text, size_t top, Workspace& work) const {
+        std::vector<FuzzyMatch> matches;
+        FoldCase(text, work.folded);
+        std::string_view lookup = work.folded;
+        if (lookup.empty() || rows_.empty()) {
+            return matches;
+        }
+        if (work.tallies.size() != rows_.size()) {
+            work.tallies.assign(rows_.size(), Workspace::Tally{0, 0, 0});
+            work.stamp = 0;
+        }
+        if (++work.stamp == 0) {
+            work.tallies.assign(rows_.size(), Workspace::Tally{0, 0, 0});
+            work.stamp = 1;
+        }
+
+        work.candidates.clear();
+        auto add = [&](uint32_t candidate, uint32_t segment) {
+            auto& tally = work.tallies[candidate];
+            if (tally.stamp != work.stamp) {
+                tally = Workspace::Tally{work.stamp, 1, segment};
+                work.candidates.push_back(candidate);
+            } else if (tally.last != segment) {
+                ++tally.segments;
+                tally.last = segment;
+            }
+        };
+        size_t size = lookup.size();
+        uint64_t mask = CharacterMask(lookup);
+        for (const Length& length : lengths_) {
+            if (!LengthsWithinReach(size, length.size, threshold_)) {
+                continue;
+            }
+            size_t found = work.candidates.size();
+            size_t allowed = MaxEdits(size, length.size, threshold_);
+            if (length.scan) {
+                for (uint32_t id = length.begin; id < length.end; ++id) {
+                    if (MasksWithinEdits(mask, masks_[id], allowed)) {
+                        add(id, 0);
+                    }
+                }
+                continue;
+            }
+            // an intact segment moved by x has the edits on either side of it cost at least |x| + |size difference - x|
+            ptrdiff_t shift = ptrdiff_t(size) - ptrdiff_t(length.size);
+            ptrdiff_t slack = (ptrdiff_t(allowed) - std::abs(shift)) / 2;
+            work.probes.clear();
+            work.costs.assign(length.segments, 0);
+            for (size_t segment = 0; segment < length.segments; ++segment) {
+                auto [offset, count] = Segment(length.size, length.segments, segment);
+                ptrdiff_t first = std::max<ptrdiff_t>(ptrdiff_t(offset) + std::min<ptrdiff_t>(shift, 0) - slack, 0);
+                ptrdiff_t last = std::min<ptrdiff_t>(ptrdiff_t(offset) + std::max<ptrdiff_t>(shift, 0) + slack, ptrdiff_t(size - count));
+                for (ptrdiff_t from = first; from <= last; ++from) {
+                    size_t id = segments_.find(SegmentKey(length.size, segment, lookup.substr(size_t(from), count)));
+                    if (id != segments_.npos) {
+                        work.probes.emplace_back(uint32_t(segment), uint32_t(id));
+                        work.costs[segment] += offsets_[id + 1] - offsets_[id];
+                    }
+                }
+            }
+
+            // each edit breaks at most one segment, so a match keeps intact segments: all but one of them may go unprobed, the
+            // costliest first, as a word most strings share would make most strings candidates
+            size_t intact = length.segments - allowed;
+            work.order.resize(length.segments);
+            for (size_t segment = 0; segment < length.segments; ++segment) {
+                work.order[segment] = uint32_t(segment);
+            }
+            std::sort(begin(work.order), end(work.order), [&](uint32_t lhs, uint32_t rhs) { return work.costs[lhs] > work.costs[rhs]; });
+            for (size_t i = 0; intact > 1 && work.costs[work.order[i]] > FUZZY_CHEAP_POSTINGS; ++i) {
+                work.costs[work.order[i]] = SKIPPED;
+                --intact;
+            }
+            for (auto [segment, id] : work.probes) {
+                if (work.costs[segment] != SKIPPED) {
+                    for (size_t i = offsets_[id]; i < offsets_[id + 1]; ++i) {
+                        add(ids_[i], segment);
+                    }
+                }
+            }
+            // a string dropped here may come back at its own length after a clash of keys
+            auto drop = [&](uint32_t candidate) {
+                if (work.tallies[candidate].segments >= intact && MasksWithinEdits(mask, masks_[candidate], allowed)) {
+                    return false;
+                }
+                work.tallies[candidate].stamp = 0;
+                return true;
+            };
+            auto kept = std::remove_if(begin(work.candidates) + ptrdiff_t(found), end(work.candidates), drop);
+            work.candidates.erase(kept, end(work.candidates));
+        }
+
+        work.trigrams.Pattern(lookup);
+        work.distance.Pattern(lookup);
+        for (uint32_t candidate : work.candidates) {
+            std::string_view other = Text(candidate);
+            size_t allowed = MaxEdits(size, other.size(), threshold_);
+            if (!work.trigrams.MayMatch(other, allowed)) {
+                continue;
+            }
+            size_t distance = work.distance(other);
+            if (distance <= allowed) {
+                double score = 1.0 - double(distance) / double(std::max(size, other.size()));
+                for (size_t row : rows_[candidate]) {
+                    matches.push_back(FuzzyMatch{score, row});
+                }
+            }
+        }
+
+        auto better = [](const FuzzyMatch& lhs, const FuzzyMatch& rhs) {
+            return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.row < rhs.row);
+        };
+        if (matches.size() > top) {
+            std::partial_sort(begin(matches), begin(matches) + ptrdiff_t(top), end(matches), better);
+            matches.resize(top);
+        } else {
+            std::sort(begin(matches), end(matches), better);
+        }
+        return matches;
+    }
+
+  private:
+    static constexpr size_t SKIPPED = size_t(-1);
+
+    // the strings of one length
+    struct Length {
+        size_t size;
+        size_t segments;     // one more than the most edits a match of a string of this length may need, and the spare ones
+        uint32_t begin, end; // their ids
+        bool scan;           // whether they are all candidates, rather than indexed by their segments
+    };
+
+    std::string_view Text(uint32_t id) const { return std::string_view(text_).substr(starts_[id], starts_[id + 1] - starts_[id]); }
+
+    // the most edits a string of this size may be from any match: the one at the longest reach
+    size_t Edits(size_t size) const {
+        // lengths within reach run up to about size / threshold: a step or two either way settles the rounding
+        double reach = std::floor(double(size) / threshold_);
+        size_t other = reach < double(FUZZY_MAX_REACH) ? std::max(size, size_t(reach)) : FUZZY_MAX_REACH;
+        while (other > size && !LengthsWithinReach(size, other, threshold_)) {
+            --other;
+        }
+        while (other < FUZZY_MAX_REACH && LengthsWithinReach(size, other + 1, threshold_)) {
+            ++other;
+        }
+        return MaxEdits(size, other, threshold_);
+    }
+
+    // offset and size of the segment-th of count segments of a string of this size, the longer ones last
+    static std::pair<size_t, size_t> Segment(size_t size, size_t count, size_t segment) {
+        size_t shorter = count - size % count, width = size / count;
+        if (segment < shorter) {
+            return {segment * width, width};
+        }
+        return {shorter * width + (segment - shorter) * (width + 1), width + 1};
+    }
+
+    static uint64_t SegmentKey(size_t size, size_t segment, std::string_view text) {
+        return HashCombine(HashMix((uint64_t(size) << 32) | segment), HashBytes(text.data(), text.size()));
+    }
+
+    double threshold_;
+    std::string text_;                      // distinct folded strings, one after the other
+    std::vector<size_t> starts_;            // starts_[id] .. starts_[id + 1] is the slice of text_ holding string id
+    std::vector<std::vector<size_t>> rows_; // table rows of each string
+    std::vector<uint64_t> masks_;           // characters of each string
+    std::vector<Length> lengths_;           // by size
+    FlatHashSet<uint64_t, HashInteger, EqualInteger> segments_;
+    std::vector<size_t> offsets_;                     // offsets_[segment] .. offsets_[segment + 1] is the slice of ids_ holding the segment
+    std::vector<uint32_t> ids_;                       // strings holding each segment, in id order
+};
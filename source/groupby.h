@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "columnartable.h"
+#include "parallel.h"
+#include "pivot.h"
+#include "sketches.h"
+
+/*************************************
+group by: the aggregates of several value columns for every distinct key of any number of key columns, one output row per key
+the hash tables are sized from an estimate of the number of keys, so the aggregation does not rehash as the keys come in
+*************************************/
+
+constexpr double GROUP_ESTIMATE_ERROR = 0.05; // relative error of the estimated number of keys
+
+// the number of distinct keys, estimated from a sketch of the key hashes
+inline size_t EstimateGroups(const ColumnarTable& keys) {
+    DistinctSketch empty(GROUP_ESTIMATE_ERROR);
+    DistinctSketch sketch = SketchRows(keys.Rows(), empty, [&](DistinctSketch& block, size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row) {
+            uint64_t hash = keys.Columns();
+            for (size_t col = 0; col < keys.Columns(); ++col) {
+                hash = HashCombine(hash, keys(row, col));
+            }
+            block.Add(hash);
+        }
+    });
+    return size_t(sketch.Estimate());
+}
+
+// Index is KeyIndex, or NumberKeyIndex for a key of numbers only; each key has one AggregateState per value column
+template <class Index> class GroupAggregation {
+  public:
+    // aggregates rows [begin, end), with room for expectedGroups keys
+    GroupAggregation(const ColumnarTable& keys, const ColumnarTable& values, bool numeric, bool distinct, const SketchOptions& sketches,
+                     size_t begin, size_t end, size_t expectedGroups)
+        : keys_(&keys), index_(keys.Columns()), width_(values.Columns()) {
+        Reserve(expectedGroups);
+        bool sketch = sketches.Any();
+
+        for (size_t row = begin; row < end; ++row) {
+            JobCheckpoint(row);
+            auto [id, newGroup] = index_.Insert(keys, row);
+            if (newGroup) {
+                first_.push_back(row);
+                states_.resize(states_.size() + width_);
+            }
+            AggregateState* states = &states_[id * width_];
+            for (size_t col = 0; col < width_; ++col) {
+                CellCode value = values(row, col);
+                states[col].Add(value, row, numeric);
+                if (sketch) {
+                    states[col].Sketch(value, sketches);
+                }
+                if (distinct) {
+                    distinctValues_.insert({StateKey(id, col), value});
+                }
+            }
+        }
+    }
+
+    void Reserve(size_t groups) {
+        index_.Reserve(groups);
+        first_.reserve(groups);
+        states_.reserve(groups * width_);
+    }
+
+    // folds in the aggregation of another slice of the same tables
+    void Merge(const GroupAggregation& other) {
+        std::vector<size_t> ids(other.index_.Size());
+        for (size_t id = 0; id < ids.size(); ++id) {
+            auto [groupId, newGroup] = index_.Insert(*keys_, other.first_[id]);
+            if (newGroup) {
+                first_.push_back(other.first_[id]);
+                states_.resize(states_.size() + width_);
+            }
+            for (size_t col = 0; col < width_; ++col) {
+                states_[groupId * width_ + col].Merge(other.states_[id * width_ + col]);
+            }
+            ids[id] = groupId;
+        }
+        for (auto& item : other.distinctValues_.items()) {
+            distinctValues_.insert({StateKey(ids[item.first >> 32], size_t(uint32_t(item.first))), item.second});
+        }
+    }
+
+    // counts the distinct values, once every slice is merged
+    void Finish() {
+        for (auto& item : distinctValues_.items()) {
+            states_[(item.first >> 32) * width_ + uint32_t(item.first)].distinct += 1.0;
+        }
+    }
+
+    const Index& Keys() const { return index_; }
+    size_t Width() const { return width_; }
+    const AggregateState& State(size_t id, size_t col) const { return states_[id * width_ + col]; }
+
+  private:
+    static uint64_t StateKey(size_t id, size_t col) { return (uint64_t(id) << 32) | uint32_t(col); }
+
+    const ColumnarTable* keys_;
+    Index index_;
+    size_t width_;
+    std::vector<size_t> first_;          // first input row of each key
+    std::vector<AggregateState> states_; // by key, then value column
+    FlatHashSet<std::pair<uint64_t, CellCode>, HashCodePair, EqualCodePair> distinctValues_; // (state key, value)
+};
+
+// aggregates all rows, in parallel slices on large inputs; the values are encoded against pool
+template <class Index>
+GroupAggregation<Index> AggregateGroups(const ColumnarTable& keys, const ColumnarTable& values,
+                                        const std::vector<AggregateSpec>& aggregates, const StringPool& pool) {
+    bool numeric{false}, distinct{false};
+    for (auto& aggregate : aggregates) {
+        numeric = numeric || IsNumericAggregate(aggregate.type);
+        distinct = distinct || aggregate.type == AGG_DISTINCT;
+    }
+    SketchOptions sketches(aggregates, pool);
+    size_t expected = EstimateGroups(keys);
+
+    // a slice holds at most all the keys, or one key per row
+    size_t workers = WorkerCount(keys.Rows(), PIVOT_SLICE_ROWS);
+    std::vector<std::unique_ptr<GroupAggregation<Index>>> partials(workers);
+    ParallelFor(workers, [&](size_t worker) {
+        auto range = ChunkRange(keys.Rows(), workers, worker);
+        partials[worker] = std::make_unique<GroupAggregation<Index>>(keys, values, numeric, distinct, sketches, range.first, range.second,
+                                                                     std::min(expected, range.second - range.first));
+    });
+
+    if (workers > 1) {
+        partials[0]->Reserve(expected);
+    }
+    for (size_t worker = 1; worker < workers; ++worker) {
+        partials[0]->Merge(*partials[worker]);
+    }
+    partials[0]->Finish();
+    return std::move(*partials[0]);
+}
+
+/*************************************
+conditions on, and order by, the aggregates of a group by
+*************************************/
+
+// an aggregate of a value column, written as the name of the aggregate then the 1-based value column, as in "sum 2"; the column
+// may be left out for the first one
+struct GroupTerm {
+    AggregateSpec aggregate;
+    size_t column;
+};
+
+inline GroupTerm ParseGroupTerm(const std::string& text, size_t valueColumns) {
+    size_t end = text.find_last_not_of(' ');
+    size_t start = text.find_first_not_of(' ');
+    if (start == std::string::npos) {
+        throw("An aggregate is expected, as in \"sum\" or \"sum 2\".");
+    }
+    std::string name = text.substr(start, end + 1 - start);
+    size_t column = 1;
+    size_t space = name.find_last_of(' ');
+    if (space != std::string::npos && name.find_first_not_of("0123456789", space + 1) == std::string::npos) {
+        column = size_t(std::strtoull(name.c_str() + space + 1, nullptr, 10));
+        name.erase(name.find_last_not_of(' ', space) + 1);
+    }
+    if (column < 1 || column > valueColumns) {
+        throw("The value column is out of range.");
+    }
+    return {ParseAggregate(name), column - 1};
+}
+
+enum GroupComparison { GROUP_EQUAL, GROUP_NOT_EQUAL, GROUP_LESS, GROUP_LESS_EQUAL, GROUP_GREATER, GROUP_GREATER_EQUAL };
+
+// a condition a group must meet to be kept, as in "count >= 10" or "mean 2 < 0"; only numbers meet a condition
+struct GroupCondition {
+    GroupTerm term;
+    GroupComparison comparison;
+    double threshold;
+
+    bool Holds(double value) const {
+        switch (comparison) {
+        case GROUP_EQUAL:
+            return value == threshold;
+        case GROUP_NOT_EQUAL:
+            return value != threshold;
+        case GROUP_LESS:
+            return value < threshold;
+        case GROUP_LESS_EQUAL:
+            return value <= threshold;
+        case GROUP_GREATER:
+            return value > threshold;
+        default:
+            return value >= threshold;
+        }
+    }
+};
+
+inline GroupCondition ParseGroupCondition(const std::string& text, size_t valueColumns) {
+    size_t position = text.find_first_of("<>=!");
+    if (position == std::string::npos) {
+        throw("A condition is expected, as in \"count >= 10\".");
+    }
+    size_t length = text.find_first_not_of("<>=!", position) - position;
+    std::string op = text.substr(position, length);
+    GroupComparison comparison;
+    if (op == "=" || op == "==")
+        comparison = GROUP_EQUAL;
+    else if (op == "<>" || op == "!=")
+        comparison = GROUP_NOT_EQUAL;
+    else if (op == "<")
+        comparison = GROUP_LESS;
+    else if (op == "<=")
+        comparison = GROUP_LESS_EQUAL;
+    else if (op == ">")
+        comparison = GROUP_GREATER;
+    else if (op == ">=")
+        comparison = GROUP_GREATER_EQUAL;
+    else
+        throw("Unknown comparison, use =, <>, <, <=, > or >=.");
+
+    const char* number = text.c_str() + position + length;
+    char* numberEnd = nullptr;
+    double threshold = std::strtod(number, &numberEnd);
+    if (numberEnd == number || std::string(numberEnd).find_first_not_of(' ') != std::string::npos) {
+        throw("A condition must compare with a number.");
+    }
+    return {ParseGroupTerm(text.substr(0, position), valueColumns), comparison, threshold};
+}
+
+// the aggregate the groups are sorted on, as in "sum desc"; ascending unless desc follows the aggregate
+struct GroupOrder {
+    GroupTerm term;
+    bool descending;
+};
+
+inline GroupOrder ParseGroupOrder(std::string text, size_t valueColumns) {
+    bool descending = false;
+    size_t end = text.find_last_not_of(' ');
+    size_t space = end == std::string::npos ? std::string::npos : text.find_last_of(' ', end);
+    if (space != std::string::npos) {
+        std::string direction = text.substr(space + 1, end - space);
+        for (auto& c : direction) {
+            c = char(std::tolower(static_cast<unsigned char>(c)));
+        }
+        if (direction == "asc" || direction == "desc") {
+            descending = direction == "desc";
+            text.erase(space);
+        }
+    }
+    return {ParseGroupTerm(text, valueColumns), descending};
+}
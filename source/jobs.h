@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <xlw/CellMatrix.h>
+
+#include "parallel.h"
+
+/*************************************
+background jobs: a heavy call runs on a job thread and is referred to by the handle returned at once, so the calculation thread
+is free meanwhile; the handle is derived from the call, so submitting an identical call again gives the job already submitted
+*************************************/
+
+constexpr size_t JOB_THREADS = 2;  // jobs running at a time, each with the threads of its own ParallelFor
+constexpr size_t JOB_HISTORY = 64; // finished jobs kept for their results, the oldest are dropped first
+
+enum JobState { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED, JOB_CANCELLED };
+
+inline const char* JobStateName(JobState state) {
+    static const char* names[] = {"queued", "running", "done", "failed", "cancelled"};
+    return names[state];
+}
+
+struct JobStatus {
+    JobState state;
+    double progress; // estimated, from the rows scanned so far
+    double elapsed;  // seconds since the job started, or that it ran
+    uint64_t rows;
+    const char* error; // nullptr unless the job failed
+};
+
+class JobEngine {
+  public:
+    explicit JobEngine(size_t threads) : threads_(threads) {}
+    JobEngine(const JobEngine&) = delete;
+    JobEngine& operator=(const JobEngine&) = delete;
+
+    // running jobs stop at their next checkpoint
+    ~JobEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            for (auto& item : jobs_) {
+                item.second->control.cancelled = true;
+            }
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    // makeWork() returns the work of a new job, which owns copies of its inputs; it is only called when the handle has no job that
+    // is queued, running or done, so a resubmission copies nothing; expectedRows is the number of rows the job is expected to scan
+    template <class MakeWork> std::string Submit(const std::string& handle, uint64_t expectedRows, MakeWork makeWork) {
+        if (Holds(handle)) {
+            return handle;
+        }
+        auto job = std::make_shared<Job>();
+        job->work = makeWork();
+        job->expectedRows = std::max<uint64_t>(expectedRows, 1);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (HoldsLocked(handle)) {
+            return handle;
+        }
+        // a failed or cancelled job of the handle is replaced
+        if (auto iter = std::find(begin(finished_), end(finished_), handle); iter != end(finished_)) {
+            finished_.erase(iter);
+        }
+        jobs_[handle] = job;
+        queue_.push_back(handle);
+        if (workers_.size() < threads_) {
+            workers_.emplace_back([this] { Work(); });
+        }
+        wake_.notify_one();
+        return handle;
+    }
+
+    std::optional<JobStatus> Status(const std::string& handle) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = jobs_.find(handle);
+        if (iter == end(jobs_)) {
+            return std::nullopt;
+        }
+        const Job& job = *iter->second;
+        JobStatus status{job.state, 0.0, 0.0, job.control.rows.load(std::memory_order_relaxed), job.error};
+        // a running job is never shown as complete, as the rows it scans are only an estimate of its work
+        status.progress = job.state == JOB_DONE ? 1.0 : std::min(0.99, double(status.rows) / double(job.expectedRows));
+        if (job.state == JOB_RUNNING) {
+            status.elapsed = Seconds(job.started, std::chrono::steady_clock::now());
+        } else if (job.state != JOB_QUEUED && job.ran) {
+            status.elapsed = Seconds(job.started, job.finished);
+        }
+        return status;
+    }
+
+    // the result of a finished job; throws while it is not done
+    xlw::CellMatrix Result(const std::string& handle) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = jobs_.find(handle);
+        if (iter == end(jobs_)) {
+            throw("Unknown or dropped job handle, recalculate its QFSubmit call.");
+        }
+        const Job& job = *iter->second;
+        switch (job.state) {
+        case JOB_DONE:
+            return job.result;
+        case JOB_FAILED:
+            throw(job.error);
+        case JOB_CANCELLED:
+            throw("The job has been cancelled.");
+        default:
+            throw("The job is not finished yet.");
+        }
+    }
+
+    // a queued job is cancelled at once, a running one at its next checkpoint; a finished job is dropped with its result
+    // returns false for an unknown handle
+    bool Cancel(const std::string& handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = jobs_.find(handle);
+        if (iter == end(jobs_)) {
+            return false;
+        }
+        Job& job = *iter->second;
+        if (job.state == JOB_QUEUED) {
+            queue_.erase(std::find(begin(queue_), end(queue_), handle));
+            Finish(handle, job, JOB_CANCELLED);
+        } else if (job.state == JOB_RUNNING) {
+            job.control.cancelled = true;
+        } else {
+            finished_.erase(std::find(begin(finished_), end(finished_), handle));
+            jobs_.erase(iter);
+        }
+        return true;
+    }
+
+    // blocks until the job is finished, for callers other than Excel
+    void Wait(const std::string& handle) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] {
+            auto iter = jobs_.find(handle);
+            return iter == end(jobs_) || iter->second->state >= JOB_DONE;
+        });
+    }
+
+  private:
+    struct Job {
+        JobState state{JOB_QUEUED};
+        JobControl control;
+        uint64_t expectedRows{1};
+        bool ran{false};
+        std::chrono::steady_clock::time_point started, finished;
+        std::function<xlw::CellMatrix()> work;
+        xlw::CellMatrix result;
+        const char* error{nullptr}; // the messages thrown are string literals, so they outlive the job
+    };
+
+    static double Seconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    }
+
+    bool Holds(const std::string& handle) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return HoldsLocked(handle);
+    }
+
+    // failed and cancelled jobs are submitted again, also a cancelled job still running up to its next checkpoint
+    bool HoldsLocked(const std::string& handle) const {
+        auto iter = jobs_.find(handle);
+        return iter != end(jobs_) && iter->second->state != JOB_FAILED && iter->second->state != JOB_CANCELLED &&
+               !iter->second->control.cancelled;
+    }
+
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            std::string handle = std::move(queue_.front());
+            queue_.pop_front();
+            std::shared_ptr<Job> job = jobs_[handle];
+            job->state = JOB_RUNNING;
+            job->ran = true;
+            job->started = std::chrono::steady_clock::now();
+            lock.unlock();
+
+            xlw::CellMatrix result;
+            const char* error = nullptr;
+            JobState state = JOB_DONE;
+            CurrentJob() = &job->control;
+            try {
+                result = job->work();
+            } catch (const char* message) {
+                error = message;
+                state = job->control.cancelled ? JOB_CANCELLED : JOB_FAILED;
+            } catch (const std::bad_alloc&) {
+                error = "Not enough memory for the job.";
+                state = JOB_FAILED;
+            } catch (...) {
+                error = "The job failed.";
+                state = JOB_FAILED;
+            }
+            CurrentJob() = nullptr;
+            // the inputs are not needed any more
+            job->work = nullptr;
+
+            lock.lock();
+            job->result = std::move(result);
+            job->error = error;
+            // a job cancelled and submitted again while it ran has been replaced, the new one is left alone
+            auto iter = jobs_.find(handle);
+            if (iter != end(jobs_) && iter->second == job) {
+                Finish(handle, *job, state);
+            } else {
+                job->state = state;
+            }
+        }
+    }
+
+    // moves the job to the finished ones, dropping the oldest beyond the history
+    void Finish(const std::string& handle, Job& job, JobState state) {
+        job.state = state;
+        job.finished = std::chrono::steady_clock::now();
+        finished_.push_back(handle);
+        while (finished_.size() > JOB_HISTORY) {
+            jobs_.erase(finished_.front());
+            finished_.pop_front();
+        }
+        done_.notify_all();
+    }
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable done_;
+    std::condition_variable wake_;
+    size_t threads_;
+    bool stopping_{false};
+    std::vector<std::thread> workers_; // started with the first jobs, up to threads_
+    std::unordered_map<std::string, std::shared_ptr<Job>> jobs_;
+    std::deque<std::string> queue_;
+    std::deque<std::string> finished_; // oldest first
+};
+
+// never destroyed: at exit the job threads may still use the other process-wide stores, which are destroyed by then
+inline JobEngine& Jobs() {
+    static JobEngine* engine = new JobEngine(JOB_THREADS);
+    return *engine;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "columnartable.h"
+
+/*************************************
+joins of two keyed tables
+*************************************/
+
+enum JoinType { JOIN_INNER, JOIN_LEFT, JOIN_RIGHT, JOIN_FULL, JOIN_SEMI, JOIN_ANTI };
+
+inline JoinType ParseJoinType(std::string name) {
+    for (auto& c : name) {
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (name == "inner" || name.empty())
+        return JOIN_INNER;
+    else if (name == "left")
+        return JOIN_LEFT;
+    else if (name == "right")
+        return JOIN_RIGHT;
+    else if (name == "full" || name == "outer")
+        return JOIN_FULL;
+    else if (name == "semi")
+        return JOIN_SEMI;
+    else if (name == "anti")
+        return JOIN_ANTI;
+    else
+        throw("Unknown join type, use inner, left, right, full, semi or anti.");
+}
+
+constexpr size_t NO_ROW = size_t(-1);
+
+// matching (left row, right row) pairs, NO_ROW standing for the missing side of an unmatched row
+// left rows come in order, each with its right rows in order; unmatched right rows follow at the end
+using JoinPairs = std::vector<std::pair<size_t, size_t>>;
+
+inline bool KeepsUnmatchedLeft(JoinType type) { return type == JOIN_LEFT || type == JOIN_FULL; }
+inline bool KeepsUnmatchedRight(JoinType type) { return type == JOIN_RIGHT || type == JOIN_FULL; }
+
+// -1, 0 or 1 as the keys of the two rows compare, in operator< order; NaN, equal to itself as a key as it is to the hash joins, sorts
+// after every other number rather than being equal to them all
+inline int CompareKeys(const ColumnarTable& lhs, size_t lRow, const ColumnarTable& rhs, size_t rRow, const StringPool& pool) {
+    for (size_t col = 0; col < lhs.Columns(); ++col) {
+        CellCode lCode = lhs(lRow, col);
+        CellCode rCode = rhs(rRow, col);
+        if (lCode == rCode) {
+            continue;
+        }
+        if (CodeType(lCode) == CVT_NUMBER && CodeType(rCode) == CVT_NUMBER) {
+            return OrderedDoubleBits(CodeNumber(lCode)) < OrderedDoubleBits(CodeNumber(rCode)) ? -1 : 1;
+        }
+        return LessCode(lCode, rCode, pool) ? -1 : (LessCode(rCode, lCode, pool) ? 1 : 0);
+    }
+    return 0;
+}
+
+inline bool IsSortedKeys(const ColumnarTable& keys, const StringPool& pool) {
+    for (size_t row = 1; row < keys.Rows(); ++row) {
+        if (CompareKeys(keys, row - 1, keys, row, pool) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// builds on the right keys and probes with the left ones
+inline JoinPairs HashJoinBuildRight(const ColumnarTable& left, const ColumnarTable& right, JoinType type) {
+    KeyGroups groups(right);
+    std::vector<bool> matchedRight(KeepsUnmatchedRight(type) ? right.Rows() : 0, false);
+    JoinPairs pairs;
+
+    for (size_t lRow = 0; lRow < left.Rows(); ++lRow) {
+        JobCheckpoint(lRow);
+        size_t id = groups.Find(left, lRow);
+        if (id == KeyIndex::npos) {
+            if (KeepsUnmatchedLeft(type) || type == JOIN_ANTI) {
+                pairs.emplace_back(lRow, NO_ROW);
+            }
+        } else if (type == JOIN_SEMI) {
+            pairs.emplace_back(lRow, NO_ROW);
+        } else if (type != JOIN_ANTI) {
+            auto rows = groups.Rows(id);
+            for (auto rRow = rows.first; rRow != rows.second; ++rRow) {
+                pairs.emplace_back(lRow, *rRow);
+                if (!matchedRight.empty()) {
+                    matchedRight[*rRow] = true;
+                }
+            }
+        }
+    }
+
+    for (size_t rRow = 0; rRow < matchedRight.size(); ++rRow) {
+        if (!matchedRight[rRow]) {
+            pairs.emplace_back(NO_ROW, rRow);
+        }
+    }
+    return pairs;
+}
+
+// builds on the left keys and probes with the right ones, then puts the pairs back in left order
+inline JoinPairs HashJoinBuildLeft(const ColumnarTable& left, const ColumnarTable& right, JoinType type) {
+    KeyGroups groups(left);
+    std::vector<size_t> counts(left.Rows() + 1, 0);
+    JoinPairs matches, unmatchedRight;
+
+    for (size_t rRow = 0; rRow < right.Rows(); ++rRow) {
+        JobCheckpoint(rRow);
+        size_t id = groups.Find(right, rRow);
+        if (id == KeyIndex::npos) {
+            if (KeepsUnmatchedRight(type)) {
+                unmatchedRight.emplace_back(NO_ROW, rRow);
+            }
+            continue;
+        }
+        auto rows = groups.Rows(id);
+        for (auto lRow = rows.first; lRow != rows.second; ++lRow) {
+            matches.emplace_back(*lRow, rRow);
+            ++counts[*lRow + 1];
+        }
+    }
+
+    // counting sort by left row; the right rows of each left row stay in order
+    for (size_t lRow = 0; lRow < left.Rows(); ++lRow) {
+        counts[lRow + 1] += counts[lRow];
+    }
+    JoinPairs sorted(matches.size());
+    std::vector<size_t> next(begin(counts), end(counts) - 1);
+    for (auto& match : matches) {
+        sorted[next[match.first]++] = match;
+    }
+
+    JoinPairs pairs;
+    pairs.reserve(sorted.size() + unmatchedRight.size());
+    for (size_t lRow = 0; lRow < left.Rows(); ++lRow) {
+        if (counts[lRow] == counts[lRow + 1]) {
+            if (KeepsUnmatchedLeft(type)) {
+                pairs.emplace_back(lRow, NO_ROW);
+            }
+        } else {
+            pairs.insert(end(pairs), begin(sorted) + counts[lRow], begin(sorted) + counts[lRow + 1]);
+        }
+    }
+    pairs.insert(end(pairs), begin(unmatchedRight), end(unmatchedRight));
+    return pairs;
+}
+
+// both sides must be sorted by key
+inline JoinPairs MergeJoin(const ColumnarTable& left, const ColumnarTable& right, const StringPool& pool, JoinType type) {
+    JoinPairs pairs, unmatchedRight;
+    size_t lRow = 0, rRow = 0;
+
+    while (lRow < left.Rows() || rRow < right.Rows()) {
+        int order = (lRow == left.Rows()) ? 1 : ((rRow == right.Rows()) ? -1 : CompareKeys(left, lRow, right, rRow, pool));
+        if (order < 0) {
+            if (KeepsUnmatchedLeft(type) || type == JOIN_ANTI) {
+                pairs.emplace_back(lRow, NO_ROW);
+            }
+            ++lRow;
+        } else if (order > 0) {
+            if (KeepsUnmatchedRight(type)) {
+                unmatchedRight.emplace_back(NO_ROW, rRow);
+            }
+            ++rRow;
+        } else {
+            // runs of equal keys on both sides
+            size_t lEnd = lRow + 1, rEnd = rRow + 1;
+            while (lEnd < left.Rows() && CompareKeys(left, lEnd, left, lRow, pool) == 0) {
+                ++lEnd;
+            }
+            while (rEnd < right.Rows() && CompareKeys(right, rEnd, right, rRow, pool) == 0) {
+                ++rEnd;
+            }
+            for (; lRow < lEnd; ++lRow) {
+                if (type == JOIN_SEMI) {
+                    pairs.emplace_back(lRow, NO_ROW);
+                } else if (type != JOIN_ANTI) {
+                    for (size_t row = rRow; row < rEnd; ++row) {
+                        pairs.emplace_back(lRow, row);
+                    }
+                }
+            }
+            rRow = rEnd;
+        }
+    }
+
+    pairs.insert(end(pairs), begin(unmatchedRight), end(unmatchedRight));
+    return pairs;
+}
+
+// keys encoded against the same string pool; every strategy returns the same pairs in the same order
+inline JoinPairs Join(const ColumnarTable& left, const ColumnarTable& right, const StringPool& pool, JoinType type) {
+    if (left.Columns() != right.Columns()) {
+        throw("The left and right keys do not have the same number of fields.");
+    }
+    // sorted inputs need no hash table at all
+    if (IsSortedKeys(left, pool) && IsSortedKeys(right, pool)) {
+        return MergeJoin(left, right, pool, type);
+    }
+    // otherwise build on the smaller side; semi and anti joins answer per left row, so they always build on the right
+    if (left.Rows() < right.Rows() && type != JOIN_SEMI && type != JOIN_ANTI) {
+        return HashJoinBuildLeft(left, right, type);
+    }
+    return HashJoinBuildRight(left, right, type);
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "columnartable.h"
+#include "parallel.h"
+#include "pivot.h"
+#include "registry.h"
+
+/*************************************
+incremental pivot: the input of the previous call is kept with the rows of every pivot cell, so a new input only aggregates again
+the cells of the rows that changed
+cells are aggregated over the same slices and in the same merge order as AggregatePivot, so the results are the bits of a full recompute
+*************************************/
+
+class IncrementalPivot {
+  public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit IncrementalPivot(const std::vector<AggregateSpec>& aggregates)
+        : aggregates_(aggregates), sketches_(aggregates, pool_), rowKeys_(0), columnKeys_(0) {
+        for (auto& aggregate : aggregates) {
+            numeric_ = numeric_ || IsNumericAggregate(aggregate.type);
+            distinct_ = distinct_ || aggregate.type == AGG_DISTINCT;
+        }
+    }
+
+    const std::vector<AggregateSpec>& Aggregates() const { return aggregates_; }
+
+    // the inputs of Update must be encoded against this pool
+    StringPool& Pool() { return pool_; }
+    const StringPool& Pool() const { return pool_; }
+
+    // replaces the input; rows are matched by position, rows past the end of the shorter input are inserts or deletes
+    // returns the number of input rows aggregated again
+    size_t Update(ColumnarTable values, ColumnarTable rows, ColumnarTable columns) {
+        size_t count = rows.Rows();
+        size_t previous = rows_.Rows();
+        size_t slices = WorkerCount(count, PIVOT_SLICE_ROWS);
+
+        // a change of the slices, the shape or most of the rows is cheaper to aggregate from scratch
+        bool incremental = (rowIds_.size() == previous) && rows.Columns() == rows_.Columns() && columns.Columns() == columns_.Columns() &&
+                           slices == slices_ && (slices == 1 || count == previous);
+        std::vector<size_t> changed;
+        for (size_t row = 0; incremental && row < std::max(count, previous); ++row) {
+            if (row >= count || row >= previous || !SameRow(values, rows, columns, row)) {
+                changed.push_back(row);
+                incremental = changed.size() <= count / 8 + 16;
+            }
+        }
+
+        std::vector<size_t> dirtyTotals, dirtyCells;
+        if (incremental) {
+            for (size_t row : changed) {
+                if (row < previous) {
+                    Remove(row, dirtyTotals, dirtyCells);
+                }
+            }
+        } else {
+            Clear(rows.Columns(), columns.Columns());
+        }
+        values_ = std::move(values);
+        rows_ = std::move(rows);
+        columns_ = std::move(columns);
+        slices_ = slices;
+        rowIds_.resize(count, npos);
+        cellIds_.resize(count, npos);
+
+        if (incremental) {
+            for (size_t row : changed) {
+                if (row < count) {
+                    Assign(row);
+                    AddMember(totalRows_[rowIds_[row]], row);
+                    dirtyTotals.push_back(rowIds_[row]);
+                    if (cellIds_[row] != npos) {
+                        AddMember(cellRows_[cellIds_[row]], row);
+                        dirtyCells.push_back(cellIds_[row]);
+                    }
+                }
+            }
+            Unique(dirtyTotals);
+            Unique(dirtyCells);
+        } else {
+            for (size_t row = 0; row < count; ++row) {
+                Assign(row);
+            }
+            Group(rowIds_, totalRows_);
+            Group(cellIds_, cellRows_);
+            dirtyTotals = AllIds(totals_.size());
+            dirtyCells = AllIds(cells_.size());
+        }
+
+        size_t workers = WorkerCount(dirtyTotals.size() + dirtyCells.size(), 1024);
+        ParallelFor(workers, [&](size_t worker) {
+            auto range = ChunkRange(dirtyTotals.size(), workers, worker);
+            for (size_t i = range.first; i < range.second; ++i) {
+                totals_[dirtyTotals[i]] = Aggregate(totalRows_[dirtyTotals[i]]);
+            }
+            range = ChunkRange(dirtyCells.size(), workers, worker);
+            for (size_t i = range.first; i < range.second; ++i) {
+                cells_[dirtyCells[i]] = Aggregate(cellRows_[dirtyCells[i]]);
+            }
+        });
+        return incremental ? changed.size() : count;
+    }
+
+    // keys and strings of earlier inputs are kept until the state is rebuilt; true when they outweigh the current input
+    bool Bloated() const {
+        size_t input = rows_.Rows() * (1 + rows_.Columns() + columns_.Columns());
+        return pool_.Size() + rowKeys_.Size() + columnKeys_.Size() + cells_.size() > 4 * input + 4096;
+    }
+
+    // the interface of PivotAggregation; keys and cells left without records by earlier inputs have a count of 0
+    const KeyIndex& RowKeys() const { return rowKeys_; }
+    const KeyIndex& ColumnKeys() const { return columnKeys_; }
+    const AggregateState& Total(size_t rowId) const { return totals_[rowId]; }
+    size_t Cells() const { return cells_.size(); }
+    size_t CellRow(size_t cellId) const { return size_t(cellKeys_[cellId] >> 32); }
+    size_t CellColumn(size_t cellId) const { return size_t(uint32_t(cellKeys_[cellId])); }
+    const AggregateState& Cell(size_t cellId) const { return cells_[cellId]; }
+
+    size_t MemoryUsage() const {
+        size_t rows = rows_.Rows();
+        return sizeof(*this) + pool_.MemoryUsage() + values_.MemoryUsage() + rows_.MemoryUsage() + columns_.MemoryUsage() + rowKeys_.MemoryUsage() +
+               columnKeys_.MemoryUsage() + (rowIds_.capacity() + cellIds_.capacity()) * sizeof(size_t) +
+               (totals_.capacity() + cells_.capacity()) * (sizeof(AggregateState) + sizeof(std::vector<size_t>)) + cellKeys_.size() * 3 * sizeof(uint64_t) +
+               (columns_.Columns() > 0 ? 2 : 1) * rows * sizeof(size_t) + SketchMemory(totals_) + SketchMemory(cells_);
+    }
+
+  private:
+    static uint64_t CellKey(size_t rowId, size_t columnId) { return (uint64_t(rowId) << 32) | uint32_t(columnId); }
+
+    static size_t SketchMemory(const std::vector<AggregateState>& states) {
+        size_t memory = 0;
+        for (auto& state : states) {
+            memory += state.sketches ? state.sketches->MemoryUsage() : 0;
+        }
+        return memory;
+    }
+
+    static void Unique(std::vector<size_t>& ids) {
+        std::sort(begin(ids), end(ids));
+        ids.erase(std::unique(begin(ids), end(ids)), end(ids));
+    }
+
+    static std::vector<size_t> AllIds(size_t count) {
+        std::vector<size_t> ids(count);
+        for (size_t id = 0; id < count; ++id) {
+            ids[id] = id;
+        }
+        return ids;
+    }
+
+    static void AddMember(std::vector<size_t>& members, size_t row) { members.insert(std::lower_bound(begin(members), end(members), row), row); }
+
+    static void RemoveMember(std::vector<size_t>& members, size_t row) { members.erase(std::lower_bound(begin(members), end(members), row)); }
+
+    bool SameRow(const ColumnarTable& values, const ColumnarTable& rows, const ColumnarTable& columns, size_t row) const {
+        if (values(row, 0) != values_(row, 0)) {
+            return false;
+        }
+        for (size_t col = 0; col < rows.Columns(); ++col) {
+            if (rows(row, col) != rows_(row, col)) {
+                return false;
+            }
+        }
+        for (size_t col = 0; col < columns.Columns(); ++col) {
+            if (columns(row, col) != columns_(row, col)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Clear(size_t rowWidth, size_t columnWidth) {
+        rowKeys_ = KeyIndex(rowWidth);
+        columnKeys_ = KeyIndex(columnWidth);
+        cellKeys_ = FlatHashSet<uint64_t, HashInteger, EqualInteger>();
+        totals_.clear();
+        cells_.clear();
+        totalRows_.clear();
+        cellRows_.clear();
+        rowIds_.clear();
+        cellIds_.clear();
+    }
+
+    // takes a row of the previous input out of its total and cell
+    void Remove(size_t row, std::vector<size_t>& dirtyTotals, std::vector<size_t>& dirtyCells) {
+        RemoveMember(totalRows_[rowIds_[row]], row);
+        dirtyTotals.push_back(rowIds_[row]);
+        if (cellIds_[row] != npos) {
+            RemoveMember(cellRows_[cellIds_[row]], row);
+            dirtyCells.push_back(cellIds_[row]);
+        }
+    }
+
+    // the ids of the row key and cell of a row of the current input
+    void Assign(size_t row) {
+        auto [rowId, newRow] = rowKeys_.Insert(rows_, row);
+        if (newRow) {
+            totals_.emplace_back();
+            totalRows_.emplace_back();
+        }
+        rowIds_[row] = rowId;
+
+        if (columns_.Columns() > 0) {
+            size_t columnId = columnKeys_.Insert(columns_, row).first;
+            auto [cellId, newCell] = cellKeys_.insert(CellKey(rowId, columnId));
+            if (newCell) {
+                cells_.emplace_back();
+                cellRows_.emplace_back();
+            }
+            cellIds_[row] = cellId;
+        }
+    }
+
+    // the rows of every id, sized before they are filled in order
+    static void Group(const std::vector<size_t>& ids, std::vector<std::vector<size_t>>& members) {
+        std::vector<size_t> counts(members.size(), 0);
+        for (size_t id : ids) {
+            if (id != npos) {
+                ++counts[id];
+            }
+        }
+        for (size_t id = 0; id < members.size(); ++id) {
+            members[id].reserve(counts[id]);
+        }
+        for (size_t row = 0; row < ids.size(); ++row) {
+            if (ids[row] != npos) {
+                members[ids[row]].push_back(row);
+            }
+        }
+    }
+
+    // the rows of one slice are added, then the slices are merged in order, as in AggregatePivot
+    AggregateState Aggregate(const std::vector<size_t>& members) const {
+        AggregateState state;
+        auto member = begin(members);
+        for (size_t slice = 0; slice < slices_; ++slice) {
+            size_t end = ChunkRange(rows_.Rows(), slices_, slice).second;
+            AggregateState part;
+            AggregateState& target = (slice == 0) ? state : part;
+            for (; member != members.end() && *member < end; ++member) {
+                target.Add(values_(*member, 0), *member, numeric_);
+                if (sketches_.Any()) {
+                    target.Sketch(values_(*member, 0), sketches_);
+                }
+            }
+            if (slice > 0 && part.count > 0.0) {
+                state.Merge(part);
+            }
+        }
+
+        if (distinct_) {
+            std::vector<CellCode> codes;
+            for (size_t row : members) {
+                codes.push_back(values_(row, 0));
+            }
+            std::sort(begin(codes), end(codes));
+            state.distinct = double(std::unique(begin(codes), end(codes)) - begin(codes));
+        }
+        return state;
+    }
+
+    std::vector<AggregateSpec> aggregates_;
+    bool numeric_{false};
+    bool distinct_{false};
+    StringPool pool_;
+    SketchOptions sketches_; // hashes strings in pool_
+    ColumnarTable values_;
+    ColumnarTable rows_;
+    ColumnarTable columns_;
+    size_t slices_{0};
+    KeyIndex rowKeys_;
+    KeyIndex columnKeys_;
+    FlatHashSet<uint64_t, HashInteger, EqualInteger> cellKeys_;
+    std::vector<AggregateState> totals_;
+    std::vector<AggregateState> cells_;
+    std::vector<std::vector<size_t>> totalRows_; // input rows of each row key, in order
+    std::vector<std::vector<size_t>> cellRows_;  // input rows of each cell, in order
+    std::vector<size_t> rowIds_;                 // row key of each input row
+    std::vector<size_t> cellIds_;                // cell of each input row, npos without column keys
+};
+
+// a live pivot is updated in place, under its lock, by the calls naming it; the registry hands it out as const
+struct LivePivot {
+    mutable std::mutex mutex;
+    mutable std::unique_ptr<IncrementalPivot> pivot;
+
+    size_t MemoryUsage() const { return sizeof(*this) + (pivot ? pivot->MemoryUsage() : 0); }
+};
+
+inline HandleRegistry<LivePivot>& LivePivotRegistry() {
+    static HandleRegistry<LivePivot> registry{size_t(512) << 20};
+    return registry;
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "columnartable.h"
+#include "mappedtable.h"
+#include "registry.h"
+
+/*************************************
+hash index over the rows of a table, built once and probed by many lookups
+*************************************/
+
+class LookupIndex {
+  public:
+    using RowRange = KeyGroups::RowRange;
+    static constexpr size_t npos = KeyIndex::npos;
+
+    // a key of numbers only is grouped by NumberKeyGroups, any other by KeyGroups; an index kept by handle has the second hash of
+    // the table content as its check
+    template <class Matrix>
+    explicit LookupIndex(const Matrix& table, uint64_t check = 0)
+        : rows_(table.RowsInStructure()), columns_(table.ColumnsInStructure()), check_(check) {
+        ColumnarTable keys(table, InternStrings{pool_});
+        if (NumberKeyIndex::Accepts(keys)) {
+            numbers_ = std::make_unique<NumberKeyGroups>(keys);
+        } else {
+            groups_ = std::make_unique<KeyGroups>(keys);
+        }
+    }
+
+    size_t Rows() const { return rows_; }
+    size_t Columns() const { return columns_; }
+    uint64_t Check() const { return check_; }
+
+    // the lookup items encoded against the strings of the table, ready to be probed
+    template <class Matrix> ColumnarTable Encode(const Matrix& lookup) const { return ColumnarTable(lookup, FindStrings{pool_}); }
+
+    // whether the keys are numbers only, probed with FindNumber; otherwise the lookup items are encoded and probed with Find
+    bool NumberKeys() const { return bool(numbers_); }
+
+    // the key id of an encoded lookup row, or npos if the table does not hold it
+    size_t Find(const ColumnarTable& lookup, size_t row) const { return groups_->Find(lookup, row); }
+
+    // the slot of the number with its key id and last table row, or nullptr
+    const NumberKeyIndex::Slot* FindNumber(double value) const { return numbers_->Find(value); }
+
+    // the table rows holding the key, in table order
+    RowRange TableRows(size_t id) const { return numbers_ ? numbers_->Rows(id) : groups_->Rows(id); }
+
+    void KeyValue(size_t id, size_t col, xlw::CellValue& result) const { DecodeCell(Key(id)[col], pool_, result); }
+
+    // writes the keys of the indexed table row by row as a table file, from which an equal index is built again
+    void Save(const std::string& path) const {
+        std::vector<size_t> rowIds(rows_);
+        size_t keys = numbers_ ? numbers_->Keys().Size() : groups_->Keys().Size();
+        for (size_t id = 0; id < keys; ++id) {
+            for (auto rows = TableRows(id); rows.first != rows.second; ++rows.first) {
+                rowIds[*rows.first] = id;
+            }
+        }
+
+        TableWriter writer(path, std::vector<std::string>(columns_));
+        std::vector<CellCode> codes(columns_);
+        for (size_t row = 0; row < rows_; ++row) {
+            const CellCode* key = Key(rowIds[row]);
+            for (size_t col = 0; col < columns_; ++col) {
+                bool text = CodeType(key[col]) == CVT_STRING;
+                codes[col] = text ? TaggedCode(CVT_STRING, writer.Intern(pool_[CodePayload(key[col])])) : key[col];
+            }
+            writer.AppendRow(codes.data());
+        }
+        writer.Finish();
+    }
+
+    size_t MemoryUsage() const {
+        return sizeof(*this) + pool_.MemoryUsage() + (numbers_ ? numbers_->MemoryUsage() : 0) + (groups_ ? groups_->MemoryUsage() : 0);
+    }
+
+  private:
+    const CellCode* Key(size_t id) const { return numbers_ ? numbers_->Keys().Key(id) : groups_->Keys().Key(id); }
+
+    size_t rows_;
+    size_t columns_;
+    uint64_t check_;
+    StringPool pool_;
+    std::unique_ptr<NumberKeyGroups> numbers_;
+    std::unique_ptr<KeyGroups> groups_;
+};
+
+/*************************************
+indexes evicted from the registry are spilled to table files in the temporary directory, so their handles keep working: the next
+call using the handle builds the index again from its file, instead of failing until QFBuildIndex is recalculated
+
+the files are kept to a budget of disk space, the oldest removed first, and a file is removed once its index is built again
+*************************************/
+
+constexpr size_t INDEX_SPILL_BUDGET = size_t(2) << 30; // bytes
+
+class IndexSpills {
+  public:
+    explicit IndexSpills(size_t budget = INDEX_SPILL_BUDGET) : budget_(budget) {
+        // the files of this process are told apart from those of other processes by a tag
+        uint64_t now = uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+        uint64_t tag = HashCombine(now, uint64_t(reinterpret_cast<uintptr_t>(this)));
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "QFIndex-%016llx-", static_cast<unsigned long long>(tag));
+        prefix_ = (std::filesystem::temp_directory_path() / buffer).string();
+    }
+    IndexSpills(const IndexSpills&) = delete;
+    IndexSpills& operator=(const IndexSpills&) = delete;
+    ~IndexSpills() {
+        for (auto& item : spills_) {
+            std::remove(item.second.path.c_str());
+        }
+    }
+
+    // the content of a handle only changes on a collision of fingerprints, told by the check hash, so it is mostly written once; the
+    // file is written without the lock, so that other spills and loads go on meanwhile, and a load of the handle meanwhile gets the
+    // index being written
+    void Save(const std::string& handle, const std::shared_ptr<const LookupIndex>& index) {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto iter = spills_.find(handle); iter != end(spills_)) {
+                if (iter->second.check == index->Check()) {
+                    return;
+                }
+                Erase(handle);
+            }
+            if (!writing_.emplace(handle, index).second) {
+                return;
+            }
+            path = prefix_ + std::to_string(files_++) + ".qft";
+        }
+        try {
+            index->Save(path);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_.erase(handle);
+            throw;
+        }
+        std::error_code error;
+        size_t bytes = size_t(std::filesystem::file_size(path, error));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        writing_.erase(handle);
+        if (error) {
+            std::remove(path.c_str());
+            return;
+        }
+        order_.push_back(handle);
+        spills_.emplace(handle, Spill{path, bytes, index->Check(), std::prev(end(order_))});
+        used_ += bytes;
+        while (used_ > budget_ && !order_.empty()) {
+            Erase(order_.front());
+        }
+    }
+
+    // the index built again from the file of a handle, or nullptr if it was not spilled, or its file was removed or cannot be read
+    std::shared_ptr<const LookupIndex> Load(const std::string& handle) {
+        std::string path;
+        uint64_t check;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto writing = writing_.find(handle); writing != end(writing_)) {
+                return writing->second;
+            }
+            auto iter = spills_.find(handle);
+            if (iter == end(spills_)) {
+                return nullptr;
+            }
+            path = iter->second.path;
+            check = iter->second.check;
+            // the index goes back to the registry, which spills it again if it is evicted again
+            used_ -= iter->second.bytes;
+            order_.erase(iter->second.position);
+            spills_.erase(iter);
+        }
+        std::shared_ptr<const LookupIndex> index;
+        try {
+            auto table = std::make_shared<const MappedTable>(path);
+            std::vector<size_t> columns(table->Columns());
+            std::iota(begin(columns), end(columns), size_t(0));
+            index = std::make_shared<const LookupIndex>(TableView(std::move(table), std::move(columns)), check);
+        } catch (const char*) {
+        }
+        std::remove(path.c_str());
+        return index;
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return spills_.size();
+    }
+
+    size_t DiskUsage() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return used_;
+    }
+
+  private:
+    struct Spill {
+        std::string path;
+        size_t bytes;
+        uint64_t check; // of the index spilled
+        std::list<std::string>::iterator position;
+    };
+
+    void Erase(const std::string& handle) {
+        auto iter = spills_.find(handle);
+        std::remove(iter->second.path.c_str());
+        used_ -= iter->second.bytes;
+        order_.erase(iter->second.position);
+        spills_.erase(iter);
+    }
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    std::string prefix_;
+    size_t files_{0};
+    size_t used_{0};
+    std::list<std::string> order_; // oldest spill first
+    std::unordered_map<std::string, Spill> spills_;
+    std::unordered_map<std::string, std::shared_ptr<const LookupIndex>> writing_;
+};
+
+inline IndexSpills& LookupIndexSpills() {
+    static IndexSpills spills;
+    return spills;
+}
+
+// an index whose file cannot be written is dropped, its handle then fails as before
+inline HandleRegistry<LookupIndex>& LookupIndexRegistry() {
+    static HandleRegistry<LookupIndex> registry{size_t(512) << 20, [](const std::string& handle, const auto& index) {
+                                                    try {
+                                                        LookupIndexSpills().Save(handle, index);
+                                                    } catch (const char*) {
+                                                    }
+                                                }};
+    return registry;
+}
+
+inline std::string LookupIndexHandle(uint64_t fingerprint) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "QFIndex:%016llx", static_cast<unsigned long long>(fingerprint));
+    return buffer;
+}
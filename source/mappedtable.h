@@ -0,0 +1,497 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cellhash.h"
+#include "columnartable.h"
+#include "registry.h"
+
+/*************************************
+columnar table files: a header, then every column as cell codes, then the strings the codes refer to
+integers are little endian; the strings of a file have their own ids, so they are re-interned by the calls reading them
+*************************************/
+
+constexpr char TABLE_FILE_MAGIC[8] = {'Q', 'F', 'T', 'A', 'B', 'L', 'E', '1'};
+
+struct TableFileHeader {
+    char magic[8];
+    uint64_t rows;
+    uint64_t columns;
+    uint64_t strings;
+    uint64_t typesOffset;         // columns uint32_t masks of the CellValueTypes in each column
+    uint64_t namesOffset;         // columns uint32_t string ids of the column names
+    uint64_t dataOffset;          // rows cell codes per column, one column after the other
+    uint64_t stringOffsetsOffset; // strings + 1 uint64_t offsets of the strings in the string bytes
+    uint64_t stringDataOffset;
+};
+
+/*************************************
+read only mapping of a whole file; its pages are only read from disk when touched
+*************************************/
+
+class MemoryMap {
+  public:
+    explicit MemoryMap(const std::string& path) {
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            throw("Cannot open the table file.");
+        }
+        LARGE_INTEGER size;
+        FILETIME written;
+        if (!GetFileSizeEx(file_, &size) || !GetFileTime(file_, nullptr, nullptr, &written) || size.QuadPart == 0) {
+            Close();
+            throw("Cannot read the table file.");
+        }
+        size_ = size_t(size.QuadPart);
+        stamp_ = (uint64_t(written.dwHighDateTime) << 32) | written.dwLowDateTime;
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data_ = mapping_ ? static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (!data_) {
+            Close();
+            throw("Cannot map the table file.");
+        }
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw("Cannot open the table file.");
+        }
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size == 0) {
+            close(file);
+            throw("Cannot read the table file.");
+        }
+        size_ = size_t(status.st_size);
+        stamp_ = HashCombine(uint64_t(status.st_mtime), uint64_t(status.st_ino));
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (data == MAP_FAILED) {
+            throw("Cannot map the table file.");
+        }
+        data_ = static_cast<const char*>(data);
+#endif
+    }
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap& operator=(const MemoryMap&) = delete;
+    ~MemoryMap() { Close(); }
+
+    const char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+    uint64_t Stamp() const { return stamp_; } // changes when the file is rewritten, so it gets a new handle
+
+  private:
+    void Close() {
+#if defined(_WIN32)
+        if (data_) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+        data_ = nullptr;
+    }
+
+#if defined(_WIN32)
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE mapping_{nullptr};
+#endif
+    const char* data_{nullptr};
+    size_t size_{0};
+    uint64_t stamp_{0};
+};
+
+/*************************************
+cells of a mapped table, with the interface of a cell value so the tables can be encoded like ranges
+*************************************/
+
+class MappedCell {
+  public:
+    MappedCell(CellCode code, std::string_view text) : code_(code), text_(text) {}
+
+    bool IsANumber() const { return CodeType(code_) == CVT_NUMBER; }
+    bool IsString() const { return CodeType(code_) == CVT_STRING; }
+    bool IsBoolean() const { return CodeType(code_) == CVT_BOOLEAN; }
+    bool IsError() const { return CodeType(code_) == CVT_ERROR; }
+    bool IsEmpty() const { return CodeType(code_) == CVT_EMPTY; }
+
+    explicit operator double() const { return CodeNumber(code_); }
+    explicit operator bool() const { return CodePayload(code_) != 0; }
+    unsigned long ErrorValue() const { return CodePayload(code_); }
+    std::string_view StringValue() const { return text_; }
+
+  private:
+    CellCode code_;
+    std::string_view text_;
+};
+
+inline void CopyCell(const xlw::CellValue& item, xlw::CellValue& result) { result = item; }
+
+inline void CopyCell(const MappedCell& item, xlw::CellValue& result) {
+    switch (GetType(item)) {
+    case CVT_NUMBER:
+        result = double(item);
+        break;
+    case CVT_STRING:
+        result = std::string(item.StringValue());
+        break;
+    case CVT_BOOLEAN:
+        result = bool(item);
+        break;
+    case CVT_ERROR:
+        result = xlw::CellValue::error_type{item.ErrorValue()};
+        break;
+    default:
+        result.clear();
+    }
+}
+
+class MappedTable {
+  public:
+    explicit MappedTable(const std::string& path) : path_(path), map_(path) {
+        if (map_.Size() < sizeof(TableFileHeader)) {
+            throw("The file is not a table file.");
+        }
+        std::memcpy(&header_, map_.Data(), sizeof(header_));
+        if (std::memcmp(header_.magic, TABLE_FILE_MAGIC, sizeof(TABLE_FILE_MAGIC)) != 0) {
+            throw("The file is not a table file.");
+        }
+        // every section must lie in the file; sizes are checked against the file size before they are multiplied
+        size_t size = map_.Size();
+        bool valid = header_.columns <= size / 4 && header_.strings < size / 8 && (header_.columns == 0 ? header_.rows == 0 : header_.rows <= size / 8 / header_.columns) &&
+                     Fits(header_.typesOffset, header_.columns * 4, 4) && Fits(header_.namesOffset, header_.columns * 4, 4) &&
+                     Fits(header_.dataOffset, header_.rows * header_.columns * 8, 8) &&
+                     Fits(header_.stringOffsetsOffset, (header_.strings + 1) * 8, 8) && Fits(header_.stringDataOffset, 0, 1);
+        if (!valid) {
+            throw("The table file is corrupt.");
+        }
+    }
+
+    size_t Rows() const { return size_t(header_.rows); }
+    size_t Columns() const { return size_t(header_.columns); }
+    const std::string& Path() const { return path_; }
+
+    // the codes of a column, straight from the mapping
+    const CellCode* Column(size_t col) const { return reinterpret_cast<const CellCode*>(map_.Data() + header_.dataOffset) + col * header_.rows; }
+
+    unsigned ColumnTypes(size_t col) const { return Read<uint32_t>(header_.typesOffset + col * 4); }
+    std::string_view ColumnName(size_t col) const { return String(Read<uint32_t>(header_.namesOffset + col * 4)); }
+
+    std::string_view String(uint64_t id) const {
+        if (id >= header_.strings) {
+            throw("The table file is corrupt.");
+        }
+        uint64_t first = Read<uint64_t>(header_.stringOffsetsOffset + id * 8);
+        uint64_t last = Read<uint64_t>(header_.stringOffsetsOffset + id * 8 + 8);
+        if (first > last || last > map_.Size() - header_.stringDataOffset) {
+            throw("The table file is corrupt.");
+        }
+        return std::string_view(map_.Data() + header_.stringDataOffset + first, size_t(last - first));
+    }
+
+    MappedCell Cell(size_t row, size_t col) const {
+        CellCode code = Column(col)[row];
+        return MappedCell(code, CodeType(code) == CVT_STRING ? String(CodePayload(code)) : std::string_view());
+    }
+
+    uint64_t Fingerprint() const { return HashCombine(HashCombine(map_.Size(), map_.Stamp()), HashBytes(map_.Data(), sizeof(header_))); }
+    uint64_t Check() const { return CheckCombine(CheckCombine(map_.Size(), map_.Stamp()), CheckBytes(map_.Data(), sizeof(header_))); }
+
+    // the whole mapping is counted: it takes that much address space, and that much memory once its pages are read
+    size_t MemoryUsage() const { return sizeof(*this) + path_.capacity() + map_.Size(); }
+
+  private:
+    bool Fits(uint64_t offset, uint64_t length, uint64_t alignment) const {
+        return offset % alignment == 0 && offset <= map_.Size() && length <= map_.Size() - offset;
+    }
+
+    template <class T> T Read(uint64_t offset) const {
+        T value;
+        std::memcpy(&value, map_.Data() + offset, sizeof(value));
+        return value;
+    }
+
+    std::string path_;
+    MemoryMap map_;
+    TableFileHeader header_;
+};
+
+// some columns of a mapped table, seen as a table of MappedCells
+class TableView {
+  public:
+    TableView(std::shared_ptr<const MappedTable> table, std::vector<size_t> columns) : table_(std::move(table)), columns_(std::move(columns)) {}
+
+    size_t RowsInStructure() const { return table_->Rows(); }
+    size_t ColumnsInStructure() const { return columns_.size(); }
+    MappedCell operator()(size_t row, size_t col) const { return table_->Cell(row, columns_[col]); }
+
+    uint64_t Fingerprint() const {
+        uint64_t hash = table_->Fingerprint();
+        for (size_t col : columns_) {
+            hash = HashCombine(hash, col);
+        }
+        return hash;
+    }
+
+    // a second hash of the same, as the check hash of DigestMatrix
+    uint64_t Check() const {
+        uint64_t check = table_->Check();
+        for (size_t col : columns_) {
+            check = CheckCombine(check, col);
+        }
+        return check;
+    }
+
+  private:
+    std::shared_ptr<const MappedTable> table_;
+    std::vector<size_t> columns_;
+};
+
+// the mappings open at a time are bounded by the address space they take, of which a 32 bit process has little
+constexpr uint64_t MAPPED_TABLE_BUDGET = sizeof(void*) >= 8 ? uint64_t(16) << 30 : uint64_t(512) << 20;
+
+// the files of the tables evicted from the registry, by handle
+class EvictedTables {
+  public:
+    void Add(const std::string& handle, const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        paths_[handle] = path;
+    }
+
+    // empty if the handle was never evicted
+    std::string Path(const std::string& handle) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = paths_.find(handle);
+        return iter == end(paths_) ? std::string() : iter->second;
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::string> paths_;
+};
+
+inline EvictedTables& EvictedTablePaths() {
+    static EvictedTables paths;
+    return paths;
+}
+
+inline HandleRegistry<MappedTable>& MappedTableRegistry() {
+    static HandleRegistry<MappedTable> registry{size_t(MAPPED_TABLE_BUDGET), [](const std::string& handle, const auto& table) {
+                                                    EvictedTablePaths().Add(handle, table->Path());
+                                                }};
+    return registry;
+}
+
+constexpr char TABLE_HANDLE_PREFIX[] = "QFTable:";
+
+inline std::string MappedTableHandle(uint64_t fingerprint) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%s%016llx", TABLE_HANDLE_PREFIX, static_cast<unsigned long long>(fingerprint));
+    return buffer;
+}
+
+inline bool IsTableHandle(std::string_view text) { return text.compare(0, sizeof(TABLE_HANDLE_PREFIX) - 1, TABLE_HANDLE_PREFIX) == 0; }
+
+// the table of a handle without columns; an evicted table is mapped again, as long as its file has not changed since
+inline std::shared_ptr<const MappedTable> FindMappedTable(const std::string& handle) {
+    auto table = MappedTableRegistry().Find(handle);
+    if (table) {
+        return table;
+    }
+    if (std::string path = EvictedTablePaths().Path(handle); !path.empty()) {
+        try {
+            table = std::make_shared<const MappedTable>(path);
+        } catch (const char*) {
+        }
+        if (table && MappedTableHandle(table->Fingerprint()) == handle) {
+            MappedTableRegistry().Insert(handle, table);
+            return table;
+        }
+    }
+    throw("Unknown or evicted table handle, recalculate its QFOpenTable.");
+}
+
+// a table handle, optionally followed by the 1-based numbers of the columns it shows: QFTable:0123456789abcdef:2,5
+inline TableView FindTableView(const std::string& handle) {
+    size_t split = handle.find(':', sizeof(TABLE_HANDLE_PREFIX) - 1);
+    auto table = FindMappedTable(handle.substr(0, split));
+
+    std::vector<size_t> columns;
+    if (split == std::string::npos) {
+        for (size_t col = 0; col < table->Columns(); ++col) {
+            columns.push_back(col);
+        }
+    } else {
+        const char* text = handle.c_str() + split + 1;
+        while (*text) {
+            char* end;
+            unsigned long long col = std::strtoull(text, &end, 10);
+            if (end == text || col < 1 || col > table->Columns() || (*end != ',' && *end != '\0')) {
+                throw("Invalid table handle.");
+            }
+            columns.push_back(size_t(col) - 1);
+            text = (*end == ',') ? end + 1 : end;
+        }
+    }
+    return TableView(std::move(table), std::move(columns));
+}
+
+/*************************************
+streaming writer of table files: rows are buffered in blocks per column and spilled to a scratch file, so any number of rows
+takes bounded memory besides the distinct strings
+*************************************/
+
+class TableWriter {
+  public:
+    static constexpr size_t BLOCK_ROWS = 65536;
+
+    TableWriter(const std::string& path, const std::vector<std::string>& names)
+        : path_(path), partial_(path + ".partial"), spill_(path + ".spill"), blocks_(names.size()) {
+        for (auto& name : names) {
+            names_.push_back(strings_.Intern(name));
+        }
+        types_.assign(names.size(), 0);
+        spillFile_.open(spill_, std::ios::binary | std::ios::trunc);
+        if (!spillFile_) {
+            throw("Cannot write the table file.");
+        }
+    }
+    TableWriter(const TableWriter&) = delete;
+    TableWriter& operator=(const TableWriter&) = delete;
+    ~TableWriter() {
+        spillFile_.close();
+        std::remove(spill_.c_str());
+        std::remove(partial_.c_str());
+    }
+
+    size_t Columns() const { return blocks_.size(); }
+    size_t Rows() const { return rows_; }
+    uint32_t Intern(std::string_view text) { return strings_.Intern(text); }
+
+    // one code per column, strings encoded with Intern
+    void AppendRow(const CellCode* codes) {
+        for (size_t col = 0; col < blocks_.size(); ++col) {
+            blocks_[col].push_back(codes[col]);
+            types_[col] |= 1u << CodeType(codes[col]);
+        }
+        if (++rows_ % BLOCK_ROWS == 0) {
+            Spill();
+        }
+    }
+
+    // writes the file next to its destination, then moves it in place, so readers of a previous version keep their mapping
+    void Finish() {
+        Spill();
+        spillFile_.close();
+
+        TableFileHeader header{};
+        std::memcpy(header.magic, TABLE_FILE_MAGIC, sizeof(TABLE_FILE_MAGIC));
+        header.rows = rows_;
+        header.columns = blocks_.size();
+        header.strings = strings_.Size();
+        header.typesOffset = Align(sizeof(TableFileHeader));
+        header.namesOffset = header.typesOffset + 4 * header.columns;
+        header.dataOffset = Align(header.namesOffset + 4 * header.columns);
+        header.stringOffsetsOffset = header.dataOffset + 8 * header.rows * header.columns;
+        header.stringDataOffset = header.stringOffsetsOffset + 8 * (header.strings + 1);
+
+        std::ofstream file(partial_, std::ios::binary | std::ios::trunc);
+        std::ifstream spill(spill_, std::ios::binary);
+        Write(file, &header, sizeof(header));
+        Pad(file, header.typesOffset);
+        Write(file, types_.data(), 4 * types_.size());
+        Write(file, names_.data(), 4 * names_.size());
+        Pad(file, header.dataOffset);
+
+        // the spill holds the blocks row block by row block, each column of a block after the other
+        std::vector<CellCode> buffer(BLOCK_ROWS);
+        for (size_t col = 0; col < blocks_.size(); ++col) {
+            for (size_t first = 0; first < rows_; first += BLOCK_ROWS) {
+                size_t count = std::min(BLOCK_ROWS, rows_ - first);
+                spill.seekg(std::streamoff(8 * (first * blocks_.size() + col * count)));
+                spill.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(8 * count));
+                Write(file, buffer.data(), 8 * count);
+            }
+        }
+
+        uint64_t offset = 0;
+        for (uint32_t id = 0; id < strings_.Size(); ++id) {
+            Write(file, &offset, 8);
+            offset += strings_[id].size();
+        }
+        Write(file, &offset, 8);
+        for (uint32_t id = 0; id < strings_.Size(); ++id) {
+            Write(file, strings_[id].data(), strings_[id].size());
+        }
+
+        file.close();
+        spill.close();
+        if (!file || !spill) {
+            throw("Cannot write the table file.");
+        }
+        std::remove(path_.c_str());
+        if (std::rename(partial_.c_str(), path_.c_str()) != 0) {
+            throw("Cannot replace the table file.");
+        }
+    }
+
+  private:
+    static uint64_t Align(uint64_t offset) { return (offset + 7) / 8 * 8; }
+
+    static void Write(std::ofstream& file, const void* data, size_t size) { file.write(static_cast<const char*>(data), std::streamsize(size)); }
+
+    static void Pad(std::ofstream& file, uint64_t offset) {
+        while (uint64_t(file.tellp()) < offset) {
+            file.put('\0');
+        }
+    }
+
+    void Spill() {
+        for (auto& block : blocks_) {
+            Write(spillFile_, block.data(), 8 * block.size());
+            block.clear();
+        }
+        if (!spillFile_) {
+            throw("Cannot write the table file.");
+        }
+    }
+
+    std::string path_;
+    std::string partial_;
+    std::string spill_;
+    std::ofstream spillFile_;
+    StringPool strings_;
+    std::vector<uint32_t> names_;
+    std::vector<unsigned> types_;
+    std::vector<std::vector<CellCode>> blocks_; // the rows since the last spill
+    size_t rows_{0};
+};
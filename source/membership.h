@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "columnartable.h"
+
+/*************************************
+membership tests: a Bloom filter small enough to stay in cache answers most misses before the exact hash set is read
+*************************************/
+
+constexpr size_t BLOOM_BITS_PER_KEY = 12; // about 0.5% false positives
+constexpr size_t BLOOM_MIN_KEYS = size_t(1) << 12; // smaller sets are in cache already, a filter would only add work
+constexpr size_t BLOOM_MAX_KEYS = size_t(1) << 20; // larger filters are out of cache, a probe would miss twice
+
+// whether a set of keys is worth a filter in front of it
+inline bool WorthFilter(size_t keys) { return keys >= BLOOM_MIN_KEYS && keys <= BLOOM_MAX_KEYS; }
+
+// split block Bloom filter: the key sets one bit in each 32 bit word of a single 256 bit block, so a probe reads one cache line
+class BloomFilter {
+  public:
+    BloomFilter() = default;
+
+    explicit BloomFilter(size_t keys) : blocks_(std::max<size_t>(1, (keys * BLOOM_BITS_PER_KEY + 255) / 256)) {}
+
+    bool Empty() const { return blocks_.empty(); }
+
+    void Insert(uint64_t hash) {
+        Block& block = blocks_[BlockOf(hash)];
+        for (size_t i = 0; i < 8; ++i) {
+            block.words[i] |= Bit(hash, i);
+        }
+    }
+
+    // false only if the hash has never been inserted; the words are tested without branches, which vectorizes
+    bool MayContain(uint64_t hash) const {
+        const Block& block = blocks_[BlockOf(hash)];
+        uint32_t missing = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            missing |= Bit(hash, i) & ~block.words[i];
+        }
+        return missing == 0;
+    }
+
+    size_t MemoryUsage() const { return blocks_.capacity() * sizeof(Block); }
+
+  private:
+    struct alignas(32) Block {
+        uint32_t words[8]{};
+    };
+
+    // the upper half of the hash picks the block, the lower half the bits
+    size_t BlockOf(uint64_t hash) const { return size_t(((hash >> 32) * blocks_.size()) >> 32); }
+
+    static uint32_t Bit(uint64_t hash, size_t i) {
+        static constexpr uint32_t salts[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                              0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+        return 1u << ((uint32_t(hash) * salts[i]) >> 27);
+    }
+
+    std::vector<Block> blocks_;
+};
+
+/*************************************
+distinct rows of a table, hashed and compared by cell content; the table is held by reference, so the keys of a call are neither
+copied nor encoded, and lookup rows are probed straight from their cells
+*************************************/
+
+// content hash of a cell: a number is hashed by its code, a single mix, as numbers are the bulk of most keys
+template <class Cell> uint64_t HashMember(const Cell& item) { return GetType(item) == CVT_NUMBER ? HashMix(NumberCode(double(item))) : HashCell(item); }
+
+// content hash of a row, the same for equal rows of any cell types
+template <class Matrix> uint64_t HashRow(const Matrix& x, size_t row) {
+    if (x.ColumnsInStructure() == 1) {
+        return HashMember(x(row, 0));
+    }
+    uint64_t hash = x.ColumnsInStructure();
+    for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+        hash = HashCombine(hash, HashMember(x(row, col)));
+    }
+    return hash;
+}
+
+template <class Table> class TableKeys {
+  public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit TableKeys(const Table& table) : rows_(RowHash(), RowEqual{&table}) {
+        std::vector<uint64_t> hashes;
+        for (size_t row = 0; row < table.RowsInStructure(); ++row) {
+            uint64_t hash = HashRow(table, row);
+            if (rows_.find_or_insert(Row<Table>{table, row}, hash, [](const Row<Table>& item) { return item.row; }).second) {
+                hashes.push_back(hash);
+            }
+        }
+        if (WorthFilter(hashes.size())) {
+            filter_ = BloomFilter(hashes.size());
+            for (uint64_t hash : hashes) {
+                filter_.Insert(hash);
+            }
+        }
+    }
+
+    size_t Size() const { return rows_.size(); }
+
+    // the first table row holding the row of the lookup, or npos; the lookup has the columns of the table
+    template <class Matrix> size_t Find(const Matrix& lookup, size_t row) const {
+        uint64_t hash = HashRow(lookup, row);
+        if (!filter_.Empty() && !filter_.MayContain(hash)) {
+            return npos;
+        }
+        size_t id = rows_.find(Row<Matrix>{lookup, row}, hash);
+        return id == npos ? npos : rows_[id];
+    }
+
+    size_t MemoryUsage() const { return sizeof(*this) + rows_.size() * (sizeof(size_t) + 2 * sizeof(uint64_t)) + filter_.MemoryUsage(); }
+
+  private:
+    template <class Matrix> struct Row {
+        const Matrix& x;
+        size_t row;
+    };
+
+    struct RowHash {
+        template <class Matrix> uint64_t operator()(const Row<Matrix>& item) const { return HashRow(item.x, item.row); }
+    };
+
+    struct RowEqual {
+        const Table* table;
+        template <class Matrix> bool operator()(size_t tableRow, const Row<Matrix>& item) const {
+            for (size_t col = 0; col < table->ColumnsInStructure(); ++col) {
+                if (!EqualCell((*table)(tableRow, col), item.x(item.row, col))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    FlatHashSet<size_t, RowHash, RowEqual> rows_; // first table row of each distinct row
+    BloomFilter filter_;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*************************************
+splitting work across threads
+*************************************/
+
+// threads the work is split across, the hardware threads unless set otherwise; the tests set it to split work on any machine
+inline std::atomic<size_t>& WorkerThreads() {
+    static std::atomic<size_t> threads{std::max<size_t>(std::thread::hardware_concurrency(), 1)};
+    return threads;
+}
+
+// number of threads worth using for the given amount of work, at least one
+inline size_t WorkerCount(size_t items, size_t minItemsPerWorker) {
+    size_t threads = std::max<size_t>(WorkerThreads().load(std::memory_order_relaxed), 1);
+    return std::max<size_t>(std::min(threads, items / std::max<size_t>(minItemsPerWorker, 1)), 1);
+}
+
+// [begin, end) of the chunk-th of chunks contiguous slices of items
+inline std::pair<size_t, size_t> ChunkRange(size_t items, size_t chunks, size_t chunk) {
+    return {items * chunk / chunks, items * (chunk + 1) / chunks};
+}
+
+/*************************************
+cancellation: the job a thread works for, which the threads of its ParallelFor work for too
+scans pass a checkpoint on every row; each block of rows is counted to the job, which is stopped there once cancelled
+*************************************/
+
+constexpr size_t JOB_CHECKPOINT_ROWS = 4096; // a power of two
+
+struct JobControl {
+    std::atomic<bool> cancelled{false};
+    std::atomic<uint64_t> rows{0}; // rows scanned so far, in whole blocks
+};
+
+// nullptr outside of background jobs
+inline JobControl*& CurrentJob() {
+    thread_local JobControl* job = nullptr;
+    return job;
+}
+
+inline void JobCheckpoint(size_t row) {
+    if ((row & (JOB_CHECKPOINT_ROWS - 1)) != JOB_CHECKPOINT_ROWS - 1) {
+        return;
+    }
+    if (JobControl* job = CurrentJob()) {
+        job->rows.fetch_add(JOB_CHECKPOINT_ROWS, std::memory_order_relaxed);
+        if (job->cancelled.load(std::memory_order_relaxed)) {
+            throw("The job has been cancelled.");
+        }
+    }
+}
+
+// runs function(chunk) for every chunk in [0, chunks), the first one on the calling thread, as are those no thread can be started
+// for; rethrows the first exception
+template <class Function> void ParallelFor(size_t chunks, Function function) {
+    std::vector<std::exception_ptr> errors(chunks);
+    JobControl* job = CurrentJob();
+    auto run = [&](size_t chunk) {
+        CurrentJob() = job;
+        try {
+            function(chunk);
+        } catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(chunks);
+    size_t started = 1;
+    try {
+        for (; started < chunks; ++started) {
+            threads.emplace_back(run, started);
+        }
+    } catch (const std::system_error&) {
+    }
+    if (chunks > 0) {
+        run(0);
+    }
+    for (size_t chunk = started; chunk < chunks; ++chunk) {
+        run(chunk);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -0,0 +1,432 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "columnartable.h"
+#include "parallel.h"
+#include "sketches.h"
+
+/*************************************
+aggregates
+*************************************/
+
+enum AggregateType {
+    AGG_SUM,
+    AGG_COUNT,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_MEAN,
+    AGG_VARIANCE,
+    AGG_FIRST,
+    AGG_LAST,
+    AGG_DISTINCT,
+    AGG_APPROX_DISTINCT,
+    AGG_APPROX_QUANTILE,
+    AGG_APPROX_TOP
+};
+
+// an aggregate with its parameters, the fraction of a quantile and the error of an approximate aggregate
+struct AggregateSpec {
+    AggregateSpec(AggregateType type, double fraction = 0.0) : type(type), fraction(fraction) {}
+
+    bool operator==(const AggregateSpec& other) const {
+        return type == other.type && fraction == other.fraction && error == other.error;
+    }
+
+    AggregateType type;
+    double fraction;
+    double error{DEFAULT_SKETCH_ERROR};
+};
+
+inline bool IsApproximateAggregate(AggregateType type) {
+    return type == AGG_APPROX_DISTINCT || type == AGG_APPROX_QUANTILE || type == AGG_APPROX_TOP;
+}
+
+// the error written after an approximate aggregate
+inline double ParseAggregateError(const AggregateSpec& aggregate, const char* text) {
+    if (!IsApproximateAggregate(aggregate.type)) {
+        throw("Only approxdistinct, approxtop, median and p0 to p100 take an error, as in \"p99@0.005\".");
+    }
+    char* end = nullptr;
+    double error = std::strtod(text, &end);
+    if (end == text || *end != '\0') {
+        throw("The error of an aggregate must be a number, as in \"p99@0.005\".");
+    }
+    return SketchError(error);
+}
+
+inline AggregateSpec ParseAggregate(std::string name) {
+    for (auto& c : name) {
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    }
+    // an approximate aggregate may be followed by its error, as in "p99@0.005" or "approxdistinct@0.02"
+    if (size_t at = name.find('@'); at != std::string::npos) {
+        AggregateSpec aggregate = ParseAggregate(name.substr(0, at));
+        aggregate.error = ParseAggregateError(aggregate, name.c_str() + at + 1);
+        return aggregate;
+    }
+    if (name == "sum")
+        return AGG_SUM;
+    else if (name == "count")
+        return AGG_COUNT;
+    else if (name == "min")
+        return AGG_MIN;
+    else if (name == "max")
+        return AGG_MAX;
+    else if (name == "mean" || name == "average")
+        return AGG_MEAN;
+    else if (name == "variance" || name == "var")
+        return AGG_VARIANCE;
+    else if (name == "first")
+        return AGG_FIRST;
+    else if (name == "last")
+        return AGG_LAST;
+    else if (name == "distinct" || name == "distinctcount")
+        return AGG_DISTINCT;
+    else if (name == "approxdistinct")
+        return AGG_APPROX_DISTINCT;
+    else if (name == "approxtop" || name == "mode")
+        return AGG_APPROX_TOP;
+    else if (name == "median")
+        return {AGG_APPROX_QUANTILE, 0.5};
+    else if (name.size() > 1 && name[0] == 'p' && name.find_first_not_of("0123456789.", 1) == std::string::npos) {
+        double percent = std::strtod(name.c_str() + 1, nullptr);
+        if (percent >= 0.0 && percent <= 100.0) {
+            return {AGG_APPROX_QUANTILE, percent / 100.0};
+        }
+    }
+    throw("Unknown aggregate, use sum, count, min, max, mean, variance, first, last, distinct, approxdistinct, approxtop, median or p0 "
+          "to p100.");
+}
+
+inline std::string AggregateName(const AggregateSpec& aggregate) {
+    static const char* names[] = {"sum",   "count", "min",      "max",            "mean", "variance",
+                                  "first", "last",  "distinct", "approxdistinct", "",     "approxtop"};
+    std::ostringstream name;
+    if (aggregate.type == AGG_APPROX_QUANTILE) {
+        name << 'p' << aggregate.fraction * 100.0;
+    } else {
+        name << names[aggregate.type];
+    }
+    if (aggregate.error != DEFAULT_SKETCH_ERROR) {
+        name << '@' << aggregate.error;
+    }
+    return name.str();
+}
+
+// whether the aggregate needs numeric values
+inline bool IsNumericAggregate(AggregateType type) {
+    return type == AGG_SUM || type == AGG_MIN || type == AGG_MAX || type == AGG_MEAN || type == AGG_VARIANCE || type == AGG_APPROX_QUANTILE;
+}
+
+// the sketches the approximate aggregates of a pivot need; strings are hashed by their text, so that the sketches do not depend
+// on the pool they are encoded in. aggregates of one kind share a sketch, built for the smallest of their errors
+struct SketchOptions {
+    SketchOptions(const std::vector<AggregateSpec>& aggregates, const StringPool& pool) : pool(&pool) {
+        for (auto& aggregate : aggregates) {
+            if (aggregate.type == AGG_APPROX_DISTINCT) {
+                distinctError = distinct ? std::min(distinctError, aggregate.error) : aggregate.error;
+                distinct = true;
+            } else if (aggregate.type == AGG_APPROX_QUANTILE) {
+                quantileError = quantile ? std::min(quantileError, aggregate.error) : aggregate.error;
+                quantile = true;
+            } else if (aggregate.type == AGG_APPROX_TOP) {
+                frequentError = frequent ? std::min(frequentError, aggregate.error) : aggregate.error;
+                frequent = true;
+            }
+        }
+    }
+
+    bool Any() const { return distinct || quantile || frequent; }
+
+    uint64_t Hash(CellCode value) const {
+        if (CodeType(value) == CVT_STRING) {
+            std::string_view text = (*pool)[CodePayload(value)];
+            return HashBytes(text.data(), text.size());
+        }
+        return HashMix(value);
+    }
+
+    bool distinct{false};
+    bool quantile{false};
+    bool frequent{false};
+    double distinctError{DEFAULT_SKETCH_ERROR};
+    double quantileError{DEFAULT_SKETCH_ERROR};
+    double frequentError{DEFAULT_SKETCH_ERROR};
+    const StringPool* pool;
+};
+
+struct CellSketches {
+    explicit CellSketches(const SketchOptions& options)
+        : distinct(options.distinctError), quantiles(options.quantileError), frequent(options.frequentError) {}
+
+    void Add(CellCode value, const SketchOptions& options) {
+        if (options.distinct) {
+            distinct.Add(options.Hash(value));
+        }
+        if (options.quantile) {
+            quantiles.Add(NumericCode(value));
+        }
+        if (options.frequent) {
+            frequent.Add(options.Hash(value), value);
+        }
+    }
+
+    void Merge(const CellSketches& other) {
+        distinct.Merge(other.distinct);
+        quantiles.Merge(other.quantiles);
+        frequent.Merge(other.frequent);
+    }
+
+    size_t MemoryUsage() const { return distinct.MemoryUsage() + quantiles.MemoryUsage() + frequent.MemoryUsage(); }
+
+    DistinctSketch distinct;
+    QuantileSketch quantiles;
+    FrequentSketch frequent;
+};
+
+// running state of every aggregate of one pivot cell; states of disjoint row sets merge into the state of their union
+struct AggregateState {
+    static constexpr size_t npos = size_t(-1);
+
+    double count{0.0};
+    double sum{0.0};
+    double min{std::numeric_limits<double>::infinity()};
+    double max{-std::numeric_limits<double>::infinity()};
+    double mean{0.0};
+    double m2{0.0}; // sum of squared deviations from the mean
+    size_t firstRow{npos};
+    CellCode first{0};
+    size_t lastRow{0};
+    CellCode last{0};
+    double distinct{0.0};
+    std::unique_ptr<CellSketches> sketches; // only for approximate aggregates
+
+    void Add(CellCode value, size_t row, bool numeric) {
+        count += 1.0;
+        if (numeric) {
+            double x = NumericCode(value);
+            sum += x;
+            min = std::min(min, x);
+            max = std::max(max, x);
+            double delta = x - mean;
+            mean += delta / count;
+            m2 += delta * (x - mean);
+        }
+        if (firstRow == npos || row < firstRow) {
+            firstRow = row;
+            first = value;
+        }
+        if (row >= lastRow) {
+            lastRow = row;
+            last = value;
+        }
+    }
+
+    void Merge(const AggregateState& other) {
+        double total = count + other.count;
+        if (total > 0.0) {
+            double delta = other.mean - mean;
+            m2 += other.m2 + delta * delta * count * other.count / total;
+            mean += delta * other.count / total;
+        }
+        count = total;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        if (other.firstRow != npos && (firstRow == npos || other.firstRow < firstRow)) {
+            firstRow = other.firstRow;
+            first = other.first;
+        }
+        if (other.firstRow != npos && other.lastRow >= lastRow) {
+            lastRow = other.lastRow;
+            last = other.last;
+        }
+        if (other.sketches && sketches) {
+            sketches->Merge(*other.sketches);
+        } else if (other.sketches) {
+            sketches = std::make_unique<CellSketches>(*other.sketches);
+        }
+    }
+
+    void Sketch(CellCode value, const SketchOptions& options) {
+        if (!sketches) {
+            sketches = std::make_unique<CellSketches>(options);
+        }
+        sketches->Add(value, options);
+    }
+};
+
+/*************************************
+hash aggregation of a pivot table over a slice of rows
+*************************************/
+
+struct HashCodePair {
+    uint64_t operator()(const std::pair<uint64_t, CellCode>& item) const { return HashCombine(HashMix(item.first), item.second); }
+};
+
+struct EqualCodePair {
+    bool operator()(const std::pair<uint64_t, CellCode>& lhs, const std::pair<uint64_t, CellCode>& rhs) const { return lhs == rhs; }
+};
+
+// RowIndex is KeyIndex, or NumberKeyIndex for a row key of numbers only
+template <class RowIndex> class PivotAggregation {
+  public:
+    static constexpr uint32_t TOTAL_COLUMN = 0xffffffff; // column id of the row totals in a cell key
+
+    // aggregates rows [begin, end); columns may have no fields, then there are only row totals
+    PivotAggregation(const ColumnarTable& values, const ColumnarTable& rows, const ColumnarTable& columns, bool numeric, bool distinct,
+                     const SketchOptions& sketches, size_t begin, size_t end)
+        : rows_(&rows), columns_(&columns), rowKeys_(rows.Columns()), columnKeys_(columns.Columns()), distinct_(distinct) {
+        bool hasColumns = columns.Columns() > 0;
+        bool sketch = sketches.Any();
+
+        for (size_t row = begin; row < end; ++row) {
+            JobCheckpoint(row);
+            CellCode value = values(row, 0);
+
+            auto [rowId, newRow] = rowKeys_.Insert(rows, row);
+            if (newRow) {
+                rowFirst_.push_back(row);
+                totals_.emplace_back();
+            }
+            totals_[rowId].Add(value, row, numeric);
+            if (sketch) {
+                totals_[rowId].Sketch(value, sketches);
+            }
+            if (distinct_) {
+                distinctValues_.insert({CellKey(rowId, TOTAL_COLUMN), value});
+            }
+
+            if (hasColumns) {
+                auto [columnId, newColumn] = columnKeys_.Insert(columns, row);
+                if (newColumn) {
+                    columnFirst_.push_back(row);
+                }
+                auto [cellId, newCell] = cellKeys_.insert(CellKey(rowId, columnId));
+                if (newCell) {
+                    cells_.emplace_back();
+                }
+                cells_[cellId].Add(value, row, numeric);
+                if (sketch) {
+                    cells_[cellId].Sketch(value, sketches);
+                }
+                if (distinct_) {
+                    distinctValues_.insert({CellKey(rowId, columnId), value});
+                }
+            }
+        }
+    }
+
+    // folds in the aggregation of another slice of the same tables
+    void Merge(const PivotAggregation& other) {
+        std::vector<size_t> rowIds(other.rowKeys_.Size());
+        for (size_t id = 0; id < rowIds.size(); ++id) {
+            auto [rowId, newRow] = rowKeys_.Insert(*rows_, other.rowFirst_[id]);
+            if (newRow) {
+                rowFirst_.push_back(other.rowFirst_[id]);
+                totals_.emplace_back();
+            }
+            totals_[rowId].Merge(other.totals_[id]);
+            rowIds[id] = rowId;
+        }
+
+        std::vector<size_t> columnIds(other.columnKeys_.Size());
+        for (size_t id = 0; id < columnIds.size(); ++id) {
+            auto [columnId, newColumn] = columnKeys_.Insert(*columns_, other.columnFirst_[id]);
+            if (newColumn) {
+                columnFirst_.push_back(other.columnFirst_[id]);
+            }
+            columnIds[id] = columnId;
+        }
+
+        auto translate = [&](uint64_t cellKey) {
+            uint32_t columnId = uint32_t(cellKey);
+            return CellKey(rowIds[cellKey >> 32], columnId == TOTAL_COLUMN ? TOTAL_COLUMN : columnIds[columnId]);
+        };
+        for (size_t id = 0; id < other.cells_.size(); ++id) {
+            auto [cellId, newCell] = cellKeys_.insert(translate(other.cellKeys_[id]));
+            if (newCell) {
+                cells_.emplace_back();
+            }
+            cells_[cellId].Merge(other.cells_[id]);
+        }
+        for (auto& item : other.distinctValues_.items()) {
+            distinctValues_.insert({translate(item.first), item.second});
+        }
+    }
+
+    // counts the distinct values, once every slice is merged
+    void Finish() {
+        for (auto& item : distinctValues_.items()) {
+            uint32_t columnId = uint32_t(item.first);
+            if (columnId == TOTAL_COLUMN) {
+                totals_[item.first >> 32].distinct += 1.0;
+            } else {
+                cells_[cellKeys_.find(item.first)].distinct += 1.0;
+            }
+        }
+    }
+
+    const RowIndex& RowKeys() const { return rowKeys_; }
+    const KeyIndex& ColumnKeys() const { return columnKeys_; }
+    const AggregateState& Total(size_t rowId) const { return totals_[rowId]; }
+
+    size_t Cells() const { return cells_.size(); }
+    size_t CellRow(size_t cellId) const { return size_t(cellKeys_[cellId] >> 32); }
+    size_t CellColumn(size_t cellId) const { return size_t(uint32_t(cellKeys_[cellId])); }
+    const AggregateState& Cell(size_t cellId) const { return cells_[cellId]; }
+
+  private:
+    static uint64_t CellKey(size_t rowId, size_t columnId) { return (uint64_t(rowId) << 32) | uint32_t(columnId); }
+
+    const ColumnarTable* rows_;
+    const ColumnarTable* columns_;
+    RowIndex rowKeys_;
+    KeyIndex columnKeys_;
+    std::vector<size_t> rowFirst_;    // first input row of each row key
+    std::vector<size_t> columnFirst_; // first input row of each column key
+    std::vector<AggregateState> totals_;
+    FlatHashSet<uint64_t, HashInteger, EqualInteger> cellKeys_;
+    std::vector<AggregateState> cells_;
+    bool distinct_;
+    FlatHashSet<std::pair<uint64_t, CellCode>, HashCodePair, EqualCodePair> distinctValues_; // (cell key, value)
+};
+
+constexpr size_t PIVOT_SLICE_ROWS = size_t(1) << 16; // fewest rows worth a slice of their own
+
+// aggregates all rows, in parallel slices on large inputs; the values are encoded against pool
+template <class RowIndex>
+PivotAggregation<RowIndex> AggregatePivot(const ColumnarTable& values, const ColumnarTable& rows, const ColumnarTable& columns,
+                                          const std::vector<AggregateSpec>& aggregates, const StringPool& pool) {
+    bool numeric{false}, distinct{false};
+    for (auto& aggregate : aggregates) {
+        numeric = numeric || IsNumericAggregate(aggregate.type);
+        distinct = distinct || aggregate.type == AGG_DISTINCT;
+    }
+    SketchOptions sketches(aggregates, pool);
+
+    size_t workers = WorkerCount(rows.Rows(), PIVOT_SLICE_ROWS);
+    std::vector<std::unique_ptr<PivotAggregation<RowIndex>>> partials(workers);
+    ParallelFor(workers, [&](size_t worker) {
+        auto range = ChunkRange(rows.Rows(), workers, worker);
+        partials[worker] =
+            std::make_unique<PivotAggregation<RowIndex>>(values, rows, columns, numeric, distinct, sketches, range.first, range.second);
+    });
+
+    for (size_t worker = 1; worker < workers; ++worker) {
+        partials[0]->Merge(*partials[worker]);
+    }
+    partials[0]->Finish();
+    return std::move(*partials[0]);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*************************************
+process-wide store of objects referred to by handle strings, bounded by a memory budget with LRU eviction
+*************************************/
+
+// ItemType must provide size_t MemoryUsage() const
+template <class ItemType> class HandleRegistry {
+  public:
+    // onEvict(handle, item) is called for every item evicted to keep to the budget, once the lock of the registry is released
+    using EvictFunction = std::function<void(const std::string&, const std::shared_ptr<const ItemType>&)>;
+
+    explicit HandleRegistry(size_t budget, EvictFunction onEvict = nullptr) : budget_(budget), onEvict_(std::move(onEvict)) {}
+    HandleRegistry(const HandleRegistry&) = delete;
+    HandleRegistry& operator=(const HandleRegistry&) = delete;
+
+    // the item, or nullptr if the handle is unknown or was evicted; the item stays alive while the caller holds it
+    std::shared_ptr<const ItemType> Find(const std::string& handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = entries_.find(handle);
+        if (iter == end(entries_)) {
+            return nullptr;
+        }
+        lru_.splice(begin(lru_), lru_, iter->second.position);
+        return iter->second.item;
+    }
+
+    // the most recently inserted item is never evicted, even if it is larger than the budget
+    void Insert(const std::string& handle, std::shared_ptr<const ItemType> item) {
+        Evicted evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Erase(handle);
+            size_t memory = item->MemoryUsage();
+            lru_.push_front(handle);
+            entries_.emplace(handle, Entry{std::move(item), memory, begin(lru_)});
+            used_ += memory;
+            evicted = Evict();
+        }
+        Notify(evicted);
+    }
+
+    void Remove(const std::string& handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Erase(handle);
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        lru_.clear();
+        used_ = 0;
+    }
+
+    // returns the previous budget
+    size_t SetBudget(size_t budget) {
+        Evicted evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(budget, budget_);
+            evicted = Evict();
+        }
+        Notify(evicted);
+        return budget;
+    }
+
+    size_t Budget() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+    size_t MemoryUsage() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return used_;
+    }
+
+  private:
+    using Evicted = std::vector<std::pair<std::string, std::shared_ptr<const ItemType>>>;
+
+    struct Entry {
+        std::shared_ptr<const ItemType> item;
+        size_t memory;
+        std::list<std::string>::iterator position;
+    };
+
+    void Erase(const std::string& handle) {
+        if (auto iter = entries_.find(handle); iter != end(entries_)) {
+            used_ -= iter->second.memory;
+            lru_.erase(iter->second.position);
+            entries_.erase(iter);
+        }
+    }
+
+    // the items evicted, kept alive for onEvict, which may be slow: spilling to disk, say
+    Evicted Evict() {
+        Evicted evicted;
+        while (used_ > budget_ && lru_.size() > 1) {
+            std::string handle = lru_.back();
+            if (onEvict_) {
+                evicted.emplace_back(handle, entries_.at(handle).item);
+            }
+            Erase(handle);
+        }
+        return evicted;
+    }
+
+    void Notify(const Evicted& evicted) const {
+        for (auto& [handle, item] : evicted) {
+            onEvict_(handle, item);
+        }
+    }
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    EvictFunction onEvict_;
+    size_t used_{0};
+    std::list<std::string> lru_; // most recently used first
+    std::unordered_map<std::string, Entry> entries_;
+};
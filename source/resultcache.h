@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <xlw/CellMatrix.h>
+
+#include "cellhash.h"
+#include "registry.h"
+#include "stats.h"
+
+/*************************************
+result cache: a call whose arguments all hold the contents of an earlier call of the function returns the result of that call
+the key is a 64 bit hash of the function and of the argument contents; a cached result is only returned if the shapes of the
+arguments and a second, independent hash of their contents match those of its call too. the cache is off until it is given a budget
+*************************************/
+
+struct CachedResult {
+    xlw::CellMatrix result;
+    std::vector<size_t> shapes; // of the arguments of the call
+    uint64_t check;             // second hash of the arguments of the call
+    size_t memory;
+
+    size_t MemoryUsage() const { return memory; }
+};
+
+inline HandleRegistry<CachedResult>& ResultCache() {
+    static HandleRegistry<CachedResult> registry{0};
+    return registry;
+}
+
+inline size_t ResultMemory(const xlw::CellMatrix& x) {
+    size_t memory = sizeof(CachedResult) + x.RowsInStructure() * x.ColumnsInStructure() * sizeof(xlw::CellValue);
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            if (x(row, col).IsString()) {
+                memory += x(row, col).StringValue().size();
+            }
+        }
+    }
+    return memory;
+}
+
+// the arguments of a call: the hash that keys the cache, the check hash and the shapes that a hit must match
+struct CallDigest {
+    template <class... Args> CallDigest(size_t function, const std::tuple<Args&...>& arguments)
+        : hash(HashMix(function)), check(CheckMix(function)) {
+        std::apply([&](const Args&... argument) { (Add(argument), ...); }, arguments);
+    }
+
+    void Add(const xlw::CellMatrix& x) {
+        Combine(DigestMatrix(x));
+        shapes.push_back(x.RowsInStructure());
+        shapes.push_back(x.ColumnsInStructure());
+    }
+    void Add(const std::string& x) {
+        Combine({HashBytes(x.data(), x.size()), CheckBytes(x.data(), x.size())});
+        shapes.push_back(x.size());
+    }
+    void Add(double x) { Combine({HashDouble(x), CheckMix(DoubleBits(x))}); }
+
+    void Combine(const std::pair<uint64_t, uint64_t>& digest) {
+        hash = HashCombine(hash, digest.first);
+        check = CheckCombine(check, digest.second);
+    }
+
+    bool Matches(const CachedResult& cached) const { return cached.check == check && cached.shapes == shapes; }
+
+    uint64_t hash;
+    uint64_t check;
+    std::vector<size_t> shapes;
+};
+
+inline std::string CallKey(size_t function, const CallDigest& digest) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%zu:%016llx", function, static_cast<unsigned long long>(digest.hash));
+    return buffer;
+}
+
+// results are cached as matrices
+inline xlw::CellMatrix CacheForm(const xlw::CellMatrix& result) { return result; }
+inline xlw::CellMatrix CacheForm(double result) { return xlw::CellMatrix(result); }
+inline void FromCacheForm(const xlw::CellMatrix& cached, xlw::CellMatrix& result) { result = cached; }
+inline void FromCacheForm(const xlw::CellMatrix& cached, double& result) { result = cached(0, 0).NumericValue(); }
+
+// runs the body of an exported function through the cache; arguments are all the arguments of the function, by reference
+template <class Body, class... Args> auto CachedCall(size_t function, const std::tuple<Args&...>& arguments, Body body) -> decltype(body()) {
+    auto& cache = ResultCache();
+    if (cache.Budget() == 0) {
+        return body();
+    }
+    CallDigest digest(function, arguments);
+    std::string key = CallKey(function, digest);
+    CallRecord* call = CurrentCall();
+    // an entry that fails the check holds another call whose key collides, the result of this call replaces it
+    if (auto cached = cache.Find(key); cached && digest.Matches(*cached)) {
+        decltype(body()) result;
+        FromCacheForm(cached->result, result);
+        if (call) {
+            ++call->cacheHits;
+        }
+        return result;
+    }
+
+    auto result = body();
+    if (call) {
+        ++call->cacheMisses;
+    }
+    auto entry = std::make_shared<CachedResult>(CachedResult{CacheForm(result), std::move(digest.shapes), digest.check, 0});
+    entry->memory = ResultMemory(entry->result) + entry->shapes.size() * sizeof(size_t);
+    // a result larger than the whole budget would only evict everything else
+    if (entry->memory <= cache.Budget()) {
+        cache.Insert(key, std::move(entry));
+    }
+    return result;
+}
+
+// as Instrumented, with the result taken from the cache when it holds the call
+template <class Body, class... Args>
+auto Memoized(size_t function, std::initializer_list<const xlw::CellMatrix*> inputs, const std::tuple<Args&...>& arguments, Body body)
+    -> decltype(body()) {
+    return Instrumented(function, inputs, [&] { return CachedCall(function, arguments, body); });
+}
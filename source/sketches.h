@@ -0,0 +1,462 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "cellhash.h"
+#include "parallel.h"
+
+/*************************************
+sketches: approximate summaries of a stream in bounded memory, set by a relative error
+the summaries of two streams merge into the summary of both, so slices of a table are sketched separately
+*************************************/
+
+constexpr double DEFAULT_SKETCH_ERROR = 0.01;
+constexpr size_t SKETCH_BLOCK_ROWS = size_t(1) << 16;
+
+// errors out of this range would take no memory or unbounded memory
+inline double SketchError(double error) {
+    if (!(error > 0.0) || error > 0.5) {
+        throw("The error must be between 0 and 0.5.");
+    }
+    return std::max(error, 0.0001);
+}
+
+// HyperLogLog distinct count with 2^precision registers; until the registers would take more memory, the distinct hashes are kept
+// and counted exactly
+class DistinctSketch {
+  public:
+    // standard error 1.04 / sqrt(registers)
+    explicit DistinctSketch(double error) {
+        double registers = std::ceil(std::log2((1.04 / error) * (1.04 / error)));
+        precision_ = unsigned(std::min(std::max(registers, 4.0), 18.0));
+    }
+
+    void Add(uint64_t hash) {
+        if (!registers_.empty()) {
+            Set(hash);
+            return;
+        }
+        auto position = std::lower_bound(begin(hashes_), end(hashes_), hash);
+        if (position == end(hashes_) || *position != hash) {
+            hashes_.insert(position, hash);
+            if (hashes_.size() > (size_t(1) << precision_) / 8) {
+                Densify();
+            }
+        }
+    }
+
+    void Merge(const DistinctSketch& other) {
+        if (other.registers_.empty()) {
+            for (uint64_t hash : other.hashes_) {
+                Add(hash);
+            }
+            return;
+        }
+        Densify();
+        for (size_t i = 0; i < registers_.size(); ++i) {
+            registers_[i] = std::max(registers_[i], other.registers_[i]);
+        }
+    }
+
+    // the improved raw estimator of Ertl, unbiased over the whole range without correction tables
+    double Estimate() const {
+        if (registers_.empty()) {
+            return double(hashes_.size());
+        }
+        unsigned q = 64 - precision_;
+        double m = double(registers_.size());
+        std::vector<double> counts(q + 2, 0.0);
+        for (uint8_t value : registers_) {
+            counts[value] += 1.0;
+        }
+        double z = m * Tau(1.0 - counts[q + 1] / m);
+        for (unsigned k = q; k >= 1; --k) {
+            z = 0.5 * (z + counts[k]);
+        }
+        z += m * Sigma(counts[0] / m);
+        return m * m / (2.0 * std::log(2.0) * z);
+    }
+
+    size_t MemoryUsage() const { return sizeof(*this) + hashes_.capacity() * sizeof(uint64_t) + registers_.capacity(); }
+
+  private:
+    static double Sigma(double x) {
+        if (x == 1.0) {
+            return INFINITY;
+        }
+        double y = 1.0;
+        double z = x;
+        for (double previous = -1.0; z != previous;) {
+            x *= x;
+            previous = z;
+            z += x * y;
+            y += y;
+        }
+        return z;
+    }
+
+    static double Tau(double x) {
+        if (x == 0.0 || x == 1.0) {
+            return 0.0;
+        }
+        double y = 1.0;
+        double z = 1.0 - x;
+        for (double previous = -1.0; z != previous;) {
+            x = std::sqrt(x);
+            previous = z;
+            y *= 0.5;
+            z -= (1.0 - x) * (1.0 - x) * y;
+        }
+        return z / 3.0;
+    }
+
+    void Densify() {
+        if (registers_.empty()) {
+            registers_.assign(size_t(1) << precision_, 0);
+            for (uint64_t hash : hashes_) {
+                Set(hash);
+            }
+            hashes_ = std::vector<uint64_t>();
+        }
+    }
+
+    // the register of the first bits keeps the largest position of the first set bit among the others
+    void Set(uint64_t hash) {
+        uint64_t rest = hash << precision_;
+        uint8_t rank = 1;
+        for (uint64_t bit = uint64_t(1) << 63; rank <= 64 - precision_ && !(rest & bit); bit >>= 1) {
+            ++rank;
+        }
+        uint8_t& value = registers_[size_t(hash >> (64 - precision_))];
+        value = std::max(value, rank);
+    }
+
+    unsigned precision_;
+    std::vector<uint64_t> hashes_; // sorted
+    std::vector<uint8_t> registers_;
+};
+
+// KLL quantile sketch: compactors of geometrically decreasing capacity, each halving its sorted items into the next one
+// the coin of the compactions is seeded, so the same stream gives the same sketch
+class QuantileSketch {
+  public:
+    explicit QuantileSketch(double error) : k_(size_t(std::min(std::ceil(std::pow(2.296 / error, 1.0 / 0.9723)), 65536.0))) {}
+
+    void Add(double value) {
+        if (levels_.empty()) {
+            Grow();
+        }
+        levels_[0].push_back(value);
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        count_ += 1.0;
+        if (++size_ >= capacity_) {
+            Compress();
+        }
+    }
+
+    void Merge(const QuantileSketch& other) {
+        if (other.count_ == 0.0) {
+            return;
+        }
+        while (levels_.size() < other.levels_.size()) {
+            Grow();
+        }
+        for (size_t level = 0; level < other.levels_.size(); ++level) {
+            levels_[level].insert(end(levels_[level]), begin(other.levels_[level]), end(other.levels_[level]));
+        }
+        size_ += other.size_;
+        count_ += other.count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        while (size_ >= capacity_) {
+            Compress();
+        }
+    }
+
+    double Count() const { return count_; }
+
+    // the smallest kept value whose rank reaches fraction of the count; the exact minimum and maximum at 0 and 1
+    double Quantile(double fraction) const {
+        if (fraction <= 0.0 || count_ == 0.0) {
+            return min_;
+        }
+        if (fraction >= 1.0) {
+            return max_;
+        }
+        std::vector<std::pair<double, double>> items; // (value, weight)
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            for (double value : levels_[level]) {
+                items.emplace_back(value, std::ldexp(1.0, int(level)));
+            }
+        }
+        std::sort(begin(items), end(items));
+        double rank = 0.0;
+        for (auto& item : items) {
+            rank += item.second;
+            if (rank >= fraction * count_) {
+                return item.first;
+            }
+        }
+        return max_;
+    }
+
+    size_t MemoryUsage() const {
+        size_t memory = sizeof(*this);
+        for (auto& level : levels_) {
+            memory += sizeof(level) + level.capacity() * sizeof(double);
+        }
+        return memory;
+    }
+
+  private:
+    // level capacities shrink by 2/3 from the top level down, to at least 2
+    void Grow() {
+        levels_.emplace_back();
+        capacities_.resize(levels_.size());
+        capacity_ = 0;
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            double scale = std::pow(2.0 / 3.0, double(levels_.size() - 1 - level));
+            capacities_[level] = std::max<size_t>(size_t(std::ceil(double(k_) * scale)), 2);
+            capacity_ += capacities_[level];
+        }
+    }
+
+    // halves the lowest level over its capacity: sorted, every other item moves up with twice the weight
+    void Compress() {
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            if (levels_[level].size() < capacities_[level]) {
+                continue;
+            }
+            if (level + 1 == levels_.size()) {
+                Grow();
+            }
+            std::vector<double>& items = levels_[level];
+            std::sort(begin(items), end(items));
+            size_t odd = items.size() % 2;
+            coin_ ^= coin_ << 13;
+            coin_ ^= coin_ >> 7;
+            coin_ ^= coin_ << 17;
+            for (size_t i = odd + (coin_ & 1); i < items.size(); i += 2) {
+                levels_[level + 1].push_back(items[i]);
+            }
+            size_ -= (items.size() - odd) / 2;
+            items.resize(odd);
+            return;
+        }
+    }
+
+    size_t k_;
+    std::vector<std::vector<double>> levels_; // items of level h weigh 2^h
+    std::vector<size_t> capacities_;
+    size_t capacity_{0};
+    size_t size_{0};
+    double count_{0.0};
+    double min_{INFINITY};
+    double max_{-INFINITY};
+    uint64_t coin_{0x9e3779b97f4a7c15ULL};
+};
+
+// SpaceSaving heavy hitters: a fixed number of counters; an uncounted key takes over the smallest counter, so a count overstates
+// the true one by at most its error, itself at most the number of items over the number of counters
+class FrequentSketch {
+  public:
+    struct Counter {
+        uint64_t key;
+        uint64_t payload; // what the key stands for, kept from its first item
+        double count;
+        double error;
+    };
+
+    explicit FrequentSketch(double error) : capacity_(size_t(std::ceil(1.0 / error))) {}
+
+    void Add(uint64_t key, uint64_t payload) {
+        total_ += 1.0;
+        if (size_t slot = Find(key); slot != npos) {
+            counters_[slot].count += 1.0;
+            SiftDown(positions_[slot]);
+        } else if (counters_.size() < capacity_) {
+            positions_.push_back(heap_.size());
+            heap_.push_back(counters_.size());
+            counters_.push_back({key, payload, 1.0, 0.0});
+            Insert(counters_.size() - 1);
+            SiftUp(heap_.size() - 1);
+        } else {
+            size_t smallest = heap_[0];
+            Counter& counter = counters_[smallest];
+            Erase(counter.key);
+            counter = {key, payload, counter.count + 1.0, counter.count};
+            Insert(smallest);
+            SiftDown(0);
+        }
+    }
+
+    // counters of keys missing from one side take its smallest count as their count and error there, when that side is full
+    void Merge(const FrequentSketch& other) {
+        double floor = Floor();
+        double otherFloor = other.Floor();
+        std::vector<Counter> merged;
+        for (auto& counter : counters_) {
+            size_t slot = other.Find(counter.key);
+            bool found = slot != npos;
+            merged.push_back({counter.key, counter.payload, counter.count + (found ? other.counters_[slot].count : otherFloor),
+                              counter.error + (found ? other.counters_[slot].error : otherFloor)});
+        }
+        for (auto& counter : other.counters_) {
+            if (Find(counter.key) == npos) {
+                merged.push_back({counter.key, counter.payload, counter.count + floor, counter.error + floor});
+            }
+        }
+        std::stable_sort(begin(merged), end(merged), [](const Counter& lhs, const Counter& rhs) { return lhs.count > rhs.count; });
+        merged.resize(std::min(merged.size(), capacity_));
+
+        total_ += other.total_;
+        counters_ = std::move(merged);
+        table_.clear();
+        heap_.clear();
+        positions_.clear();
+        for (size_t slot = 0; slot < counters_.size(); ++slot) {
+            Insert(slot);
+            positions_.push_back(slot);
+            heap_.push_back(slot);
+            SiftUp(slot);
+        }
+    }
+
+    double Total() const { return total_; }
+
+    // the largest counters, by decreasing count
+    std::vector<Counter> Top(size_t count) const {
+        std::vector<Counter> result = counters_;
+        std::stable_sort(begin(result), end(result), [](const Counter& lhs, const Counter& rhs) { return lhs.count > rhs.count; });
+        result.resize(std::min(result.size(), count));
+        return result;
+    }
+
+    size_t MemoryUsage() const {
+        return sizeof(*this) + counters_.capacity() * sizeof(Counter) + (heap_.capacity() + positions_.capacity()) * sizeof(size_t) +
+               table_.capacity() * sizeof(uint32_t);
+    }
+
+  private:
+    static constexpr size_t npos = size_t(-1);
+
+    // the counters are found by key in an open addressing table of counter slots plus one, 0 when free, at most half full
+    size_t Home(uint64_t key) const { return size_t(HashMix(key)) & (table_.size() - 1); }
+
+    size_t Find(uint64_t key) const {
+        if (table_.empty()) {
+            return npos;
+        }
+        for (size_t position = Home(key);; position = (position + 1) & (table_.size() - 1)) {
+            if (table_[position] == 0) {
+                return npos;
+            } else if (counters_[table_[position] - 1].key == key) {
+                return table_[position] - 1;
+            }
+        }
+    }
+
+    void Insert(size_t slot) {
+        if (2 * counters_.size() > table_.size()) {
+            std::vector<uint32_t> old = std::move(table_);
+            table_.assign(std::max<size_t>(8, 2 * old.size()), 0);
+            for (uint32_t entry : old) {
+                if (entry != 0) {
+                    Place(entry);
+                }
+            }
+        }
+        Place(uint32_t(slot + 1));
+    }
+
+    void Place(uint32_t entry) {
+        size_t position = Home(counters_[entry - 1].key);
+        while (table_[position] != 0) {
+            position = (position + 1) & (table_.size() - 1);
+        }
+        table_[position] = entry;
+    }
+
+    // later entries of the probe sequence move back into the hole, so lookups need no tombstones
+    void Erase(uint64_t key) {
+        size_t mask = table_.size() - 1;
+        size_t hole = Home(key);
+        while (counters_[table_[hole] - 1].key != key) {
+            hole = (hole + 1) & mask;
+        }
+        for (size_t next = (hole + 1) & mask; table_[next] != 0; next = (next + 1) & mask) {
+            size_t home = Home(counters_[table_[next] - 1].key);
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                table_[hole] = table_[next];
+                hole = next;
+            }
+        }
+        table_[hole] = 0;
+    }
+
+    // the count any key may have had without holding a counter
+    double Floor() const { return (counters_.size() < capacity_ || heap_.empty()) ? 0.0 : counters_[heap_[0]].count; }
+
+    bool Less(size_t lhs, size_t rhs) const { return counters_[heap_[lhs]].count < counters_[heap_[rhs]].count; }
+
+    void Swap(size_t lhs, size_t rhs) {
+        std::swap(heap_[lhs], heap_[rhs]);
+        positions_[heap_[lhs]] = lhs;
+        positions_[heap_[rhs]] = rhs;
+    }
+
+    void SiftUp(size_t position) {
+        while (position > 0 && Less(position, (position - 1) / 2)) {
+            Swap(position, (position - 1) / 2);
+            position = (position - 1) / 2;
+        }
+    }
+
+    void SiftDown(size_t position) {
+        for (;;) {
+            size_t smallest = position;
+            for (size_t child = 2 * position + 1; child <= 2 * position + 2 && child < heap_.size(); ++child) {
+                if (Less(child, smallest)) {
+                    smallest = child;
+                }
+            }
+            if (smallest == position) {
+                return;
+            }
+            Swap(position, smallest);
+            position = smallest;
+        }
+    }
+
+    size_t capacity_;
+    double total_{0.0};
+    std::vector<Counter> counters_;
+    std::vector<size_t> heap_;      // counters, the smallest count on top
+    std::vector<size_t> positions_; // heap position of each counter
+    std::vector<uint32_t> table_;
+};
+
+// sketches rows [0, rows) in blocks, a wave of blocks at a time in parallel, and merges the blocks in order,
+// so the result does not depend on the number of threads; fill(sketch, begin, end) adds a block of rows
+template <class Sketch, class Fill> Sketch SketchRows(size_t rows, const Sketch& empty, Fill fill) {
+    Sketch result = empty;
+    size_t blocks = (rows + SKETCH_BLOCK_ROWS - 1) / SKETCH_BLOCK_ROWS;
+    size_t wave = WorkerCount(blocks, 1);
+    for (size_t first = 0; first < blocks; first += wave) {
+        size_t count = std::min(wave, blocks - first);
+        std::vector<Sketch> sketches(count, empty);
+        ParallelFor(count, [&](size_t block) {
+            size_t begin = (first + block) * SKETCH_BLOCK_ROWS;
+            fill(sketches[block], begin, std::min(begin + SKETCH_BLOCK_ROWS, rows));
+        });
+        for (auto& sketch : sketches) {
+            result.Merge(sketch);
+        }
+    }
+    return result;
+}
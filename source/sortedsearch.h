@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "columnartable.h"
+#include "registry.h"
+
+/*************************************
+order preserving integer keys: comparing them gives the operator< order of the cells they come from
+*************************************/
+
+struct OrderKey {
+    uint64_t type;
+    uint64_t value;
+
+    bool operator<(const OrderKey& other) const { return type < other.type || (type == other.type && value < other.value); }
+    bool operator==(const OrderKey& other) const { return type == other.type && value == other.value; }
+};
+
+// rank of every string of the pool in string order
+inline std::vector<uint64_t> StringRanks(const StringPool& pool) {
+    std::vector<uint32_t> ids(pool.Size());
+    for (uint32_t id = 0; id < ids.size(); ++id) {
+        ids[id] = id;
+    }
+    std::sort(begin(ids), end(ids), [&](uint32_t lhs, uint32_t rhs) { return pool[lhs] < pool[rhs]; });
+
+    std::vector<uint64_t> ranks(ids.size());
+    for (size_t rank = 0; rank < ids.size(); ++rank) {
+        ranks[ids[rank]] = rank;
+    }
+    return ranks;
+}
+
+inline OrderKey MakeOrderKey(CellCode code, const std::vector<uint64_t>& stringRanks) {
+    CellValueType type = CodeType(code);
+    switch (type) {
+    case CVT_NUMBER:
+        return {type, OrderedDoubleBits(CodeNumber(code))};
+    case CVT_STRING:
+        return {type, stringRanks[CodePayload(code)]};
+    case CVT_BOOLEAN:
+    case CVT_ERROR:
+        return {type, CodePayload(code)};
+    default:
+        return {type, 0};
+    }
+}
+
+// the rows of a table as order keys, flattened row by row
+inline std::vector<OrderKey> OrderKeys(const ColumnarTable& table, const std::vector<uint64_t>& stringRanks) {
+    std::vector<OrderKey> keys(table.Rows() * table.Columns());
+    for (size_t col = 0; col < table.Columns(); ++col) {
+        const std::vector<CellCode>& column = table.Column(col);
+        for (size_t row = 0; row < table.Rows(); ++row) {
+            keys[row * table.Columns() + col] = MakeOrderKey(column[row], stringRanks);
+        }
+    }
+    return keys;
+}
+
+/*************************************
+searches in sorted keys, through an Eytzinger (breadth first) layout when there are many probes
+*************************************/
+
+class SortedSearch {
+  public:
+    // keys holds the sorted rows, width fields each; eytzinger lays them out for many cache friendly probes
+    SortedSearch(std::vector<OrderKey> keys, size_t width, bool eytzinger) : width_(width), rows_(width ? keys.size() / width : 0) {
+        for (size_t row = 1; row < rows_; ++row) {
+            if (Compare(&keys[row * width_], &keys[(row - 1) * width_]) < 0) {
+                throw("The table must be sorted in ascending order.");
+            }
+        }
+        if (eytzinger && rows_ > 0) {
+            // node k (from 1) holds the sorted row positions_[k]; the children of k are 2k and 2k + 1
+            layout_.resize((rows_ + 1) * width_);
+            positions_.resize(rows_ + 1);
+            size_t next = 0;
+            Fill(keys, 1, next);
+        } else {
+            layout_ = std::move(keys);
+        }
+    }
+
+    size_t Rows() const { return rows_; }
+    size_t MemoryUsage() const { return layout_.capacity() * sizeof(OrderKey) + positions_.capacity() * sizeof(size_t); }
+
+    // first sorted row whose key is not less than the probe, Rows() if there is none
+    size_t LowerBound(const OrderKey* probe) const {
+        return Search(probe, [](int order) { return order < 0; });
+    }
+
+    // first sorted row whose key is greater than the probe, Rows() if there is none
+    size_t UpperBound(const OrderKey* probe) const {
+        return Search(probe, [](int order) { return order <= 0; });
+    }
+
+  private:
+    int Compare(const OrderKey* lhs, const OrderKey* rhs) const {
+        for (size_t col = 0; col < width_; ++col) {
+            if (lhs[col] < rhs[col]) {
+                return -1;
+            } else if (rhs[col] < lhs[col]) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // in order traversal of the implicit tree fills it with the sorted rows
+    void Fill(const std::vector<OrderKey>& keys, size_t node, size_t& next) {
+        if (node > rows_) {
+            return;
+        }
+        Fill(keys, 2 * node, next);
+        std::copy(begin(keys) + next * width_, begin(keys) + (next + 1) * width_, begin(layout_) + node * width_);
+        positions_[node] = next++;
+        Fill(keys, 2 * node + 1, next);
+    }
+
+    // first sorted row for which goRight(compare(key, probe)) is false
+    template <class GoRight> size_t Search(const OrderKey* probe, GoRight goRight) const {
+        if (positions_.empty()) {
+            size_t low = 0, high = rows_;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (goRight(Compare(&layout_[middle * width_], probe))) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            return low;
+        }
+
+        size_t node = 1;
+        while (node <= rows_) {
+#if defined(__GNUC__)
+            // the 16 descendants four levels down are contiguous, fetch them ahead of time
+            if (16 * node <= rows_) {
+                __builtin_prefetch(&layout_[16 * node * width_]);
+            }
+#endif
+            node = 2 * node + (goRight(Compare(&layout_[node * width_], probe)) ? 1 : 0);
+        }
+        // drop the trailing right turns and the last left turn to get the answer node
+        while (node & 1) {
+            node >>= 1;
+        }
+        node >>= 1;
+        return node == 0 ? rows_ : positions_[node];
+    }
+
+    size_t width_;
+    size_t rows_;
+    std::vector<OrderKey> layout_;  // sorted rows, or the Eytzinger layout starting at node 1
+    std::vector<size_t> positions_; // sorted row of each Eytzinger node, empty for the plain layout
+};
+
+/*************************************
+a sorted table with its search, kept by content so that the lookups against an unchanged table only encode and rank their probes
+the strings of the table take the odd ranks 2r + 1, a probe string the table does not hold the even rank between its neighbours
+*************************************/
+
+class SortedTable {
+  public:
+    // the layout is kept for many calls, so it is always the Eytzinger one; check is the second hash of the table content
+    SortedTable(const xlw::CellMatrix& table, uint64_t check) : width_(table.ColumnsInStructure()), check_(check) {
+        ColumnarTable items(table, InternStrings{pool_});
+        ranks_ = StringRanks(pool_);
+        order_.resize(ranks_.size());
+        std::vector<uint64_t> spaced(ranks_.size());
+        for (uint32_t id = 0; id < ranks_.size(); ++id) {
+            order_[ranks_[id]] = id;
+            spaced[id] = 2 * ranks_[id] + 1;
+        }
+        search_ = std::make_unique<SortedSearch>(OrderKeys(items, spaced), width_, true);
+    }
+
+    size_t Columns() const { return width_; }
+    uint64_t Check() const { return check_; }
+    const SortedSearch& Search() const { return *search_; }
+
+    // the rows of the probe as order keys, comparable with the rows of the table
+    std::vector<OrderKey> ProbeKeys(const xlw::CellMatrix& probe) const {
+        if (probe.ColumnsInStructure() != width_) {
+            throw("Lookup items and table do not have the same number of fields.");
+        }
+        StringPool strings;
+        ColumnarTable items(probe, InternStrings{strings});
+        std::vector<uint64_t> ranks(strings.Size());
+        for (uint32_t id = 0; id < ranks.size(); ++id) {
+            if (uint32_t tableId = pool_.Find(strings[id]); tableId != MISSING_STRING) {
+                ranks[id] = 2 * ranks_[tableId] + 1;
+            } else {
+                auto next = std::lower_bound(begin(order_), end(order_), strings[id],
+                                             [&](uint32_t item, std::string_view value) { return pool_[item] < value; });
+                ranks[id] = 2 * uint64_t(next - begin(order_));
+            }
+        }
+        return OrderKeys(items, ranks);
+    }
+
+    size_t MemoryUsage() const {
+        return sizeof(*this) + pool_.MemoryUsage() + ranks_.capacity() * sizeof(uint64_t) + order_.capacity() * sizeof(uint32_t) +
+               search_->MemoryUsage();
+    }
+
+  private:
+    size_t width_;
+    uint64_t check_;
+    StringPool pool_;
+    std::vector<uint64_t> ranks_;  // rank of each string of the table
+    std::vector<uint32_t> order_;  // strings of the table in rank order
+    std::unique_ptr<SortedSearch> search_;
+};
+
+inline HandleRegistry<SortedTable>& SortedTableRegistry() {
+    static HandleRegistry<SortedTable> registry{size_t(256) << 20};
+    return registry;
+}
+
+// the shape is part of the handle; a table only uses a kept layout if the check hashes agree as well
+inline std::string SortedTableHandle(size_t rows, size_t columns, uint64_t fingerprint) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "QFSorted:%zux%zu:%016llx", rows, columns, static_cast<unsigned long long>(fingerprint));
+    return buffer;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "columnartable.h"
+#include "parallel.h"
+#include "sortedsearch.h"
+
+/*************************************
+sorting the rows of a table on several keys, each ascending or descending; rows with equal keys keep their table order
+*************************************/
+
+// true for descending
+inline bool ParseSortDirection(std::string name) {
+    for (auto& c : name) {
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (name == "asc" || name == "ascending" || name.empty())
+        return false;
+    else if (name == "desc" || name == "descending")
+        return true;
+    else
+        throw("Unknown sort direction, use asc or desc.");
+}
+
+// a column of numbers only, whose keys are then plain 64 bit integers
+inline bool IsNumericColumn(const ColumnarTable& table, size_t col) { return (table.ColumnTypes(col) & ~(1u << CVT_NUMBER)) == 0; }
+
+// stable LSD radix sort of the rows on their 64 bit keys, a byte per pass; bytes that are the same in every key are skipped
+inline void RadixSortRows(std::vector<size_t>& rows, const std::vector<uint64_t>& keys) {
+    std::vector<std::pair<uint64_t, size_t>> items(rows.size()), buffer(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        items[i] = {keys[rows[i]], rows[i]};
+    }
+
+    // the counts of every byte in one pass over the keys
+    std::vector<size_t> counts(8 * 256, 0);
+    for (auto& item : items) {
+        for (size_t pass = 0; pass < 8; ++pass) {
+            ++counts[pass * 256 + size_t((item.first >> (8 * pass)) & 0xff)];
+        }
+    }
+
+    for (size_t pass = 0; pass < 8; ++pass) {
+        size_t* count = counts.data() + pass * 256;
+        if (count[size_t(items.empty() ? 0 : (items[0].first >> (8 * pass)) & 0xff)] == items.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            offset += std::exchange(count[digit], offset);
+        }
+        for (auto& item : items) {
+            buffer[count[size_t((item.first >> (8 * pass)) & 0xff)]++] = item;
+        }
+        items.swap(buffer);
+    }
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        rows[i] = items[i].second;
+    }
+}
+
+// sorts slices of the rows on separate threads, then merges them pairwise; less must be a strict total order on the rows
+template <class Less> void ParallelSortRows(std::vector<size_t>& rows, Less less) {
+    size_t chunks = WorkerCount(rows.size(), size_t(1) << 15);
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        bounds[chunk] = ChunkRange(rows.size(), chunks, chunk).first;
+    }
+    bounds[chunks] = rows.size();
+    ParallelFor(chunks, [&](size_t chunk) { std::sort(begin(rows) + bounds[chunk], begin(rows) + bounds[chunk + 1], less); });
+
+    std::vector<size_t> buffer(rows.size());
+    while (bounds.size() > 2) {
+        size_t slices = bounds.size() - 1;
+        size_t merges = (slices + 1) / 2;
+        ParallelFor(merges, [&](size_t merge) {
+            size_t low = bounds[2 * merge];
+            size_t middle = bounds[std::min(2 * merge + 1, slices)];
+            size_t high = bounds[std::min(2 * merge + 2, slices)];
+            std::merge(begin(rows) + low, begin(rows) + middle, begin(rows) + middle, begin(rows) + high, begin(buffer) + low, less);
+        });
+        rows.swap(buffer);
+
+        std::vector<size_t> merged;
+        for (size_t merge = 0; merge < merges; ++merge) {
+            merged.push_back(bounds[2 * merge]);
+        }
+        merged.push_back(bounds[slices]);
+        bounds.swap(merged);
+    }
+}
+
+// the first topN rows of the table sorted on its key columns, all of them if topN is 0
+inline std::vector<size_t> SortRows(const ColumnarTable& keys, const StringPool& pool, const std::vector<bool>& descending, size_t topN) {
+    size_t rowCount = keys.Rows();
+    size_t width = keys.Columns();
+    topN = (topN == 0) ? rowCount : std::min(topN, rowCount);
+    std::vector<size_t> rows(rowCount);
+    for (size_t row = 0; row < rowCount; ++row) {
+        rows[row] = row;
+    }
+    // a heap of the top rows beats sorting them all when only a few are wanted
+    bool partial = topN * 16 <= rowCount;
+
+    bool numeric = true;
+    for (size_t col = 0; col < width; ++col) {
+        numeric = numeric && IsNumericColumn(keys, col);
+    }
+
+    if (numeric) {
+        // descending keys are complemented, so every key sorts ascending
+        std::vector<std::vector<uint64_t>> columns(width, std::vector<uint64_t>(rowCount));
+        for (size_t col = 0; col < width; ++col) {
+            uint64_t flip = descending[col] ? ~uint64_t(0) : 0;
+            const std::vector<CellCode>& codes = keys.Column(col);
+            for (size_t row = 0; row < rowCount; ++row) {
+                columns[col][row] = OrderedDoubleBits(CodeNumber(codes[row])) ^ flip;
+            }
+        }
+        if (partial) {
+            std::partial_sort(begin(rows), begin(rows) + topN, end(rows), [&](size_t lhs, size_t rhs) {
+                for (auto& column : columns) {
+                    if (column[lhs] != column[rhs]) {
+                        return column[lhs] < column[rhs];
+                    }
+                }
+                return lhs < rhs;
+            });
+        } else {
+            // stable passes from the last key to the first
+            for (size_t col = width; col-- > 0;) {
+                RadixSortRows(rows, columns[col]);
+            }
+        }
+    } else {
+        std::vector<OrderKey> orderKeys = OrderKeys(keys, StringRanks(pool));
+        for (size_t i = 0; i < orderKeys.size(); ++i) {
+            if (descending[i % width]) {
+                orderKeys[i] = {~orderKeys[i].type, ~orderKeys[i].value};
+            }
+        }
+        // the row breaks the ties, so any sort gives the stable order
+        auto less = [&](size_t lhs, size_t rhs) {
+            const OrderKey* lKey = &orderKeys[lhs * width];
+            const OrderKey* rKey = &orderKeys[rhs * width];
+            for (size_t col = 0; col < width; ++col) {
+                if (!(lKey[col] == rKey[col])) {
+                    return lKey[col] < rKey[col];
+                }
+            }
+            return lhs < rhs;
+        };
+        if (partial) {
+            std::partial_sort(begin(rows), begin(rows) + topN, end(rows), less);
+        } else {
+            ParallelSortRows(rows, less);
+        }
+    }
+
+    rows.resize(topN);
+    return rows;
+}
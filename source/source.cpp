@@ -1,115 +1,283 @@
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <optional>
 #include <set>
-#include <unordered_set>
 
+#include "cellhash.h"
 #include "cellitem.h"
+#include "columnartable.h"
+#include "csvtable.h"
 #include "cppinterface.h"
+#include "fuzzymatch.h"
+#include "groupby.h"
+#include "jobs.h"
+#include "join.h"
+#include "livepivot.h"
+#include "lookupindex.h"
+#include "mappedtable.h"
+#include "membership.h"
+#include "parallel.h"
+#include "pivot.h"
+#include "resultcache.h"
+#include "sketches.h"
+#include "sortedsearch.h"
+#include "sortrows.h"
+#include "stats.h"
+#include "window.h"
 
 std::string QFAbout() {
-    std::string result = std::string("Written by Duc Truong. \n") + "Using XLW " + XLW_VERSION + "\nCompiled with " + XLW_VERSION;
-    return result;
+    static const size_t function = Stats().Register("QFAbout");
+    return Instrumented(function, {}, [&] {
+        std::string result = std::string("Written by Duc Truong. \n") + "Using XLW " + XLW_VERSION + "\nCompiled with " + XLW_VERSION;
+        return result;
+    });
 }
 
 /*************************************
 utility functions & classes
 *************************************/
 
-struct LessThanCellValue {
-    bool operator()(const QFCellValue& lhs, const QFCellValue& rhs) const { return lhs < rhs; }
-};
+std::vector<const CellMatrix*> Arguments2Vector() { return std::vector<const CellMatrix*>(); }
 
-struct LessThanCellValueVector {
-    bool operator()(const std::vector<QFCellValue>& lhs, const std::vector<QFCellValue>& rhs) const {
-        size_t minSize = std::min(lhs.size(), rhs.size());
-        for (size_t i = 0; i < minSize; ++i) {
-            if (lhs[i] < rhs[i]) {
-                return true;
-            } else if (rhs[i] < lhs[i]) {
-                return false;
+template <typename... Types> std::vector<const CellMatrix*> Arguments2Vector(const CellMatrix* first, Types... rest) {
+    std::vector<const CellMatrix*> result = Arguments2Vector(rest...);
+    if ((first->RowsInStructure() * first->ColumnsInStructure()) != 0.0) {
+        result.insert(begin(result), first);
+    }
+    return result;
+}
+
+/*************************************
+sorts, unique, union, intersection functions
+*************************************/
+
+// sorts the cells on their order keys, so no cell is copied until the output; equal cells keep their table order
+CellMatrix SortCells(const CellMatrix& x) {
+    StringPool pool;
+    ColumnarTable items(x, InternStrings{pool});
+    for (size_t col = 0; col < items.Columns(); ++col) {
+        if (items.ColumnTypes(col) & (1u << CVT_UNKNOWN)) {
+            throw("Unknown type");
+        }
+    }
+
+    // keys come row by row, the order in which the cells are read
+    std::vector<OrderKey> keys = OrderKeys(items, StringRanks(pool));
+    std::vector<std::pair<OrderKey, size_t>> order(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        order[i] = {keys[i], i};
+    }
+    std::sort(begin(order), end(order));
+
+    CellMatrix result{order.size(), 1};
+    size_t columns = x.ColumnsInStructure();
+    for (size_t i = 0; i < order.size(); ++i) {
+        result(i, 0) = x(order[i].second / columns, order[i].second % columns);
+    }
+    return result;
+}
+
+CellMatrix QFSort(const CellMatrix& x) {
+    static const size_t function = Stats().Register("QFSort");
+    return Memoized(function, {&x}, std::tie(x), [&] { return SortCells(x); });
+}
+
+using CellHashSet = FlatHashSet<QFCellValue, HashCellValue, EqualCellValue>;
+
+// the items of the set functions, of any type: converted only the first time they are seen, sorted on output
+struct AnyCells {
+    static constexpr size_t npos = CellHashSet::npos;
+
+    void Insert(const CellValue& item) {
+        items.find_or_insert(item, [](const CellValue& x) { return Convert2QFCellValue(x); });
+    }
+    size_t Size() const { return items.size(); }
+
+    // after the last insert: most probes of a large set by items it does not hold stop at the filter
+    void Prefilter() {
+        if (WorthFilter(items.size())) {
+            filter = BloomFilter(items.size());
+            for (auto& item : items.items()) {
+                filter.Insert(HashCell(item));
             }
         }
-        return (lhs.size() < rhs.size());
     }
-};
+    size_t Find(const CellValue& item) const {
+        uint64_t hash = HashCell(item);
+        return (filter.Empty() || filter.MayContain(hash)) ? items.find(item, hash) : npos;
+    }
 
-template <class SetType> struct SetInsert {
-    void operator()(SetType& value, typename SetType::value_type x) { value.insert(x); }
-};
+    // only the output is sorted, so the result order is the same as the set based version
+    template <class Predicate> CellMatrix Sorted(Predicate keep) const {
+        std::vector<const QFCellValue*> result;
+        for (size_t id = 0; id < items.size(); ++id) {
+            if (keep(id)) {
+                result.push_back(&items[id]);
+            }
+        }
+        std::sort(begin(result), end(result), [](const QFCellValue* lhs, const QFCellValue* rhs) { return *lhs < *rhs; });
+
+        CellMatrix output{result.size(), 1};
+        for (size_t i = 0; i < result.size(); ++i) {
+            Convert2CellValue(*result[i], output(i, 0));
+        }
+        return output;
+    }
 
-template <class VectorType> struct VectorInsert {
-    void operator()(VectorType& value, typename VectorType::value_type x) { value.push_back(x); }
+    CellHashSet items;
+    BloomFilter filter;
 };
 
-template <class ContainerType, class InsertClass> ContainerType CellMatrix2Container(const CellMatrix& x, InsertClass insertFunction) {
-    ContainerType items;
+// the items of the set functions when the cells they keep are numbers only: hashed as number codes, sorted as doubles
+struct NumberCells {
+    static constexpr size_t npos = CellHashSet::npos;
 
-    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
-        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
-            insertFunction(items, Convert2QFCellValue(x(row, col)));
+    void Insert(const CellValue& item) {
+        double value = double(item);
+        if (codes.insert(NumberCode(value)).second) {
+            values.push_back(value);
         }
     }
-    return items;
-}
+    size_t Size() const { return codes.size(); }
 
-template <class ContainerType> CellMatrix Container2CellMatrix(const ContainerType& items) {
-    CellMatrix result{items.size(), 1};
+    void Prefilter() {
+        if (WorthFilter(codes.size())) {
+            filter = BloomFilter(codes.size());
+            for (CellCode code : codes.items()) {
+                filter.Insert(HashMix(code));
+            }
+        }
+    }
+    size_t Find(const CellValue& item) const {
+        if (!item.IsANumber()) {
+            return npos;
+        }
+        CellCode code = NumberCode(double(item));
+        uint64_t hash = HashMix(code);
+        return (filter.Empty() || filter.MayContain(hash)) ? codes.find(code, hash) : npos;
+    }
 
-    size_t i{0};
-    for (auto& item : items) {
-        Convert2CellValue(item, result(i, 0));
-        ++i;
+    template <class Predicate> CellMatrix Sorted(Predicate keep) const {
+        std::vector<double> result;
+        for (size_t id = 0; id < values.size(); ++id) {
+            if (keep(id)) {
+                result.push_back(values[id]);
+            }
+        }
+        std::sort(begin(result), end(result));
+
+        CellMatrix output{result.size(), 1};
+        for (size_t i = 0; i < result.size(); ++i) {
+            output(i, 0) = result[i];
+        }
+        return output;
     }
-    return result;
-}
 
-std::vector<const CellMatrix*> Arguments2Vector() { return std::vector<const CellMatrix*>(); }
+    FlatHashSet<CellCode, HashInteger, EqualInteger> codes;
+    std::vector<double> values; // first value of each code, as a -0 stays -0
+    BloomFilter filter;
+};
 
-template <typename... Types> std::vector<const CellMatrix*> Arguments2Vector(const CellMatrix* first, Types... rest) {
-    std::vector<const CellMatrix*> result = Arguments2Vector(rest...);
-    if ((first->RowsInStructure() * first->ColumnsInStructure()) != 0.0) {
-        result.insert(begin(result), first);
+bool AllNumbers(const CellMatrix& x) {
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            if (!x(row, col).IsANumber()) {
+                return false;
+            }
+        }
     }
-    return result;
+    return true;
 }
 
-/*************************************
-sorts, unique, union, intersection functions
-*************************************/
-
-template <class SetClass> CellMatrix SortSet(const CellMatrix& x) {
-    return Container2CellMatrix(CellMatrix2Container<SetClass>(x, SetInsert<SetClass>()));
+// calls function with the set of items fitting the cells: one column scan picks the number codes over the generic cells
+template <class Function> CellMatrix VisitCells(bool numbers, Function function) {
+    if (numbers) {
+        NumberCells items;
+        return function(items);
+    }
+    AnyCells items;
+    return function(items);
 }
 
-CellMatrix QFSort(const CellMatrix& x) { return SortSet<std::multiset<QFCellValue, LessThanCellValue>>(x); }
+// insert the items of a table, converting only the ones not seen before
+template <class Cells> void InsertCells(Cells& items, const CellMatrix& x) {
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            items.Insert(x(row, col));
+        }
+    }
+}
 
 CellMatrix QFUnique(const CellMatrix& x) {
-    // could use unordered_set here, but have to write hash function
-    return SortSet<std::set<QFCellValue, LessThanCellValue>>(x);
+    static const size_t function = Stats().Register("QFUnique");
+    return Memoized(function, {&x}, std::tie(x), [&] {
+        return VisitCells(AllNumbers(x), [&](auto& items) {
+            InsertCells(items, x);
+            return items.Sorted([](size_t) { return true; });
+        });
+    });
 }
 
 CellMatrix Union(const std::vector<const CellMatrix*>& cells) {
-    using SetContainer = std::set<QFCellValue, LessThanCellValue>;
-    SetContainer result;
-    for (auto& cell : cells) {
-        SetContainer item = CellMatrix2Container<SetContainer>(*cell, SetInsert<SetContainer>());
-        result.insert(begin(item), end(item));
-    }
-    return Container2CellMatrix(result);
+    bool numbers = std::all_of(begin(cells), end(cells), [](const CellMatrix* cell) { return AllNumbers(*cell); });
+    return VisitCells(numbers, [&](auto& items) {
+        for (auto& cell : cells) {
+            InsertCells(items, *cell);
+        }
+        return items.Sorted([](size_t) { return true; });
+    });
 }
 
+// only the items of the first table are kept, so only they decide the type of the set
 CellMatrix Intersection(const std::vector<const CellMatrix*>& cells) {
-    using SetContainer = std::set<QFCellValue, LessThanCellValue>;
-    SetContainer result{CellMatrix2Container<SetContainer>(*cells[0], SetInsert<SetContainer>())};
+    if (cells.empty()) {
+        return AnyCells().Sorted([](size_t) { return true; });
+    }
+    return VisitCells(AllNumbers(*cells[0]), [&](auto& items) {
+        InsertCells(items, *cells[0]);
+        items.Prefilter();
+
+        // rounds[id] is the number of following tables the item has been found in so far
+        std::vector<size_t> rounds(items.Size(), 0);
+        for (size_t round = 1; round < cells.size(); ++round) {
+            const CellMatrix& cell = *cells[round];
+            for (size_t row = 0; row < cell.RowsInStructure(); ++row) {
+                for (size_t col = 0; col < cell.ColumnsInStructure(); ++col) {
+                    if (size_t id = items.Find(cell(row, col)); id != items.npos && rounds[id] == round - 1) {
+                        rounds[id] = round;
+                    }
+                }
+            }
+        }
+
+        return items.Sorted([&](size_t id) { return rounds[id] == cells.size() - 1; });
+    });
+}
 
-    for (auto iter = cbegin(cells) + 1; iter != cend(cells); ++iter) {
-        auto items = CellMatrix2Container<SetContainer>(**iter, SetInsert<SetContainer>());
-        SetContainer temp;
-        std::set_intersection(cbegin(items), cend(items), cbegin(result), cend(result),
-                              std::insert_iterator<SetContainer>(temp, begin(temp)), LessThanCellValue());
-        result = std::move(temp);
+CellMatrix Difference(const std::vector<const CellMatrix*>& cells) {
+    if (cells.empty()) {
+        return AnyCells().Sorted([](size_t) { return true; });
     }
+    return VisitCells(AllNumbers(*cells[0]), [&](auto& items) {
+        InsertCells(items, *cells[0]);
+        items.Prefilter();
+
+        std::vector<bool> removed(items.Size(), false);
+        for (auto iter = cbegin(cells) + 1; iter != cend(cells); ++iter) {
+            const CellMatrix& cell = **iter;
+            for (size_t row = 0; row < cell.RowsInStructure(); ++row) {
+                for (size_t col = 0; col < cell.ColumnsInStructure(); ++col) {
+                    if (size_t id = items.Find(cell(row, col)); id != items.npos) {
+                        removed[id] = true;
+                    }
+                }
+            }
+        }
 
-    return Container2CellMatrix(result);
+        return items.Sorted([&](size_t id) { return !removed[id]; });
+    });
 }
 
 CellMatrix                           // get the intersection items of tables
@@ -120,8 +288,9 @@ QFIntersection(const CellMatrix& x1, // 1st item
                const CellMatrix& x5, // 5th item
                const CellMatrix& x6) // 6th item
 {
-    auto result = Arguments2Vector(&x1, &x2, &x3, &x4, &x5, &x6);
-    return Intersection(result);
+    static const size_t function = Stats().Register("QFIntersection");
+    return Memoized(function, {&x1, &x2, &x3, &x4, &x5, &x6}, std::tie(x1, x2, x3, x4, x5, x6),
+                    [&] { return Intersection(Arguments2Vector(&x1, &x2, &x3, &x4, &x5, &x6)); });
 }
 
 CellMatrix                    // get the intersection items of tables
@@ -132,257 +301,1487 @@ QFUnion(const CellMatrix& x1, // 1st item
         const CellMatrix& x5, // 5th item
         const CellMatrix& x6) // 6th item
 {
-    auto result = Arguments2Vector(&x1, &x2, &x3, &x4, &x5, &x6);
-    return Union(result);
+    static const size_t function = Stats().Register("QFUnion");
+    return Memoized(function, {&x1, &x2, &x3, &x4, &x5, &x6}, std::tie(x1, x2, x3, x4, x5, x6),
+                    [&] { return Union(Arguments2Vector(&x1, &x2, &x3, &x4, &x5, &x6)); });
+}
+
+CellMatrix                     // get the items of the first table which are not in the other tables
+QFExcept(const CellMatrix& x1, // 1st item
+         const CellMatrix& x2, // 2nd item
+         const CellMatrix& x3, // 3rd item
+         const CellMatrix& x4, // 4th item
+         const CellMatrix& x5, // 5th item
+         const CellMatrix& x6) // 6th item
+{
+    static const size_t function = Stats().Register("QFExcept");
+    return Memoized(function, {&x1, &x2, &x3, &x4, &x5, &x6}, std::tie(x1, x2, x3, x4, x5, x6), [&] {
+        // an empty first table must not be dropped, otherwise the second one would take its place
+        if (x1.RowsInStructure() * x1.ColumnsInStructure() == 0) {
+            return Difference(std::vector<const CellMatrix*>());
+        }
+        return Difference(Arguments2Vector(&x1, &x2, &x3, &x4, &x5, &x6));
+    });
 }
 
+/*************************************
+table arguments: a range, or a single cell holding the handle of a mapped table
+*************************************/
+
+std::optional<TableView> FindTableArgument(const CellMatrix& x) {
+    if (x.RowsInStructure() == 1 && x.ColumnsInStructure() == 1 && x(0, 0).IsString()) {
+        std::string text = std::string(x(0, 0));
+        if (IsTableHandle(text)) {
+            return FindTableView(text);
+        }
+    }
+    return std::nullopt;
+}
+
+// calls function with the range, or with the view of the mapped table it names
+template <class Function> auto VisitTable(const CellMatrix& x, Function function) {
+    if (auto view = FindTableArgument(x)) {
+        return function(*view);
+    }
+    return function(x);
+}
+
+size_t TableRows(const CellMatrix& x) {
+    return VisitTable(x, [](const auto& table) { return size_t(table.RowsInStructure()); });
+}
+
+// only the columns of the view are read from a mapped table
+template <class StringEncoder> ColumnarTable EncodeTable(const CellMatrix& x, StringEncoder encodeString) {
+    return VisitTable(x, [&](const auto& table) { return ColumnarTable(table, encodeString); });
+}
+
+// the fingerprint of a table and the check hash of it
+std::pair<uint64_t, uint64_t> TableDigest(const CellMatrix& x) { return DigestMatrix(x); }
+std::pair<uint64_t, uint64_t> TableDigest(const TableView& x) { return {x.Fingerprint(), x.Check()}; }
+
 /*************************************
 exact match, lookup functions
 *************************************/
 
-CellMatrix QFExactVLookup(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable) {
-    if (lookup.ColumnsInStructure() != table.ColumnsInStructure()) {
+// 0, false or empty for false, anything else for true
+bool FlagValue(const CellMatrix& flag) {
+    if (flag.ColumnsInStructure() * flag.RowsInStructure() == 0) {
+        return false;
+    }
+    return !(CheckCellValue(flag(0, 0), 0.0) || CheckCellValue(flag(0, 0), false) || flag(0, 0).IsEmpty());
+}
+
+// the first cell as a number, or the default when it is empty
+double NumberValue(const CellMatrix& x, double defaultValue) {
+    if (x.ColumnsInStructure() * x.RowsInStructure() == 0 || x(0, 0).IsEmpty()) {
+        return defaultValue;
+    }
+    if (!x(0, 0).IsANumber()) {
+        throw("A number is expected.");
+    }
+    return double(x(0, 0));
+}
+
+void CheckLookupInputs(const LookupIndex& index, const CellMatrix& lookup, size_t outputRows) {
+    if (lookup.ColumnsInStructure() != index.Columns()) {
         throw("Lookup items and table do not have the same number of fields.");
     }
 
-    if (outputTable.RowsInStructure() != table.RowsInStructure()) {
+    if (outputRows != index.Rows()) {
         throw("Table and output table do not have the same number of records.");
     }
+}
 
-    // construct the map
-    std::map<std::vector<QFCellValue>, size_t, LessThanCellValueVector> tableItems;
+constexpr size_t PROBE_MIN_ROWS_PER_WORKER = size_t(1) << 14;
 
-    for (size_t row = 0; row < table.RowsInStructure(); ++row) {
-        std::vector<QFCellValue> rowItem;
-        for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
-            rowItem.emplace_back(Convert2QFCellValue(table(row, col)));
-        }
-        tableItems[rowItem] = row;
-    }
+// some consecutive rows of a table, seen as a table
+struct RowSlice {
+    const CellMatrix& table;
+    size_t first;
+    size_t rows;
 
-    CellMatrix result{lookup.RowsInStructure(), outputTable.ColumnsInStructure()};
+    size_t RowsInStructure() const { return rows; }
+    size_t ColumnsInStructure() const { return table.ColumnsInStructure(); }
+    const CellValue& operator()(size_t row, size_t col) const { return table(first + row, col); }
+};
 
-    for (size_t row = 0; row < lookup.RowsInStructure(); ++row) {
-        std::vector<QFCellValue> rowItem;
-        for (size_t col = 0; col < lookup.ColumnsInStructure(); ++col) {
-            rowItem.emplace_back(Convert2QFCellValue(lookup(row, col)));
+// calls visit(row, id, lastRow) with the key id of every lookup row and its last table row, or npos; keys of numbers only are
+// probed straight from the lookup cells, as no other type can match them, the others through the encoded lookup items
+// large lookups are split in slices probed in parallel, each encoded on its own, so visit must only write what belongs to its row
+template <class Visit> void ProbeLookup(const LookupIndex& index, const CellMatrix& lookup, Visit visit) {
+    size_t rows = lookup.RowsInStructure();
+    size_t workers = WorkerCount(rows, PROBE_MIN_ROWS_PER_WORKER);
+    ParallelFor(workers, [&](size_t worker) {
+        auto range = ChunkRange(rows, workers, worker);
+        if (index.NumberKeys()) {
+            for (size_t row = range.first; row < range.second; ++row) {
+                JobCheckpoint(row);
+                const CellValue& item = lookup(row, 0);
+                auto slot = item.IsANumber() ? index.FindNumber(double(item)) : nullptr;
+                if (slot) {
+                    visit(row, size_t(slot->id), size_t(slot->last));
+                } else {
+                    visit(row, LookupIndex::npos, size_t(0));
+                }
+            }
+            return;
+        }
+
+        ColumnarTable items = index.Encode(RowSlice{lookup, range.first, range.second - range.first});
+        for (size_t row = range.first; row < range.second; ++row) {
+            JobCheckpoint(row);
+            if (size_t id = index.Find(items, row - range.first); id != LookupIndex::npos) {
+                visit(row, id, *(index.TableRows(id).second - 1));
+            } else {
+                visit(row, LookupIndex::npos, size_t(0));
+            }
         }
+    });
+}
+
+// the last matching record is returned
+template <class OutputTable> CellMatrix IndexVLookup(const LookupIndex& index, const CellMatrix& lookup, const OutputTable& outputTable) {
+    CheckLookupInputs(index, lookup, outputTable.RowsInStructure());
+    PhaseTimer timer(PHASE_PROBE);
 
-        if (auto iter = tableItems.find(rowItem); iter != end(tableItems)) {
-            double index = double(iter->second);
+    CellMatrix result{lookup.RowsInStructure(), outputTable.ColumnsInStructure()};
+    ProbeLookup(index, lookup, [&](size_t row, size_t id, size_t tableRow) {
+        if (id != LookupIndex::npos) {
             for (size_t col = 0; col < outputTable.ColumnsInStructure(); ++col) {
-                result(row, col) = outputTable(index, col);
+                CopyCell(outputTable(tableRow, col), result(row, col));
             }
         } else {
             for (size_t col = 0; col < outputTable.ColumnsInStructure(); ++col) {
                 result(row, col) = EXCEL_ERROR_NA;
             }
         }
-    }
+    });
     return result;
 }
 
-// reuse ExactVLookup to reduce code duplication
-CellMatrix QFExactMatch(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& oneIndex) {
-    // get the base index from oneIndex
-    size_t baseIndex{0};
-    if (oneIndex.ColumnsInStructure() * oneIndex.RowsInStructure() != 0) {
-        if (!(CheckCellValue(oneIndex(0, 0), 0.0) && CheckCellValue(oneIndex(0, 0), false))) {
-            baseIndex = 1;
+CellMatrix IndexMatch(const LookupIndex& index, const CellMatrix& lookup, size_t baseIndex) {
+    CheckLookupInputs(index, lookup, index.Rows());
+    PhaseTimer timer(PHASE_PROBE);
+
+    CellMatrix result{lookup.RowsInStructure(), 1};
+    ProbeLookup(index, lookup, [&](size_t row, size_t id, size_t tableRow) {
+        if (id != LookupIndex::npos) {
+            result(row, 0) = int(tableRow + baseIndex);
+        } else {
+            result(row, 0) = EXCEL_ERROR_NA;
         }
+    });
+    return result;
+}
+
+// two passes: the probe keeps the key id of every lookup row, whose output rows then start at the sum of the records of the rows
+// before it; the output is filled in parallel too, in slices of about the same number of output rows
+template <class OutputTable>
+CellMatrix IndexFilter(const LookupIndex& index, const CellMatrix& lookup, const OutputTable& outputTable, bool includeLookup) {
+    CheckLookupInputs(index, lookup, outputTable.RowsInStructure());
+    PhaseTimer timer(PHASE_PROBE);
+
+    size_t lookupRows = lookup.RowsInStructure();
+    std::vector<size_t> ids(lookupRows);
+    ProbeLookup(index, lookup, [&](size_t row, size_t id, size_t) { ids[row] = id; });
+
+    // offsets[row] is the first output row of the lookup row
+    std::vector<size_t> offsets(lookupRows + 1, 0);
+    for (size_t row = 0; row < lookupRows; ++row) {
+        auto tableRows = ids[row] != LookupIndex::npos ? index.TableRows(ids[row]) : LookupIndex::RowRange{};
+        offsets[row + 1] = offsets[row] + size_t(tableRows.second - tableRows.first);
     }
-    CellMatrix indices(table.RowsInStructure(), 1);
+    size_t totalRows = offsets.back();
+
+    auto colOffset = includeLookup ? lookup.ColumnsInStructure() : 0;
+    CellMatrix result{totalRows, outputTable.ColumnsInStructure() + colOffset};
+
+    // a slice starts at the first lookup row whose output rows start in its share
+    size_t workers = WorkerCount(totalRows, PROBE_MIN_ROWS_PER_WORKER);
+    auto sliceStart = [&](size_t worker) {
+        return size_t(std::lower_bound(begin(offsets), end(offsets) - 1, ChunkRange(totalRows, workers, worker).first) - begin(offsets));
+    };
+    ParallelFor(workers, [&](size_t worker) {
+        size_t last = worker + 1 == workers ? lookupRows : sliceStart(worker + 1);
+        for (size_t lookupRow = sliceStart(worker); lookupRow < last; ++lookupRow) {
+            JobCheckpoint(lookupRow);
+            if (ids[lookupRow] == LookupIndex::npos) {
+                continue;
+            }
+            size_t id = ids[lookupRow];
+            size_t row = offsets[lookupRow];
+            auto tableRows = index.TableRows(id);
+            for (auto iOutput = tableRows.first; iOutput != tableRows.second; ++iOutput) {
+                for (size_t col = 0; col < colOffset; ++col) {
+                    index.KeyValue(id, col, result(row, col));
+                }
+                for (size_t col = 0; col < outputTable.ColumnsInStructure(); ++col) {
+                    CopyCell(outputTable(*iOutput, col), result(row, col + colOffset));
+                }
+                ++row;
+            }
+        }
+    });
+
+    return result;
+}
 
-    for (size_t row = 0; row < table.RowsInStructure(); ++row) {
-        indices(row, 0) = int(row + baseIndex);
+template <class Table> LookupIndex BuildLookupIndex(const CellMatrix& lookup, const Table& table) {
+    if (lookup.ColumnsInStructure() != table.ColumnsInStructure()) {
+        throw("Lookup items and table do not have the same number of fields.");
     }
-    return QFExactVLookup(lookup, table, indices);
+    PhaseTimer timer(PHASE_BUILD);
+    return LookupIndex(table);
+}
+
+CellMatrix QFExactVLookup(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable) {
+    static const size_t function = Stats().Register("QFExactVLookup");
+    return Memoized(function, {&lookup, &table, &outputTable}, std::tie(lookup, table, outputTable), [&] {
+        return VisitTable(table, [&](const auto& keys) {
+            return VisitTable(outputTable, [&](const auto& output) { return IndexVLookup(BuildLookupIndex(lookup, keys), lookup, output); });
+        });
+    });
+}
+
+CellMatrix QFExactMatch(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& oneIndex) {
+    static const size_t function = Stats().Register("QFExactMatch");
+    return Memoized(function, {&lookup, &table}, std::tie(lookup, table, oneIndex), [&] {
+        return VisitTable(table, [&](const auto& keys) { return IndexMatch(BuildLookupIndex(lookup, keys), lookup, FlagValue(oneIndex) ? 1 : 0); });
+    });
 }
 
 CellMatrix QFFilter(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable, const CellMatrix& includeLookup) {
+    static const size_t function = Stats().Register("QFFilter");
+    return Memoized(function, {&lookup, &table, &outputTable}, std::tie(lookup, table, outputTable, includeLookup), [&] {
+        return VisitTable(table, [&](const auto& keys) {
+            return VisitTable(outputTable,
+                              [&](const auto& output) { return IndexFilter(BuildLookupIndex(lookup, keys), lookup, output, FlagValue(includeLookup)); });
+        });
+    });
+}
+
+/*************************************
+membership tests: semi join and anti join of the lookup rows against the rows of a table
+*************************************/
+
+template <class Table> CellMatrix Membership(const CellMatrix& lookup, const Table& table, bool member) {
     if (lookup.ColumnsInStructure() != table.ColumnsInStructure()) {
         throw("Lookup items and table do not have the same number of fields.");
     }
+    std::optional<TableKeys<Table>> keys;
+    {
+        PhaseTimer timer(PHASE_BUILD);
+        keys.emplace(table);
+    }
 
-    if (outputTable.RowsInStructure() != table.RowsInStructure()) {
-        throw("Table and output table do not have the same number of records.");
+    PhaseTimer timer(PHASE_PROBE);
+    CellMatrix result{lookup.RowsInStructure(), 1};
+    for (size_t row = 0; row < lookup.RowsInStructure(); ++row) {
+        result(row, 0) = (keys->Find(lookup, row) != keys->npos) == member;
+    }
+    return result;
+}
+
+CellMatrix QFIn(const CellMatrix& lookup, const CellMatrix& table) {
+    static const size_t function = Stats().Register("QFIn");
+    return Memoized(function, {&lookup, &table}, std::tie(lookup, table),
+                        [&] { return VisitTable(table, [&](const auto& keys) { return Membership(lookup, keys, true); }); });
+}
+
+CellMatrix QFNotIn(const CellMatrix& lookup, const CellMatrix& table) {
+    static const size_t function = Stats().Register("QFNotIn");
+    return Memoized(function, {&lookup, &table}, std::tie(lookup, table),
+                        [&] { return VisitTable(table, [&](const auto& keys) { return Membership(lookup, keys, false); }); });
+}
+
+/*************************************
+fuzzy match: the rows of a table whose strings are within an edit distance of each lookup string
+*************************************/
+
+constexpr size_t FUZZY_MIN_LOOKUPS_PER_WORKER = 256;
+
+// the best matches of each lookup row as (index, score) pairs, most similar first; #N/A where there is no match
+template <class Table>
+CellMatrix FuzzyMatchRows(const CellMatrix& lookup, const Table& table, double threshold, size_t top, size_t baseIndex) {
+    if (lookup.ColumnsInStructure() != 1 || table.ColumnsInStructure() != 1) {
+        throw("Lookup items and table must have one column.");
+    }
+    std::optional<FuzzyIndex> index;
+    {
+        PhaseTimer timer(PHASE_BUILD);
+        index.emplace(table, threshold);
+    }
+
+    PhaseTimer timer(PHASE_PROBE);
+    size_t rows = lookup.RowsInStructure();
+    CellMatrix result{rows, 2 * top};
+    size_t workers = WorkerCount(rows, FUZZY_MIN_LOOKUPS_PER_WORKER);
+    ParallelFor(workers, [&](size_t worker) {
+        FuzzyIndex::Workspace work;
+        std::string scratch;
+        auto range = ChunkRange(rows, workers, worker);
+        for (size_t row = range.first; row < range.second; ++row) {
+            std::vector<FuzzyMatch> matches;
+            if (lookup(row, 0).IsString()) {
+                matches = index->Match(CellText(lookup(row, 0), scratch), top, work);
+            }
+            for (size_t i = 0; i < top; ++i) {
+                if (i < matches.size()) {
+                    result(row, 2 * i) = int(matches[i].row + baseIndex);
+                    result(row, 2 * i + 1) = matches[i].score;
+                } else {
+                    result(row, 2 * i) = EXCEL_ERROR_NA;
+                    result(row, 2 * i + 1) = EXCEL_ERROR_NA;
+                }
+            }
+        }
+    });
+    return result;
+}
+
+CellMatrix QFFuzzyMatch(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& threshold, const CellMatrix& topK,
+                        const CellMatrix& oneIndex) {
+    static const size_t function = Stats().Register("QFFuzzyMatch");
+    return Memoized(function, {&lookup, &table}, std::tie(lookup, table, threshold, topK, oneIndex), [&] {
+        double minScore = NumberValue(threshold, DEFAULT_FUZZY_THRESHOLD);
+        if (!(minScore > 0.0 && minScore <= 1.0)) {
+            throw("The threshold must be between 0 and 1.");
+        }
+        double top = NumberValue(topK, 1.0);
+        if (!(top >= 1.0) || !std::isfinite(top)) {
+            throw("The number of matches must be a number of at least 1.");
+        }
+        size_t baseIndex = FlagValue(oneIndex) ? 1 : 0;
+        return VisitTable(table, [&](const auto& keys) {
+            // no lookup row has more matches than the table has rows
+            size_t matches = size_t(std::min(top, double(std::max<size_t>(keys.RowsInStructure(), 1))));
+            return FuzzyMatchRows(lookup, keys, minScore, matches, baseIndex);
+        });
+    });
+}
+
+/*************************************
+persistent lookup indices, referred to by handle
+*************************************/
+
+std::string QFBuildIndex(const CellMatrix& table) {
+    static const size_t function = Stats().Register("QFBuildIndex");
+    return Instrumented(function, {&table}, [&] {
+        PhaseTimer timer(PHASE_BUILD);
+        return VisitTable(table, [&](const auto& keys) {
+            // the handle is derived from the content, so a changed table gets a new handle and its dependents recalculate; a kept
+            // index is only used if the check hashes agree as well
+            auto digest = TableDigest(keys);
+            std::string handle = LookupIndexHandle(digest.first);
+            auto index = LookupIndexRegistry().Find(handle);
+            if (!index || index->Check() != digest.second) {
+                LookupIndexRegistry().Insert(handle, std::make_shared<const LookupIndex>(keys, digest.second));
+            }
+            return handle;
+        });
+    });
+}
+
+// an evicted index is built again from its spill
+std::shared_ptr<const LookupIndex> FindLookupIndex(const std::string& handle) {
+    auto index = LookupIndexRegistry().Find(handle);
+    if (!index) {
+        index = LookupIndexSpills().Load(handle);
+        if (!index) {
+            throw("Unknown or evicted index handle, recalculate its QFBuildIndex.");
+        }
+        LookupIndexRegistry().Insert(handle, index);
     }
+    return index;
+}
+
+CellMatrix QFIndexLookup(const CellMatrix& lookup, const std::string& index, const CellMatrix& outputTable) {
+    static const size_t function = Stats().Register("QFIndexLookup");
+    return Memoized(function, {&lookup, &outputTable}, std::tie(lookup, index, outputTable), [&] {
+        return VisitTable(outputTable, [&](const auto& output) { return IndexVLookup(*FindLookupIndex(index), lookup, output); });
+    });
+}
+
+CellMatrix QFIndexMatch(const CellMatrix& lookup, const std::string& index, const CellMatrix& oneIndex) {
+    static const size_t function = Stats().Register("QFIndexMatch");
+    return Memoized(function, {&lookup}, std::tie(lookup, index, oneIndex),
+                    [&] { return IndexMatch(*FindLookupIndex(index), lookup, FlagValue(oneIndex) ? 1 : 0); });
+}
 
-    size_t lookupIncluded{0};
-    if (includeLookup.ColumnsInStructure() * includeLookup.RowsInStructure() != 0) {
-        if (!(CheckCellValue(includeLookup(0, 0), 0.0) && CheckCellValue(includeLookup(0, 0), false))) {
-            lookupIncluded = 1;
+CellMatrix QFIndexFilter(const CellMatrix& lookup, const std::string& index, const CellMatrix& outputTable, const CellMatrix& includeLookup) {
+    static const size_t function = Stats().Register("QFIndexFilter");
+    return Memoized(function, {&lookup, &outputTable}, std::tie(lookup, index, outputTable, includeLookup), [&] {
+        return VisitTable(outputTable, [&](const auto& output) { return IndexFilter(*FindLookupIndex(index), lookup, output, FlagValue(includeLookup)); });
+    });
+}
+
+double QFSetIndexBudget(double megabytes) {
+    static const size_t function = Stats().Register("QFSetIndexBudget");
+    return Instrumented(function, {}, [&] {
+        if (megabytes < 0.0) {
+            throw("The budget must not be negative.");
         }
+        return double(LookupIndexRegistry().SetBudget(size_t(megabytes * 1024.0 * 1024.0))) / (1024.0 * 1024.0);
+    });
+}
+
+/*************************************
+sorted table lookup functions
+*************************************/
+
+// the sorted layout of a table, built by the first lookup against its content and kept for the next ones
+std::shared_ptr<const SortedTable> FindSortedTable(const CellMatrix& table) {
+    auto digest = DigestMatrix(table);
+    std::string handle = SortedTableHandle(table.RowsInStructure(), table.ColumnsInStructure(), digest.first);
+    auto sorted = SortedTableRegistry().Find(handle);
+    if (!sorted || sorted->Check() != digest.second) {
+        sorted = std::make_shared<const SortedTable>(table, digest.second);
+        SortedTableRegistry().Insert(handle, sorted);
     }
-    // construct the map
-    std::map<std::vector<QFCellValue>, std::vector<size_t>, LessThanCellValueVector> tableItems;
+    return sorted;
+}
 
-    for (size_t row = 0; row < table.RowsInStructure(); ++row) {
-        std::vector<QFCellValue> rowItem;
-        for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
-            rowItem.emplace_back(Convert2QFCellValue(table(row, col)));
+// the sorted table and the probes ranked against its strings, so the search compares integers only
+struct SortedProbes {
+    SortedProbes(const CellMatrix& table, const std::vector<const CellMatrix*>& probes) : sorted(FindSortedTable(table)) {
+        for (auto probe : probes) {
+            keys.push_back(sorted->ProbeKeys(*probe));
         }
-        tableItems[rowItem].push_back(row);
     }
 
-    std::vector<decltype(tableItems.begin())> resultIters;
-    size_t totalRows{0};
+    const SortedSearch& Search() const { return sorted->Search(); }
+    const OrderKey* Probe(size_t probe, size_t row) const { return keys[probe].data() + row * sorted->Columns(); }
+
+    std::shared_ptr<const SortedTable> sorted;
+    std::vector<std::vector<OrderKey>> keys;
+};
+
+// the matched table row for each lookup row, NO_ROW if none
+// matchType 1: last row with the largest key <= lookup, -1: first row with the smallest key >= lookup, 0: first row equal to lookup
+std::vector<size_t> SortedMatchRows(const CellMatrix& lookup, const CellMatrix& table, int matchType) {
+    PhaseTimer timer(PHASE_BUILD);
+    SortedProbes probes(table, {&lookup});
+    timer.Switch(PHASE_PROBE);
+    const SortedSearch& search = probes.Search();
+    std::vector<size_t> rows(lookup.RowsInStructure(), NO_ROW);
 
     for (size_t row = 0; row < lookup.RowsInStructure(); ++row) {
-        std::vector<QFCellValue> rowItem;
-        for (size_t col = 0; col < lookup.ColumnsInStructure(); ++col) {
-            rowItem.emplace_back(Convert2QFCellValue(lookup(row, col)));
+        const OrderKey* probe = probes.Probe(0, row);
+        if (matchType > 0) {
+            if (size_t upper = search.UpperBound(probe); upper > 0) {
+                rows[row] = upper - 1;
+            }
+        } else if (matchType < 0) {
+            if (size_t lower = search.LowerBound(probe); lower < search.Rows()) {
+                rows[row] = lower;
+            }
+        } else {
+            if (size_t lower = search.LowerBound(probe); lower < search.UpperBound(probe)) {
+                rows[row] = lower;
+            }
         }
+    }
+    return rows;
+}
+
+int MatchType(const CellMatrix& matchType) {
+    double value = NumberValue(matchType, 1.0);
+    return (value > 0.0) ? 1 : ((value < 0.0) ? -1 : 0);
+}
+
+CellMatrix SortedMatch(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& matchType, const CellMatrix& oneIndex) {
+    std::vector<size_t> rows = SortedMatchRows(lookup, table, MatchType(matchType));
+    size_t baseIndex = FlagValue(oneIndex) ? 1 : 0;
 
-        if (auto iter = tableItems.find(rowItem); iter != end(tableItems)) {
-            totalRows += iter->second.size();
-            resultIters.push_back(iter);
+    CellMatrix result{rows.size(), 1};
+    for (size_t row = 0; row < rows.size(); ++row) {
+        if (rows[row] != NO_ROW) {
+            result(row, 0) = int(rows[row] + baseIndex);
+        } else {
+            result(row, 0) = EXCEL_ERROR_NA;
         }
     }
+    return result;
+}
 
-    auto colOffset = lookupIncluded * lookup.ColumnsInStructure();
-    CellMatrix result{totalRows, outputTable.ColumnsInStructure() + colOffset};
+CellMatrix QFSortedMatch(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& matchType, const CellMatrix& oneIndex) {
+    static const size_t function = Stats().Register("QFSortedMatch");
+    return Memoized(function, {&lookup, &table}, std::tie(lookup, table, matchType, oneIndex),
+                    [&] { return SortedMatch(lookup, table, matchType, oneIndex); });
+}
 
-    size_t row{0};
-    for (auto&& iter : resultIters) {
-        for (auto&& iOutput : iter->second) {
-            if (colOffset) {
-                for (size_t col = 0; col < colOffset; ++col) {
-                    result(row, col) = iter->first[col];
-                }
+CellMatrix SortedLookup(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable, const CellMatrix& matchType) {
+    if (outputTable.RowsInStructure() != table.RowsInStructure()) {
+        throw("Table and output table do not have the same number of records.");
+    }
+    std::vector<size_t> rows = SortedMatchRows(lookup, table, MatchType(matchType));
+
+    CellMatrix result{rows.size(), outputTable.ColumnsInStructure()};
+    for (size_t row = 0; row < rows.size(); ++row) {
+        for (size_t col = 0; col < outputTable.ColumnsInStructure(); ++col) {
+            if (rows[row] != NO_ROW) {
+                result(row, col) = outputTable(rows[row], col);
+            } else {
+                result(row, col) = EXCEL_ERROR_NA;
             }
+        }
+    }
+    return result;
+}
+
+CellMatrix QFSortedLookup(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable, const CellMatrix& matchType) {
+    static const size_t function = Stats().Register("QFSortedLookup");
+    return Memoized(function, {&lookup, &table, &outputTable}, std::tie(lookup, table, outputTable, matchType),
+                    [&] { return SortedLookup(lookup, table, outputTable, matchType); });
+}
+
+CellMatrix RangeLookup(const CellMatrix& lower, const CellMatrix& upper, const CellMatrix& table, const CellMatrix& outputTable) {
+    if (lower.RowsInStructure() != upper.RowsInStructure()) {
+        throw("Lower and upper bounds do not have the same number of records.");
+    }
+    if (outputTable.RowsInStructure() != table.RowsInStructure()) {
+        throw("Table and output table do not have the same number of records.");
+    }
+    PhaseTimer timer(PHASE_BUILD);
+    SortedProbes probes(table, {&lower, &upper});
+    timer.Switch(PHASE_PROBE);
+    const SortedSearch& search = probes.Search();
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t totalRows{0};
+    for (size_t row = 0; row < lower.RowsInStructure(); ++row) {
+        size_t first = search.LowerBound(probes.Probe(0, row));
+        size_t last = search.UpperBound(probes.Probe(1, row));
+        if (first < last) {
+            ranges.emplace_back(first, last);
+            totalRows += last - first;
+        }
+    }
+
+    CellMatrix result{totalRows, outputTable.ColumnsInStructure()};
+    size_t row{0};
+    for (auto& range : ranges) {
+        for (size_t tableRow = range.first; tableRow < range.second; ++tableRow, ++row) {
             for (size_t col = 0; col < outputTable.ColumnsInStructure(); ++col) {
-                result(row, col + colOffset) = outputTable(iOutput, col);
+                result(row, col) = outputTable(tableRow, col);
+            }
+        }
+    }
+    return result;
+}
+
+CellMatrix QFRangeLookup(const CellMatrix& lower, const CellMatrix& upper, const CellMatrix& table, const CellMatrix& outputTable) {
+    static const size_t function = Stats().Register("QFRangeLookup");
+    return Memoized(function, {&lower, &upper, &table, &outputTable}, std::tie(lower, upper, table, outputTable),
+                    [&] { return RangeLookup(lower, upper, table, outputTable); });
+}
+
+/*************************************
+row sort functions
+*************************************/
+
+// some columns of a table, seen as a table
+struct TableColumns {
+    const CellMatrix& table;
+    const std::vector<size_t>& columns;
+
+    size_t RowsInStructure() const { return table.RowsInStructure(); }
+    size_t ColumnsInStructure() const { return columns.size(); }
+    const CellValue& operator()(size_t row, size_t col) const { return table(row, columns[col]); }
+};
+
+// 1-based column numbers, all the columns when there are none
+std::vector<size_t> KeyColumns(const CellMatrix& keyColumns, size_t columns) {
+    std::vector<size_t> result;
+    for (size_t row = 0; row < keyColumns.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < keyColumns.ColumnsInStructure(); ++col) {
+            const CellValue& item = keyColumns(row, col);
+            if (item.IsEmpty()) {
+                continue;
             }
+            if (!item.IsANumber() || double(item) < 1.0 || double(item) > double(columns)) {
+                throw("The key columns must be numbers between 1 and the number of columns.");
+            }
+            result.push_back(size_t(double(item)) - 1);
+        }
+    }
+    if (result.empty()) {
+        for (size_t col = 0; col < columns; ++col) {
+            result.push_back(col);
         }
     }
+    return result;
+}
 
+// one direction per key, or a single one for all of them; negative numbers, FALSE and desc sort descending
+std::vector<bool> SortDirections(const CellMatrix& directions, size_t keys) {
+    std::vector<bool> result;
+    for (size_t row = 0; row < directions.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < directions.ColumnsInStructure(); ++col) {
+            const CellValue& item = directions(row, col);
+            if (item.IsANumber()) {
+                result.push_back(double(item) < 0.0);
+            } else if (item.IsBoolean()) {
+                result.push_back(!bool(item));
+            } else if (item.IsString()) {
+                result.push_back(ParseSortDirection(std::string(item)));
+            } else if (!item.IsEmpty()) {
+                throw("Unknown sort direction, use asc or desc.");
+            }
+        }
+    }
+    if (result.size() <= 1) {
+        return std::vector<bool>(keys, !result.empty() && result[0]);
+    }
+    if (result.size() != keys) {
+        throw("There must be one direction per key column.");
+    }
     return result;
 }
 
+CellMatrix SortBy(const CellMatrix& table, const CellMatrix& keyColumns, const CellMatrix& directions, const CellMatrix& topN) {
+    std::vector<size_t> columns = KeyColumns(keyColumns, table.ColumnsInStructure());
+    std::vector<bool> descending = SortDirections(directions, columns.size());
+    double top = NumberValue(topN, 0.0);
+    if (top < 0.0) {
+        throw("The number of rows must not be negative.");
+    }
+
+    StringPool pool;
+    ColumnarTable keys(TableColumns{table, columns}, InternStrings{pool});
+    std::vector<size_t> rows = SortRows(keys, pool, descending, size_t(top));
+
+    CellMatrix result{rows.size(), table.ColumnsInStructure()};
+    for (size_t row = 0; row < rows.size(); ++row) {
+        for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
+            result(row, col) = table(rows[row], col);
+        }
+    }
+    return result;
+}
+
+CellMatrix QFSortBy(const CellMatrix& table, const CellMatrix& keyColumns, const CellMatrix& directions, const CellMatrix& topN) {
+    static const size_t function = Stats().Register("QFSortBy");
+    return Memoized(function, {&table}, std::tie(table, keyColumns, directions, topN),
+                    [&] { return SortBy(table, keyColumns, directions, topN); });
+}
+
+/*************************************
+join functions
+*************************************/
+
+void CheckJoinValues(const CellMatrix& keys, const CellMatrix& values) {
+    if (values.RowsInStructure() * values.ColumnsInStructure() != 0 && values.RowsInStructure() != keys.RowsInStructure()) {
+        throw("Keys and values do not have the same number of records.");
+    }
+}
+
+CellMatrix JoinTables(const CellMatrix& leftKeys, const CellMatrix& leftValues, const CellMatrix& rightKeys, const CellMatrix& rightValues,
+                      const std::string& joinType) {
+    JoinType type = ParseJoinType(joinType);
+    CheckJoinValues(leftKeys, leftValues);
+    CheckJoinValues(rightKeys, rightValues);
+
+    StringPool pool;
+    ColumnarTable left(leftKeys, InternStrings{pool});
+    ColumnarTable right(rightKeys, InternStrings{pool});
+    JoinPairs pairs = Join(left, right, pool, type);
+
+    size_t keyColumns = leftKeys.ColumnsInStructure();
+    size_t leftColumns = leftValues.RowsInStructure() ? leftValues.ColumnsInStructure() : 0;
+    size_t rightColumns = (type != JOIN_SEMI && type != JOIN_ANTI && rightValues.RowsInStructure()) ? rightValues.ColumnsInStructure() : 0;
+    CellMatrix result{pairs.size(), keyColumns + leftColumns + rightColumns};
+
+    for (size_t row = 0; row < pairs.size(); ++row) {
+        size_t lRow = pairs[row].first;
+        size_t rRow = pairs[row].second;
+        for (size_t col = 0; col < keyColumns; ++col) {
+            result(row, col) = (lRow != NO_ROW) ? leftKeys(lRow, col) : rightKeys(rRow, col);
+        }
+        for (size_t col = 0; col < leftColumns; ++col) {
+            if (lRow != NO_ROW) {
+                result(row, keyColumns + col) = leftValues(lRow, col);
+            } else {
+                result(row, keyColumns + col) = EXCEL_ERROR_NA;
+            }
+        }
+        for (size_t col = 0; col < rightColumns; ++col) {
+            if (rRow != NO_ROW) {
+                result(row, keyColumns + leftColumns + col) = rightValues(rRow, col);
+            } else {
+                result(row, keyColumns + leftColumns + col) = EXCEL_ERROR_NA;
+            }
+        }
+    }
+
+    return result;
+}
+
+CellMatrix QFJoin(const CellMatrix& leftKeys, const CellMatrix& leftValues, const CellMatrix& rightKeys, const CellMatrix& rightValues,
+                  const std::string& joinType) {
+    static const size_t function = Stats().Register("QFJoin");
+    return Memoized(function, {&leftKeys, &leftValues, &rightKeys, &rightValues},
+                    std::tie(leftKeys, leftValues, rightKeys, rightValues, joinType),
+                    [&] { return JoinTables(leftKeys, leftValues, rightKeys, rightValues, joinType); });
+}
+
 /*************************************
 Pivot table functions
 *************************************/
 
-template <class OutputClass, class InitializationClass, class IncrementClass>
-CellMatrix PivotTable(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical, InitializationClass initFunctor,
-                      IncrementClass incrementFunctor) {
-    bool hasVertical = (vertical.RowsInStructure() * vertical.ColumnsInStructure()) > 0;
+bool HasVertical(const CellMatrix& vertical) { return (vertical.RowsInStructure() * vertical.ColumnsInStructure()) > 0; }
+
+void AggregateValue(const AggregateState& state, const AggregateSpec& aggregate, const StringPool& pool, CellValue& result) {
+    switch (aggregate.type) {
+    case AGG_SUM:
+        result = state.sum;
+        break;
+    case AGG_COUNT:
+        result = state.count;
+        break;
+    case AGG_MIN:
+        result = state.min;
+        break;
+    case AGG_MAX:
+        result = state.max;
+        break;
+    case AGG_MEAN:
+        result = state.sum / state.count;
+        break;
+    case AGG_VARIANCE:
+        if (state.count > 1.0) {
+            result = state.m2 / (state.count - 1.0);
+        } else {
+            result = EXCEL_ERROR_DIV_0;
+        }
+        break;
+    case AGG_FIRST:
+        DecodeCell(state.first, pool, result);
+        break;
+    case AGG_LAST:
+        DecodeCell(state.last, pool, result);
+        break;
+    case AGG_DISTINCT:
+        result = state.distinct;
+        break;
+    case AGG_APPROX_DISTINCT:
+        result = std::round(state.sketches->distinct.Estimate());
+        break;
+    case AGG_APPROX_QUANTILE:
+        result = state.sketches->quantiles.Quantile(aggregate.fraction);
+        break;
+    case AGG_APPROX_TOP:
+        DecodeCell(state.sketches->frequent.Top(1)[0].payload, pool, result);
+        break;
+    }
+}
 
-    if ((horizontal.RowsInStructure() != value.RowsInStructure()) &&
-        ((!hasVertical) || (horizontal.RowsInStructure() != vertical.RowsInStructure()))) {
-        throw("The inputs must have the same number of records.");
+// each vertical key gets one column per aggregate, followed by the totals; labels adds a header row with the aggregate names
+// keys and cells without records, which a live pivot keeps from earlier inputs, are left out
+template <class Aggregation>
+CellMatrix WritePivot(const Aggregation& pivot, const std::vector<AggregateSpec>& aggregates, const StringPool& pool, bool labels) {
+    const auto& rowKeys = pivot.RowKeys();
+    const KeyIndex& columnKeys = pivot.ColumnKeys();
+
+    std::vector<size_t> rowIds;
+    for (size_t rowId : rowKeys.SortedIds(pool)) {
+        if (pivot.Total(rowId).count > 0.0) {
+            rowIds.push_back(rowId);
+        }
+    }
+    std::vector<bool> liveColumns(columnKeys.Size(), false);
+    for (size_t cellId = 0; cellId < pivot.Cells(); ++cellId) {
+        if (pivot.Cell(cellId).count > 0.0) {
+            liveColumns[pivot.CellColumn(cellId)] = true;
+        }
+    }
+    std::vector<size_t> columnIds;
+    for (size_t columnId : columnKeys.SortedIds(pool)) {
+        if (liveColumns[columnId]) {
+            columnIds.push_back(columnId);
+        }
     }
-    // construct the map
-    std::map<std::vector<QFCellValue>, std::map<std::vector<QFCellValue>, OutputClass, LessThanCellValueVector>, LessThanCellValueVector>
-        tableItems;
-    std::set<std::vector<QFCellValue>, LessThanCellValueVector> columnSet;
-    std::vector<QFCellValue> emptyItem;
 
-    for (size_t row = 0; row < horizontal.RowsInStructure(); ++row) {
-        std::vector<QFCellValue> horizontalItem, verticalItem, valueItem;
+    size_t headerRows = columnKeys.Width() + (labels ? 1 : 0);
+    size_t width = aggregates.size();
+    CellMatrix result{rowIds.size() + headerRows, rowKeys.Width() + (columnIds.size() + 1) * width};
 
-        for (size_t col = 0; col < value.ColumnsInStructure(); ++col) {
-            valueItem.emplace_back(Convert2QFCellValue(value(row, col)));
+    // set up headers
+    std::vector<size_t> columnPositions(columnKeys.Size());
+    size_t col = rowKeys.Width();
+    for (size_t columnId : columnIds) {
+        for (size_t k = 0; k < width; ++k) {
+            for (size_t i = 0; i < columnKeys.Width(); ++i) {
+                DecodeCell(columnKeys.Key(columnId)[i], pool, result(i, col + k));
+            }
         }
-        // horizontal and the total
-        for (size_t col = 0; col < horizontal.ColumnsInStructure(); ++col) {
-            horizontalItem.emplace_back(Convert2QFCellValue(horizontal(row, col)));
+        columnPositions[columnId] = col;
+        col += width;
+    }
+    if (labels) {
+        for (col = rowKeys.Width(); col < result.ColumnsInStructure(); ++col) {
+            result(headerRows - 1, col) = AggregateName(aggregates[(col - rowKeys.Width()) % width]);
         }
+    }
 
-        if (auto hIter = tableItems.find(horizontalItem); hIter == end(tableItems)) {
-            tableItems[horizontalItem][emptyItem] = initFunctor(valueItem);
-        } else {
-            (hIter->second)[emptyItem] = incrementFunctor(valueItem, (hIter->second)[emptyItem]);
+    // write items & their totals
+    std::vector<size_t> rowPositions(rowKeys.Size());
+    size_t row = headerRows;
+    for (size_t rowId : rowIds) {
+        for (col = 0; col < rowKeys.Width(); ++col) {
+            DecodeCell(rowKeys.Key(rowId)[col], pool, result(row, col));
+        }
+        for (size_t k = 0; k < width; ++k) {
+            AggregateValue(pivot.Total(rowId), aggregates[k], pool, result(row, result.ColumnsInStructure() - width + k));
+        }
+        rowPositions[rowId] = row;
+        ++row;
+    }
+
+    // write the values
+    for (size_t cellId = 0; cellId < pivot.Cells(); ++cellId) {
+        if (pivot.Cell(cellId).count == 0.0) {
+            continue;
         }
-        // vertical and the sub item
-        if (hasVertical) {
-            for (size_t col = 0; col < vertical.ColumnsInStructure(); ++col) {
-                verticalItem.emplace_back(Convert2QFCellValue(vertical(row, col)));
+        row = rowPositions[pivot.CellRow(cellId)];
+        col = columnPositions[pivot.CellColumn(cellId)];
+        for (size_t k = 0; k < width; ++k) {
+            AggregateValue(pivot.Cell(cellId), aggregates[k], pool, result(row, col + k));
+        }
+    }
+
+    return result;
+}
+
+void CheckPivotInputs(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
+    size_t records = TableRows(horizontal);
+    if ((records != TableRows(value)) || (HasVertical(vertical) && (records != TableRows(vertical)))) {
+        throw("The inputs must have the same number of records.");
+    }
+}
+
+// one pass over the records for all the aggregates
+CellMatrix PivotTable(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical, const std::vector<AggregateSpec>& aggregates,
+                      bool labels) {
+    CheckPivotInputs(value, horizontal, vertical);
+    // encode the inputs against one string pool
+    StringPool pool;
+    ColumnarTable values = EncodeTable(value, InternStrings{pool});
+    if (values.Columns() == 0) {
+        throw("There are no values.");
+    }
+    ColumnarTable horizontalItems = EncodeTable(horizontal, InternStrings{pool});
+    ColumnarTable verticalItems = HasVertical(vertical) ? EncodeTable(vertical, InternStrings{pool}) : ColumnarTable();
+
+    if (NumberKeyIndex::Accepts(horizontalItems)) {
+        return WritePivot(AggregatePivot<NumberKeyIndex>(values, horizontalItems, verticalItems, aggregates, pool), aggregates, pool, labels);
+    }
+    return WritePivot(AggregatePivot<KeyIndex>(values, horizontalItems, verticalItems, aggregates, pool), aggregates, pool, labels);
+}
+
+CellMatrix QFPivotCount(const CellMatrix& horizontal, const CellMatrix& vertical) {
+    static const size_t function = Stats().Register("QFPivotCount");
+    return Memoized(function, {&horizontal, &vertical}, std::tie(horizontal, vertical), [&] {
+        CellMatrix value{TableRows(horizontal), 1};
+
+        return PivotTable(value, horizontal, vertical, {AGG_COUNT}, false);
+    });
+}
+
+CellMatrix QFPivotSum(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
+    static const size_t function = Stats().Register("QFPivotSum");
+    return Memoized(function, {&value, &horizontal, &vertical}, std::tie(value, horizontal, vertical),
+                    [&] { return PivotTable(value, horizontal, vertical, {AGG_SUM}, false); });
+}
+
+CellMatrix QFPivotMax(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
+    static const size_t function = Stats().Register("QFPivotMax");
+    return Memoized(function, {&value, &horizontal, &vertical}, std::tie(value, horizontal, vertical),
+                    [&] { return PivotTable(value, horizontal, vertical, {AGG_MAX}, false); });
+}
+
+CellMatrix QFPivotMin(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
+    static const size_t function = Stats().Register("QFPivotMin");
+    return Memoized(function, {&value, &horizontal, &vertical}, std::tie(value, horizontal, vertical),
+                    [&] { return PivotTable(value, horizontal, vertical, {AGG_MIN}, false); });
+}
+
+std::vector<AggregateSpec> AggregateTypes(const CellMatrix& aggregates) {
+    std::vector<AggregateSpec> types;
+    for (size_t row = 0; row < aggregates.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < aggregates.ColumnsInStructure(); ++col) {
+            if (aggregates(row, col).IsString()) {
+                types.push_back(ParseAggregate(std::string(aggregates(row, col))));
             }
+        }
+    }
+    if (types.empty()) {
+        throw("There are no aggregates.");
+    }
+    return types;
+}
 
-            if (auto vIter = tableItems[horizontalItem].find(verticalItem); vIter == end(tableItems[horizontalItem])) {
-                tableItems[horizontalItem][verticalItem] = initFunctor(valueItem);
-            } else {
-                vIter->second = incrementFunctor(valueItem, vIter->second);
+CellMatrix QFPivot(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical, const CellMatrix& aggregates) {
+    static const size_t function = Stats().Register("QFPivot");
+    return Memoized(function, {&value, &horizontal, &vertical}, std::tie(value, horizontal, vertical, aggregates),
+                    [&] { return PivotTable(value, horizontal, vertical, AggregateTypes(aggregates), true); });
+}
+
+// the state of the previous call of the same name is updated with the rows that changed since
+CellMatrix QFLivePivot(const std::string& name, const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical,
+                       const CellMatrix& aggregates) {
+    static const size_t function = Stats().Register("QFLivePivot");
+    return Instrumented(function, {&value, &horizontal, &vertical}, [&] {
+        std::vector<AggregateSpec> types = AggregateTypes(aggregates);
+        CheckPivotInputs(value, horizontal, vertical);
+
+        auto live = LivePivotRegistry().Find(name);
+        if (!live) {
+            live = std::make_shared<const LivePivot>();
+        }
+        std::lock_guard<std::mutex> lock(live->mutex);
+        std::unique_ptr<IncrementalPivot>& pivot = live->pivot;
+        if (!pivot || pivot->Aggregates() != types || pivot->Bloated()) {
+            pivot = std::make_unique<IncrementalPivot>(types);
+        }
+
+        try {
+            PhaseTimer timer(PHASE_BUILD);
+            StringPool& pool = pivot->Pool();
+            ColumnarTable values = EncodeTable(value, InternStrings{pool});
+            if (values.Columns() == 0) {
+                throw("There are no values.");
+            }
+            ColumnarTable horizontalItems = EncodeTable(horizontal, InternStrings{pool});
+            ColumnarTable verticalItems = HasVertical(vertical) ? EncodeTable(vertical, InternStrings{pool}) : ColumnarTable();
+            pivot->Update(std::move(values), std::move(horizontalItems), std::move(verticalItems));
+        } catch (...) {
+            // a failed update leaves the state half done
+            pivot.reset();
+            LivePivotRegistry().Remove(name);
+            throw;
+        }
+        LivePivotRegistry().Insert(name, live);
+        return WritePivot(*pivot, types, pivot->Pool(), true);
+    });
+}
+
+/*************************************
+group by: one row per key with the aggregates of every value column, the long format of a pivot table without column keys
+*************************************/
+
+// the strings of a range, each parsed by parse; none if the range is empty
+template <class Parse> auto ParseStrings(const CellMatrix& x, Parse parse) {
+    std::vector<decltype(parse(std::string()))> items;
+    for (size_t row = 0; row < x.RowsInStructure(); ++row) {
+        for (size_t col = 0; col < x.ColumnsInStructure(); ++col) {
+            if (x(row, col).IsString()) {
+                items.push_back(parse(std::string(x(row, col))));
             }
-            columnSet.insert(verticalItem);
         }
     }
+    return items;
+}
 
-    CellMatrix result{tableItems.size() + vertical.ColumnsInStructure(), horizontal.ColumnsInStructure() + columnSet.size() + 1};
+// the aggregate of a term when it is a number, NaN otherwise
+double GroupTermValue(const AggregateState& state, const GroupTerm& term, const StringPool& pool) {
+    CellValue value;
+    AggregateValue(state, term.aggregate, pool, value);
+    return value.IsANumber() ? double(value) : std::numeric_limits<double>::quiet_NaN();
+}
 
-    // set up headers
-    size_t col = horizontal.ColumnsInStructure();
-    for (auto& column : columnSet) {
-        for (size_t i = 0; i < column.size(); ++i) {
-            Convert2CellValue(column[i], result(i, col));
+// the groups meeting every condition, in the order of their keys or of the order term; groups whose term is not a number go last
+template <class Aggregation>
+std::vector<size_t> SelectGroups(const Aggregation& groups, const std::vector<GroupCondition>& conditions,
+                                 const std::vector<GroupOrder>& order, const StringPool& pool) {
+    std::vector<size_t> ids;
+    for (size_t id : groups.Keys().SortedIds(pool)) {
+        bool keep = true;
+        for (size_t i = 0; keep && i < conditions.size(); ++i) {
+            const GroupTerm& term = conditions[i].term;
+            double value = GroupTermValue(groups.State(id, term.column), term, pool);
+            keep = !std::isnan(value) && conditions[i].Holds(value);
         }
-        ++col;
+        if (keep) {
+            ids.push_back(id);
+        }
+    }
+    if (order.empty()) {
+        return ids;
     }
 
-    // write items & their values
-    size_t row = vertical.ColumnsInStructure();
+    // ties keep the order of their keys
+    const GroupOrder& by = order.front();
+    std::vector<std::pair<double, size_t>> items(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        items[i] = {GroupTermValue(groups.State(ids[i], by.term.column), by.term, pool), ids[i]};
+    }
+    std::stable_sort(begin(items), end(items), [&](const auto& lhs, const auto& rhs) {
+        if (std::isnan(lhs.first) || std::isnan(rhs.first)) {
+            return !std::isnan(lhs.first) && std::isnan(rhs.first);
+        }
+        return by.descending ? lhs.first > rhs.first : lhs.first < rhs.first;
+    });
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ids[i] = items[i].second;
+    }
+    return ids;
+}
 
-    for (auto& rowItem : tableItems) {
-        // write the row headers
-        for (col = 0; col < horizontal.ColumnsInStructure(); ++col) {
-            Convert2CellValue(rowItem.first[col], result(row, col));
+// a header row with the aggregate names, followed by the value column when there are several, then a row per group
+template <class Aggregation>
+CellMatrix WriteGroups(const Aggregation& groups, const std::vector<AggregateSpec>& aggregates, const std::vector<size_t>& ids,
+                       const StringPool& pool) {
+    const auto& keys = groups.Keys();
+    size_t width = aggregates.size();
+    CellMatrix result{ids.size() + 1, keys.Width() + groups.Width() * width};
+    for (size_t col = 0; col < groups.Width(); ++col) {
+        for (size_t k = 0; k < width; ++k) {
+            std::string name = AggregateName(aggregates[k]);
+            result(0, keys.Width() + col * width + k) = groups.Width() > 1 ? name + " " + std::to_string(col + 1) : name;
         }
-        // write the values
-        for (auto& column : columnSet) {
-            if (auto iter = rowItem.second.find(column); iter != end(rowItem.second)) {
-                Convert2CellValue(iter->second, result(row, col));
+    }
+
+    // the rows are written in parallel, as there may be as many as records
+    size_t workers = WorkerCount(ids.size(), PROBE_MIN_ROWS_PER_WORKER);
+    ParallelFor(workers, [&](size_t worker) {
+        auto range = ChunkRange(ids.size(), workers, worker);
+        for (size_t i = range.first; i < range.second; ++i) {
+            size_t id = ids[i];
+            for (size_t col = 0; col < keys.Width(); ++col) {
+                DecodeCell(keys.Key(id)[col], pool, result(i + 1, col));
+            }
+            for (size_t col = 0; col < groups.Width(); ++col) {
+                for (size_t k = 0; k < width; ++k) {
+                    AggregateValue(groups.State(id, col), aggregates[k], pool, result(i + 1, keys.Width() + col * width + k));
+                }
             }
-            ++col;
         }
+    });
+    return result;
+}
 
-        // write the aggregate
-        Convert2CellValue(rowItem.second[emptyItem], result(row, col));
-        ++row;
+CellMatrix GroupBy(const CellMatrix& key, const CellMatrix& value, const CellMatrix& aggregates, const CellMatrix& having,
+                   const CellMatrix& orderBy) {
+    std::vector<AggregateSpec> types = AggregateTypes(aggregates);
+    if (TableRows(key) != TableRows(value)) {
+        throw("The inputs must have the same number of records.");
+    }
+    StringPool pool;
+    ColumnarTable keys = EncodeTable(key, InternStrings{pool});
+    if (keys.Columns() == 0) {
+        throw("There are no keys.");
+    }
+    ColumnarTable values = EncodeTable(value, InternStrings{pool});
+    if (values.Columns() == 0) {
+        throw("There are no values.");
+    }
+    auto conditions = ParseStrings(having, [&](const std::string& text) { return ParseGroupCondition(text, values.Columns()); });
+    auto order = ParseStrings(orderBy, [&](const std::string& text) { return ParseGroupOrder(text, values.Columns()); });
+    if (order.size() > 1) {
+        throw("The groups are sorted on one aggregate.");
+    }
+
+    // the aggregates of the conditions and the order are kept too, though not written
+    std::vector<AggregateSpec> kept = types;
+    for (auto& condition : conditions) {
+        kept.push_back(condition.term.aggregate);
+    }
+    for (auto& by : order) {
+        kept.push_back(by.term.aggregate);
+    }
+
+    auto write = [&](const auto& groups) { return WriteGroups(groups, types, SelectGroups(groups, conditions, order, pool), pool); };
+    if (NumberKeyIndex::Accepts(keys)) {
+        return write(AggregateGroups<NumberKeyIndex>(keys, values, kept, pool));
     }
+    return write(AggregateGroups<KeyIndex>(keys, values, kept, pool));
+}
+
+CellMatrix QFGroupBy(const CellMatrix& keys, const CellMatrix& values, const CellMatrix& aggregates, const CellMatrix& having,
+                     const CellMatrix& orderBy) {
+    static const size_t function = Stats().Register("QFGroupBy");
+    return Memoized(function, {&keys, &values}, std::tie(keys, values, aggregates, having, orderBy),
+                    [&] { return GroupBy(keys, values, aggregates, having, orderBy); });
+}
 
+/*************************************
+window functions: running totals, ranks and offsets within the partitions of a table, aligned with its records
+*************************************/
+
+// the key id of every record, as the row keys of a pivot table are grouped; returns the number of keys
+template <class Index> size_t GroupRecords(const ColumnarTable& keys, std::vector<size_t>& groups) {
+    Index index(keys.Columns());
+    for (size_t row = 0; row < keys.Rows(); ++row) {
+        groups[row] = index.Insert(keys, row).first;
+    }
+    return index.Size();
+}
+
+CellMatrix Window(const CellMatrix& value, const CellMatrix& partition, const CellMatrix& order, const std::string& windowFunction) {
+    WindowSpec spec = ParseWindow(windowFunction);
+    size_t records = TableRows(value);
+    if ((HasVertical(partition) && TableRows(partition) != records) || (HasVertical(order) && TableRows(order) != records)) {
+        throw("The inputs must have the same number of records.");
+    }
+    StringPool pool;
+    ColumnarTable values = EncodeTable(value, InternStrings{pool});
+    if (values.Columns() != 1) {
+        throw("The values must have one column.");
+    }
+
+    std::optional<WindowScan> scan;
+    {
+        PhaseTimer timer(PHASE_BUILD);
+        // no partition is a single one, no order is table order
+        std::vector<size_t> partitions(records, 0);
+        size_t partitionCount = records > 0 ? 1 : 0;
+        if (HasVertical(partition)) {
+            ColumnarTable keys = EncodeTable(partition, InternStrings{pool});
+            partitionCount =
+                NumberKeyIndex::Accepts(keys) ? GroupRecords<NumberKeyIndex>(keys, partitions) : GroupRecords<KeyIndex>(keys, partitions);
+        }
+        ColumnarTable orderItems = HasVertical(order) ? EncodeTable(order, InternStrings{pool}) : ColumnarTable();
+        const ColumnarTable& orderKeys = (HasVertical(order) || !RanksRows(spec)) ? orderItems : values;
+        std::vector<OrderKey> keys = orderKeys.Columns() > 0 ? OrderKeys(orderKeys, StringRanks(pool)) : std::vector<OrderKey>();
+        scan.emplace(partitions, partitionCount, std::move(keys), orderKeys.Columns());
+    }
+
+    PhaseTimer timer(PHASE_PROBE);
+    std::vector<CellCode> codes = scan->Apply(spec, values);
+    CellMatrix result{records, 1};
+    for (size_t row = 0; row < records; ++row) {
+        DecodeCell(codes[row], pool, result(row, 0));
+    }
     return result;
 }
 
-struct CountInitialization {
-    double operator()(std::vector<QFCellValue>& value) { return 1.0; }
-};
+CellMatrix QFWindow(const CellMatrix& value, const CellMatrix& partition, const CellMatrix& order, const std::string& windowFunction) {
+    static const size_t function = Stats().Register("QFWindow");
+    return Memoized(function, {&value, &partition, &order}, std::tie(value, partition, order, windowFunction),
+                    [&] { return Window(value, partition, order, windowFunction); });
+}
 
-struct CountIncrement {
-    double operator()(std::vector<QFCellValue>& value, double current) { return (current + 1); }
-};
+/*************************************
+approximate aggregates, in the memory of a sketch whatever the size of the range
+*************************************/
 
-CellMatrix QFPivotCount(const CellMatrix& horizontal, const CellMatrix& vertical) {
-    CellMatrix value{horizontal.RowsInStructure(), 1};
+double QFApproxDistinct(const CellMatrix& x, const CellMatrix& error) {
+    static const size_t function = Stats().Register("QFApproxDistinct");
+    return Memoized(function, {&x}, std::tie(x, error), [&] {
+        DistinctSketch empty(SketchError(NumberValue(error, DEFAULT_SKETCH_ERROR)));
+        return VisitTable(x, [&](const auto& table) {
+            // empty cells count as one item, as in QFUnique
+            DistinctSketch sketch = SketchRows(table.RowsInStructure(), empty, [&](DistinctSketch& block, size_t begin, size_t end) {
+                for (size_t row = begin; row < end; ++row) {
+                    for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
+                        block.Add(HashCell(table(row, col)));
+                    }
+                }
+            });
+            return std::round(sketch.Estimate());
+        });
+    });
+}
 
-    return PivotTable<double>(value, horizontal, vertical, CountInitialization(), CountIncrement());
+CellMatrix QFApproxQuantile(const CellMatrix& x, const CellMatrix& quantiles, const CellMatrix& error) {
+    static const size_t function = Stats().Register("QFApproxQuantile");
+    return Memoized(function, {&x}, std::tie(x, quantiles, error), [&] {
+        QuantileSketch empty(SketchError(NumberValue(error, DEFAULT_SKETCH_ERROR)));
+        QuantileSketch sketch = VisitTable(x, [&](const auto& table) {
+            return SketchRows(table.RowsInStructure(), empty, [&](QuantileSketch& block, size_t begin, size_t end) {
+                for (size_t row = begin; row < end; ++row) {
+                    for (size_t col = 0; col < table.ColumnsInStructure(); ++col) {
+                        if (table(row, col).IsANumber()) {
+                            block.Add(double(table(row, col)));
+                        }
+                    }
+                }
+            });
+        });
+
+        CellMatrix result{quantiles.RowsInStructure(), quantiles.ColumnsInStructure()};
+        for (size_t row = 0; row < quantiles.RowsInStructure(); ++row) {
+            for (size_t col = 0; col < quantiles.ColumnsInStructure(); ++col) {
+                if (!quantiles(row, col).IsANumber()) {
+                    continue;
+                }
+                double fraction = double(quantiles(row, col));
+                if (fraction < 0.0 || fraction > 1.0) {
+                    throw("The quantiles must be between 0 and 1.");
+                }
+                if (sketch.Count() == 0.0) {
+                    result(row, col) = EXCEL_ERROR_NUM;
+                } else {
+                    result(row, col) = sketch.Quantile(fraction);
+                }
+            }
+        }
+        return result;
+    });
 }
 
-struct SumInitialization {
-    double operator()(const std::vector<QFCellValue>& value) { return double(value[0]); }
-};
+// the most frequent items with their counts; a count is at most error times the number of cells above the true count
+CellMatrix QFApproxTopK(const CellMatrix& x, double k, const CellMatrix& error) {
+    static const size_t function = Stats().Register("QFApproxTopK");
+    return Memoized(function, {&x}, std::tie(x, k, error), [&] {
+        if (k < 1.0) {
+            throw("The number of items must be at least 1.");
+        }
+        size_t count = size_t(k);
+        FrequentSketch empty(std::min(SketchError(NumberValue(error, DEFAULT_SKETCH_ERROR)), 1.0 / k));
+        return VisitTable(x, [&](const auto& table) {
+            size_t columns = table.ColumnsInStructure();
+            // the counters keep the position of the first cell of their item
+            FrequentSketch sketch = SketchRows(table.RowsInStructure(), empty, [&](FrequentSketch& block, size_t begin, size_t end) {
+                for (size_t row = begin; row < end; ++row) {
+                    for (size_t col = 0; col < columns; ++col) {
+                        block.Add(HashCell(table(row, col)), row * columns + col);
+                    }
+                }
+            });
 
-struct SumIncrement {
-    double operator()(const std::vector<QFCellValue>& value, double current) { return current + double(value[0]); }
-};
+            std::vector<FrequentSketch::Counter> top = sketch.Top(count);
+            CellMatrix result{top.size(), 2};
+            for (size_t i = 0; i < top.size(); ++i) {
+                CopyCell(table(top[i].payload / columns, top[i].payload % columns), result(i, 0));
+                result(i, 1) = top[i].count;
+            }
+            return result;
+        });
+    });
+}
 
-CellMatrix QFPivotSum(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
-    return PivotTable<double>(value, horizontal, vertical, SumInitialization(), SumIncrement());
+/*************************************
+table files, memory mapped and referred to by handle in place of a range
+*************************************/
+
+std::string QFOpenTable(const std::string& path) {
+    static const size_t function = Stats().Register("QFOpenTable");
+    return Instrumented(function, {}, [&] {
+        auto table = std::make_shared<const MappedTable>(path);
+        // the fingerprint covers the size and modification of the file, so a rewritten file gets a new handle
+        std::string handle = MappedTableHandle(table->Fingerprint());
+        if (!MappedTableRegistry().Find(handle)) {
+            MappedTableRegistry().Insert(handle, table);
+        }
+        return handle;
+    });
 }
 
-struct MaxIncrement {
-    double operator()(const std::vector<QFCellValue>& value, double current) { return std::max(current, double(value[0])); }
-};
+std::string QFTableColumns(const std::string& table, const CellMatrix& columns) {
+    static const size_t function = Stats().Register("QFTableColumns");
+    return Instrumented(function, {&columns}, [&] {
+        std::string handle = table.substr(0, table.find(':', sizeof(TABLE_HANDLE_PREFIX) - 1));
+        if (!IsTableHandle(handle)) {
+            throw("Unknown or evicted table handle, recalculate its QFOpenTable.");
+        }
+        auto mapped = FindMappedTable(handle);
+
+        // columns by name or by 1-based number
+        std::string separator = ":";
+        for (size_t row = 0; row < columns.RowsInStructure(); ++row) {
+            for (size_t col = 0; col < columns.ColumnsInStructure(); ++col) {
+                const CellValue& item = columns(row, col);
+                size_t number = 0;
+                if (item.IsANumber()) {
+                    if (double(item) < 1.0 || double(item) > double(mapped->Columns())) {
+                        throw("The table does not have that column.");
+                    }
+                    number = size_t(double(item));
+                } else if (item.IsString()) {
+                    std::string name = std::string(item);
+                    for (size_t i = 0; i < mapped->Columns() && number == 0; ++i) {
+                        number = (mapped->ColumnName(i) == name) ? i + 1 : 0;
+                    }
+                    if (number == 0) {
+                        throw("The table does not have that column.");
+                    }
+                } else {
+                    continue;
+                }
+                handle += separator + std::to_string(number);
+                separator = ",";
+            }
+        }
+        return handle;
+    });
+}
 
-struct MinIncrement {
-    double operator()(const std::vector<QFCellValue>& value, double current) { return std::min(current, double(value[0])); }
-};
+double QFConvertCsv(const std::string& csvPath, const std::string& tablePath) {
+    static const size_t function = Stats().Register("QFConvertCsv");
+    return Instrumented(function, {}, [&] { return double(ConvertCsvTable(csvPath, tablePath, ',')); });
+}
 
-CellMatrix QFPivotMax(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
-    return PivotTable<double>(value, horizontal, vertical, SumInitialization(), MaxIncrement());
+/*************************************
+result cache
+*************************************/
+
+double QFSetCacheBudget(double megabytes) {
+    static const size_t function = Stats().Register("QFSetCacheBudget");
+    return Instrumented(function, {}, [&] {
+        if (megabytes < 0.0) {
+            throw("The budget must not be negative.");
+        }
+        size_t previous = ResultCache().SetBudget(size_t(megabytes * 1024.0 * 1024.0));
+        if (ResultCache().Budget() == 0) {
+            // the registry keeps its latest item whatever the budget, a cache turned off keeps nothing
+            ResultCache().Clear();
+        }
+        return double(previous) / (1024.0 * 1024.0);
+    });
 }
 
-CellMatrix QFPivotMin(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
-    return PivotTable<double>(value, horizontal, vertical, SumInitialization(), MinIncrement());
+double QFCacheClear() {
+    static const size_t function = Stats().Register("QFCacheClear");
+    return Instrumented(function, {}, [&] {
+        double results = double(ResultCache().Size());
+        ResultCache().Clear();
+        return results;
+    });
+}
+
+/*************************************
+background jobs: the heavy functions run off the calculation thread, their results fetched by job handle once done
+*************************************/
+
+uint64_t ArgumentRows(const CellMatrix& x) { return TableRows(x); }
+uint64_t ArgumentRows(const std::string&) { return 0; }
+
+// the job calls the function on copies of the arguments, which Excel only lends for the call; the handle is named after the
+// function and the argument contents, so an identical call submitted again gets the job of the first one; both hashes of the
+// arguments are in the handle, two calls only share a job if they agree on both
+template <class Call, class... Args> std::string SubmitJob(size_t function, Call call, const Args&... arguments) {
+    CallDigest digest(function, std::tie(arguments...));
+    char check[24];
+    std::snprintf(check, sizeof(check), ":%016llx", static_cast<unsigned long long>(digest.check));
+    std::string handle = "QFJob:" + CallKey(function, digest) + check;
+    // each input is encoded once, then the largest one scanned again to probe or aggregate
+    uint64_t rows = 0, largest = 0;
+    for (uint64_t inputRows : {ArgumentRows(arguments)...}) {
+        rows += inputRows;
+        largest = std::max(largest, inputRows);
+    }
+    return Jobs().Submit(handle, rows + largest, [&] {
+        return std::function<CellMatrix()>([call, copies = std::make_tuple(arguments...)] { return std::apply(call, copies); });
+    });
+}
+
+std::string QFSubmitPivotSum(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical) {
+    static const size_t function = Stats().Register("QFSubmitPivotSum");
+    return Instrumented(function, {&value, &horizontal, &vertical},
+                        [&] { return SubmitJob(function, QFPivotSum, value, horizontal, vertical); });
+}
+
+std::string QFSubmitPivot(const CellMatrix& value, const CellMatrix& horizontal, const CellMatrix& vertical, const CellMatrix& aggregates) {
+    static const size_t function = Stats().Register("QFSubmitPivot");
+    return Instrumented(function, {&value, &horizontal, &vertical},
+                        [&] { return SubmitJob(function, QFPivot, value, horizontal, vertical, aggregates); });
+}
+
+std::string QFSubmitVLookup(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable) {
+    static const size_t function = Stats().Register("QFSubmitVLookup");
+    return Instrumented(function, {&lookup, &table, &outputTable},
+                        [&] { return SubmitJob(function, QFExactVLookup, lookup, table, outputTable); });
+}
+
+std::string QFSubmitFilter(const CellMatrix& lookup, const CellMatrix& table, const CellMatrix& outputTable,
+                           const CellMatrix& includeLookup) {
+    static const size_t function = Stats().Register("QFSubmitFilter");
+    return Instrumented(function, {&lookup, &table, &outputTable},
+                        [&] { return SubmitJob(function, QFFilter, lookup, table, outputTable, includeLookup); });
+}
+
+std::string QFSubmitSortBy(const CellMatrix& table, const CellMatrix& keyColumns, const CellMatrix& directions, const CellMatrix& topN) {
+    static const size_t function = Stats().Register("QFSubmitSortBy");
+    return Instrumented(function, {&table}, [&] { return SubmitJob(function, QFSortBy, table, keyColumns, directions, topN); });
+}
+
+std::string QFSubmitJoin(const CellMatrix& leftKeys, const CellMatrix& leftValues, const CellMatrix& rightKeys,
+                         const CellMatrix& rightValues, const std::string& joinType) {
+    static const size_t function = Stats().Register("QFSubmitJoin");
+    return Instrumented(function, {&leftKeys, &leftValues, &rightKeys, &rightValues},
+                        [&] { return SubmitJob(function, QFJoin, leftKeys, leftValues, rightKeys, rightValues, joinType); });
+}
+
+// a header row, then the state, progress, elapsed seconds, rows scanned and error of the job
+CellMatrix QFJobStatus(const std::string& handle) {
+    static const size_t function = Stats().Register("QFJobStatus");
+    return Instrumented(function, {}, [&] {
+        std::optional<JobStatus> status = Jobs().Status(handle);
+        if (!status) {
+            throw("Unknown or dropped job handle, recalculate its QFSubmit call.");
+        }
+        const char* headers[] = {"state", "progress", "elapsed s", "rows scanned", "error"};
+        CellMatrix result{2, 5};
+        for (size_t col = 0; col < 5; ++col) {
+            result(0, col) = std::string(headers[col]);
+        }
+        result(1, 0) = std::string(JobStateName(status->state));
+        result(1, 1) = status->progress;
+        result(1, 2) = status->elapsed;
+        result(1, 3) = double(status->rows);
+        if (status->error) {
+            result(1, 4) = std::string(status->error);
+        }
+        return result;
+    });
+}
+
+CellMatrix QFJobResult(const std::string& handle) {
+    static const size_t function = Stats().Register("QFJobResult");
+    return Instrumented(function, {}, [&] { return Jobs().Result(handle); });
+}
+
+double QFJobCancel(const std::string& handle) {
+    static const size_t function = Stats().Register("QFJobCancel");
+    return Instrumented(function, {}, [&] { return Jobs().Cancel(handle) ? 1.0 : 0.0; });
+}
+
+/*************************************
+runtime statistics
+*************************************/
+
+CellMatrix QFStats() {
+    std::vector<FunctionStats> functions = Stats().Collect();
+    // the functions taking the most time first
+    std::stable_sort(begin(functions), end(functions), [](const FunctionStats& lhs, const FunctionStats& rhs) { return lhs.nanos > rhs.nanos; });
+
+    const char* headers[] = {"function",   "calls",       "total ms",     "mean ms",  "max ms",   "p50 ms",     "p99 ms",
+                             "input rows", "input cells", "output cells", "build ms", "probe ms", "cache hits", "cache misses"};
+    const size_t columns = sizeof(headers) / sizeof(headers[0]);
+    const double millis = 1e-6;
+
+    CellMatrix result{functions.size() + 1, columns};
+    for (size_t col = 0; col < columns; ++col) {
+        result(0, col) = std::string(headers[col]);
+    }
+    for (size_t i = 0; i < functions.size(); ++i) {
+        const FunctionStats& item = functions[i];
+        size_t row = i + 1;
+        result(row, 0) = item.name;
+        result(row, 1) = double(item.calls);
+        result(row, 2) = double(item.nanos) * millis;
+        result(row, 3) = double(item.nanos) * millis / double(item.calls);
+        result(row, 4) = double(item.maxNanos) * millis;
+        result(row, 5) = item.Percentile(0.50) * millis;
+        result(row, 6) = item.Percentile(0.99) * millis;
+        result(row, 7) = double(item.inputRows);
+        result(row, 8) = double(item.inputCells);
+        result(row, 9) = double(item.outputCells);
+        result(row, 10) = double(item.buildNanos) * millis;
+        result(row, 11) = double(item.probeNanos) * millis;
+        result(row, 12) = double(item.cacheHits);
+        result(row, 13) = double(item.cacheMisses);
+    }
+    return result;
+}
+
+double QFStatsReset() {
+    double calls = 0.0;
+    for (auto& item : Stats().Collect()) {
+        calls += double(item.calls);
+    }
+    Stats().Reset();
+    return calls;
 }
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <xlw/CellMatrix.h>
+
+/*************************************
+runtime statistics of the exported functions
+every thread records into its own counters, so a call takes no lock; reading and resetting visit the counters of all threads
+*************************************/
+
+enum StatsPhase { PHASE_BUILD, PHASE_PROBE };
+
+constexpr size_t STATS_FUNCTIONS = 64;                        // most functions that can be registered
+constexpr size_t LATENCY_SUB_BITS = 2;                        // 4 latency buckets per power of two, so about 19% wide
+constexpr size_t LATENCY_BUCKETS = 48 << LATENCY_SUB_BITS;    // latencies up to 2^48 ns, longer ones land in the last bucket
+
+inline size_t LatencyBucket(uint64_t nanos) {
+    if (nanos < (uint64_t(1) << LATENCY_SUB_BITS)) {
+        return size_t(nanos);
+    }
+    size_t exponent = LATENCY_SUB_BITS;
+    while ((nanos >> exponent) > 1) {
+        ++exponent;
+    }
+    size_t sub = size_t(nanos >> (exponent - LATENCY_SUB_BITS)) & ((size_t(1) << LATENCY_SUB_BITS) - 1);
+    return std::min(((exponent - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub, LATENCY_BUCKETS - 1);
+}
+
+// middle of the latencies falling in the bucket
+inline double LatencyBucketMiddle(size_t bucket) {
+    if (bucket < (size_t(1) << LATENCY_SUB_BITS)) {
+        return double(bucket);
+    }
+    size_t exponent = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    size_t sub = bucket & ((size_t(1) << LATENCY_SUB_BITS) - 1);
+    double width = double(uint64_t(1) << (exponent - LATENCY_SUB_BITS));
+    return double(uint64_t(1) << exponent) + (double(sub) + 0.5) * width;
+}
+
+// only the owning thread writes the counters, other threads may read them
+inline void AddCounter(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void MaxCounter(std::atomic<uint64_t>& counter, uint64_t value) {
+    if (value > counter.load(std::memory_order_relaxed)) {
+        counter.store(value, std::memory_order_relaxed);
+    }
+}
+
+struct FunctionCounters {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> nanos;
+    std::atomic<uint64_t> maxNanos;
+    std::atomic<uint64_t> inputRows;
+    std::atomic<uint64_t> inputCells;
+    std::atomic<uint64_t> outputCells;
+    std::atomic<uint64_t> buildNanos;
+    std::atomic<uint64_t> probeNanos;
+    std::atomic<uint64_t> cacheHits;
+    std::atomic<uint64_t> cacheMisses;
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latencies;
+};
+
+struct ThreadStats {
+    std::atomic<bool> resetPending;
+    std::array<FunctionCounters, STATS_FUNCTIONS> functions;
+};
+
+// what a call measures while it runs
+struct CallRecord {
+    uint64_t inputRows{0};
+    uint64_t inputCells{0};
+    uint64_t outputCells{0};
+    uint64_t buildNanos{0};
+    uint64_t probeNanos{0};
+    uint64_t cacheHits{0};
+    uint64_t cacheMisses{0};
+};
+
+// the counters of one function summed over all threads
+struct FunctionStats {
+    std::string name;
+    uint64_t calls{0};
+    uint64_t nanos{0};
+    uint64_t maxNanos{0};
+    uint64_t inputRows{0};
+    uint64_t inputCells{0};
+    uint64_t outputCells{0};
+    uint64_t buildNanos{0};
+    uint64_t probeNanos{0};
+    uint64_t cacheHits{0};
+    uint64_t cacheMisses{0};
+    std::vector<uint64_t> latencies;
+
+    // latency in nanoseconds below which the fraction of the calls fall, within the width of a bucket
+    double Percentile(double fraction) const {
+        uint64_t rank = std::max<uint64_t>(uint64_t(fraction * double(calls) + 0.999999), 1);
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < latencies.size(); ++bucket) {
+            seen += latencies[bucket];
+            if (seen >= rank) {
+                return std::min(LatencyBucketMiddle(bucket), double(maxNanos));
+            }
+        }
+        return double(maxNanos);
+    }
+};
+
+class StatsRegistry {
+  public:
+    StatsRegistry() = default;
+    StatsRegistry(const StatsRegistry&) = delete;
+    StatsRegistry& operator=(const StatsRegistry&) = delete;
+
+    // the id of a function, registered once per call site
+    size_t Register(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = std::find(begin(names_), end(names_), name);
+        if (iter != end(names_)) {
+            return size_t(iter - begin(names_));
+        }
+        if (names_.size() == STATS_FUNCTIONS) {
+            throw("Too many instrumented functions.");
+        }
+        names_.push_back(name);
+        return names_.size() - 1;
+    }
+
+    void Record(size_t function, const CallRecord& call, uint64_t nanos) {
+        ThreadStats& stats = Local();
+        if (stats.resetPending.load(std::memory_order_acquire)) {
+            Zero(stats);
+            stats.resetPending.store(false, std::memory_order_release);
+        }
+        FunctionCounters& counters = stats.functions[function];
+        AddCounter(counters.calls, 1);
+        AddCounter(counters.nanos, nanos);
+        MaxCounter(counters.maxNanos, nanos);
+        AddCounter(counters.inputRows, call.inputRows);
+        AddCounter(counters.inputCells, call.inputCells);
+        AddCounter(counters.outputCells, call.outputCells);
+        AddCounter(counters.buildNanos, call.buildNanos);
+        AddCounter(counters.probeNanos, call.probeNanos);
+        AddCounter(counters.cacheHits, call.cacheHits);
+        AddCounter(counters.cacheMisses, call.cacheMisses);
+        AddCounter(counters.latencies[LatencyBucket(nanos)], 1);
+    }
+
+    // every registered function called since the last reset
+    std::vector<FunctionStats> Collect() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<FunctionStats> result;
+        for (size_t function = 0; function < names_.size(); ++function) {
+            FunctionStats total;
+            total.name = names_[function];
+            total.latencies.assign(LATENCY_BUCKETS, 0);
+            for (auto& thread : threads_) {
+                // a thread with a pending reset clears its counters on its next call
+                if (thread->resetPending.load(std::memory_order_acquire)) {
+                    continue;
+                }
+                const FunctionCounters& counters = thread->functions[function];
+                total.calls += counters.calls.load(std::memory_order_relaxed);
+                total.nanos += counters.nanos.load(std::memory_order_relaxed);
+                total.maxNanos = std::max<uint64_t>(total.maxNanos, counters.maxNanos.load(std::memory_order_relaxed));
+                total.inputRows += counters.inputRows.load(std::memory_order_relaxed);
+                total.inputCells += counters.inputCells.load(std::memory_order_relaxed);
+                total.outputCells += counters.outputCells.load(std::memory_order_relaxed);
+                total.buildNanos += counters.buildNanos.load(std::memory_order_relaxed);
+                total.probeNanos += counters.probeNanos.load(std::memory_order_relaxed);
+                total.cacheHits += counters.cacheHits.load(std::memory_order_relaxed);
+                total.cacheMisses += counters.cacheMisses.load(std::memory_order_relaxed);
+                for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+                    total.latencies[bucket] += counters.latencies[bucket].load(std::memory_order_relaxed);
+                }
+            }
+            if (total.calls > 0) {
+                result.push_back(std::move(total));
+            }
+        }
+        return result;
+    }
+
+    // the counters of the other threads are cleared by their owners, on their next call
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& thread : threads_) {
+            thread->resetPending.store(true, std::memory_order_release);
+        }
+    }
+
+  private:
+    // the counters of the calling thread; they outlive the thread, so its calls are still reported
+    ThreadStats& Local() {
+        thread_local std::shared_ptr<ThreadStats> local;
+        if (!local) {
+            local = std::make_shared<ThreadStats>();
+            std::lock_guard<std::mutex> lock(mutex_);
+            threads_.push_back(local);
+        }
+        return *local;
+    }
+
+    static void Zero(ThreadStats& stats) {
+        for (auto& counters : stats.functions) {
+            for (auto* counter : {&counters.calls, &counters.nanos, &counters.maxNanos, &counters.inputRows, &counters.inputCells,
+                                  &counters.outputCells, &counters.buildNanos, &counters.probeNanos, &counters.cacheHits, &counters.cacheMisses}) {
+                counter->store(0, std::memory_order_relaxed);
+            }
+            for (auto& counter : counters.latencies) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> names_;
+    std::vector<std::shared_ptr<ThreadStats>> threads_;
+};
+
+inline StatsRegistry& Stats() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+/*************************************
+timing a call and its phases
+*************************************/
+
+// the call being timed on this thread, nullptr outside of instrumented functions
+inline CallRecord*& CurrentCall() {
+    thread_local CallRecord* current = nullptr;
+    return current;
+}
+
+inline uint64_t ElapsedNanos(std::chrono::steady_clock::time_point start) {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// adds the time spent in its scope to the build or probe time of the current call
+class PhaseTimer {
+  public:
+    explicit PhaseTimer(StatsPhase phase) : phase_(phase), start_(std::chrono::steady_clock::now()) {}
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    ~PhaseTimer() { Stop(); }
+
+    // closes the current phase and starts the next one
+    void Switch(StatsPhase phase) {
+        Stop();
+        phase_ = phase;
+        start_ = std::chrono::steady_clock::now();
+    }
+
+  private:
+    void Stop() {
+        if (CallRecord* call = CurrentCall()) {
+            (phase_ == PHASE_BUILD ? call->buildNanos : call->probeNanos) += ElapsedNanos(start_);
+        }
+    }
+
+    StatsPhase phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// records the call when it goes out of scope, also when the call throws
+class CallScope {
+  public:
+    CallScope(size_t function, std::initializer_list<const xlw::CellMatrix*> inputs)
+        : function_(function), outer_(std::exchange(CurrentCall(), &call_)), start_(std::chrono::steady_clock::now()) {
+        // rows of the largest input, cells of all of them
+        for (auto input : inputs) {
+            call_.inputRows = std::max<uint64_t>(call_.inputRows, input->RowsInStructure());
+            call_.inputCells += uint64_t(input->RowsInStructure()) * input->ColumnsInStructure();
+        }
+    }
+    CallScope(const CallScope&) = delete;
+    CallScope& operator=(const CallScope&) = delete;
+
+    ~CallScope() {
+        CurrentCall() = outer_;
+        Stats().Record(function_, call_, ElapsedNanos(start_));
+    }
+
+    void Output(const xlw::CellMatrix& result) { call_.outputCells = uint64_t(result.RowsInStructure()) * result.ColumnsInStructure(); }
+    template <class Result> void Output(const Result&) { call_.outputCells = 1; }
+
+  private:
+    size_t function_;
+    CallRecord call_;
+    CallRecord* outer_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// runs the body of an exported function, recording it under the function id
+template <class Body> auto Instrumented(size_t function, std::initializer_list<const xlw::CellMatrix*> inputs, Body body) -> decltype(body()) {
+    CallScope scope(function, inputs);
+    auto result = body();
+    scope.Output(result);
+    return result;
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cellitem.h"
+#include "columnartable.h"
+#include "parallel.h"
+#include "sortedsearch.h"
+#include "sortrows.h"
+
+/*************************************
+window functions: a value for every row from the rows before and after it in its partition, in the order of the order keys
+the rows are bucketed by partition, each partition is sorted on its order keys, then scanned once; partitions run in parallel
+*************************************/
+
+constexpr size_t WINDOW_MIN_ROWS_PER_WORKER = size_t(1) << 14;
+
+enum WindowType { WIN_SUM, WIN_MIN, WIN_MAX, WIN_ROW_NUMBER, WIN_RANK, WIN_DENSE_RANK, WIN_LAG, WIN_LEAD, WIN_MOVING_AVERAGE };
+
+struct WindowSpec {
+    WindowType type;
+    size_t rows; // offset of lag and lead, width of the moving average
+};
+
+// a name, then for lag, lead and moving averages a number of rows, as in "lag 2" or "movingaverage 20"; lag and lead default to one row
+inline WindowSpec ParseWindow(std::string name) {
+    for (auto& c : name) {
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    }
+    size_t digits = name.find_last_not_of("0123456789") + 1;
+    std::string count = name.substr(digits);
+    // spaces are left out, so "dense rank" and "lag 2" read as "denserank" and "lag2"
+    name.erase(digits);
+    name.erase(std::remove(begin(name), end(name), ' '), end(name));
+    size_t rows = count.empty() ? 1 : size_t(std::strtoull(count.c_str(), nullptr, 10));
+
+    if (name == "lag")
+        return {WIN_LAG, rows};
+    else if (name == "lead")
+        return {WIN_LEAD, rows};
+    else if ((name == "movingaverage" || name == "mavg") && !count.empty() && rows > 0)
+        return {WIN_MOVING_AVERAGE, rows};
+    else if (count.empty()) {
+        if (name == "sum" || name == "runningsum")
+            return {WIN_SUM, 0};
+        else if (name == "min" || name == "runningmin")
+            return {WIN_MIN, 0};
+        else if (name == "max" || name == "runningmax")
+            return {WIN_MAX, 0};
+        else if (name == "rownumber")
+            return {WIN_ROW_NUMBER, 0};
+        else if (name == "rank")
+            return {WIN_RANK, 0};
+        else if (name == "denserank")
+            return {WIN_DENSE_RANK, 0};
+    }
+    throw("Unknown window function, use sum, min, max, rownumber, rank, denserank, lag N, lead N or movingaverage N.");
+}
+
+// ranks compare the order keys, and rank the values themselves when there are none
+inline bool RanksRows(const WindowSpec& spec) { return spec.type == WIN_RANK || spec.type == WIN_DENSE_RANK; }
+
+class WindowScan {
+  public:
+    // partitions[row] is the partition id of each row, below partitionCount; orderKeys holds width keys per row, none for table order
+    WindowScan(const std::vector<size_t>& partitions, size_t partitionCount, std::vector<OrderKey> orderKeys, size_t width)
+        : offsets_(partitionCount + 1, 0), rows_(partitions.size()), keys_(std::move(orderKeys)), width_(width) {
+        // stable counting sort on the partition, so the rows of a partition are in table order
+        for (size_t partition : partitions) {
+            ++offsets_[partition + 1];
+        }
+        for (size_t id = 0; id < partitionCount; ++id) {
+            offsets_[id + 1] += offsets_[id];
+        }
+        std::vector<size_t> next(begin(offsets_), end(offsets_) - 1);
+        for (size_t row = 0; row < partitions.size(); ++row) {
+            rows_[next[partitions[row]]++] = row;
+        }
+        if (width_ == 0) {
+            return;
+        }
+
+        // the row breaks the ties, so equal keys keep their table order
+        auto less = [&](size_t lhs, size_t rhs) {
+            int order = Compare(lhs, rhs);
+            return order != 0 ? order < 0 : lhs < rhs;
+        };
+        if (partitionCount == 1) {
+            ParallelSortRows(rows_, less);
+            return;
+        }
+        ForChunks([&](size_t partition) { std::sort(begin(rows_) + offsets_[partition], begin(rows_) + offsets_[partition + 1], less); });
+    }
+
+    // the value of the window function at every row; values holds one column, codes of its strings index the pool of the call
+    std::vector<CellCode> Apply(const WindowSpec& spec, const ColumnarTable& values) const {
+        std::vector<CellCode> result(rows_.size());
+        const std::vector<CellCode>& column = values.Column(0);
+        ForChunks([&](size_t partition) {
+            const size_t* rows = rows_.data() + offsets_[partition];
+            size_t count = offsets_[partition + 1] - offsets_[partition];
+            Scan(spec, rows, count, column, result);
+        });
+        return result;
+    }
+
+  private:
+    static CellCode NotAvailable() { return TaggedCode(CVT_ERROR, uint32_t(EXCEL_ERROR_NA.value)); }
+
+    static bool IsNumber(CellCode code) { return CodeType(code) == CVT_NUMBER; }
+
+    // the order of the keys of two rows, as a sign
+    int Compare(size_t lhs, size_t rhs) const {
+        const OrderKey* lKey = &keys_[lhs * width_];
+        const OrderKey* rKey = &keys_[rhs * width_];
+        for (size_t col = 0; col < width_; ++col) {
+            if (!(lKey[col] == rKey[col])) {
+                return lKey[col] < rKey[col] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    // runs function(partition) for every partition, on slices holding about the same number of rows
+    template <class Function> void ForChunks(Function function) const {
+        size_t partitionCount = offsets_.size() - 1;
+        size_t chunks = std::min(WorkerCount(rows_.size(), WINDOW_MIN_ROWS_PER_WORKER), std::max<size_t>(partitionCount, 1));
+        ParallelFor(chunks, [&](size_t chunk) {
+            size_t first = ChunkStart(chunk, chunks);
+            size_t last = ChunkStart(chunk + 1, chunks);
+            for (size_t partition = first; partition < last; ++partition) {
+                function(partition);
+            }
+        });
+    }
+
+    // the first partition starting at or after the chunk-th share of the rows
+    size_t ChunkStart(size_t chunk, size_t chunks) const {
+        if (chunk == chunks) {
+            return offsets_.size() - 1;
+        }
+        size_t row = ChunkRange(rows_.size(), chunks, chunk).first;
+        return size_t(std::lower_bound(begin(offsets_), end(offsets_) - 1, row) - begin(offsets_));
+    }
+
+    void Scan(const WindowSpec& spec, const size_t* rows, size_t count, const std::vector<CellCode>& values,
+              std::vector<CellCode>& result) const {
+        switch (spec.type) {
+        case WIN_SUM: {
+            double sum = 0.0;
+            for (size_t i = 0; i < count; ++i) {
+                if (IsNumber(values[rows[i]])) {
+                    sum += CodeNumber(values[rows[i]]);
+                }
+                result[rows[i]] = NumberCode(sum);
+            }
+            break;
+        }
+        case WIN_MIN:
+        case WIN_MAX: {
+            // #N/A until the first number
+            CellCode best = NotAvailable();
+            for (size_t i = 0; i < count; ++i) {
+                CellCode value = values[rows[i]];
+                if (IsNumber(value) && (!IsNumber(best) || (spec.type == WIN_MIN ? CodeNumber(value) < CodeNumber(best)
+                                                                                 : CodeNumber(value) > CodeNumber(best)))) {
+                    best = value;
+                }
+                result[rows[i]] = best;
+            }
+            break;
+        }
+        case WIN_ROW_NUMBER:
+            for (size_t i = 0; i < count; ++i) {
+                result[rows[i]] = NumberCode(double(i + 1));
+            }
+            break;
+        case WIN_RANK:
+        case WIN_DENSE_RANK: {
+            // rows with equal order keys share a rank; rank then skips the ranks of the ties, dense rank does not
+            size_t rank = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (i == 0 || Compare(rows[i - 1], rows[i]) != 0) {
+                    rank = spec.type == WIN_RANK ? i + 1 : rank + 1;
+                }
+                result[rows[i]] = NumberCode(double(rank));
+            }
+            break;
+        }
+        case WIN_LAG:
+            for (size_t i = 0; i < count; ++i) {
+                result[rows[i]] = i >= spec.rows ? values[rows[i - spec.rows]] : NotAvailable();
+            }
+            break;
+        case WIN_LEAD:
+            for (size_t i = 0; i < count; ++i) {
+                result[rows[i]] = spec.rows < count - i ? values[rows[i + spec.rows]] : NotAvailable();
+            }
+            break;
+        case WIN_MOVING_AVERAGE: {
+            // the mean of the numbers among the last rows, #N/A when there are none; the sum slides with a compensation term, so the
+            // small values of a window are not lost to the large values that left it
+            double sum = 0.0, compensation = 0.0, numbers = 0.0;
+            auto add = [&](double value) {
+                double total = sum + value;
+                compensation += std::abs(sum) >= std::abs(value) ? (sum - total) + value : (value - total) + sum;
+                sum = total;
+            };
+            for (size_t i = 0; i < count; ++i) {
+                if (IsNumber(values[rows[i]])) {
+                    add(CodeNumber(values[rows[i]]));
+                    numbers += 1.0;
+                }
+                if (i >= spec.rows && IsNumber(values[rows[i - spec.rows]])) {
+                    add(-CodeNumber(values[rows[i - spec.rows]]));
+                    numbers -= 1.0;
+                }
+                result[rows[i]] = numbers > 0.0 ? NumberCode((sum + compensation) / numbers) : NotAvailable();
+            }
+            break;
+        }
+        }
+    }
+
+    std::vector<size_t> offsets_; // rows_ of each partition begin at its offset
+    std::vector<size_t> rows_;    // rows by partition, then order
+    std::vector<OrderKey> keys_;
+    size_t width_;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+// in-memory stand-in for xlw's CellMatrix, stored row by row
+
+#include <vector>
+
+#include <xlw/CellValue.h>
+
+namespace xlw {
+
+    class CellMatrix {
+      public:
+        CellMatrix() = default;
+        CellMatrix(size_t rows, size_t columns) : rows_(rows), columns_(columns), cells_(rows * columns) {}
+        CellMatrix(double value) : CellMatrix(1, 1) { cells_[0] = value; }
+        CellMatrix(const std::string& value) : CellMatrix(1, 1) { cells_[0] = value; }
+        CellMatrix(const char* value) : CellMatrix(1, 1) { cells_[0] = value; }
+
+        const CellValue& operator()(size_t i, size_t j) const { return cells_[i * columns_ + j]; }
+        CellValue& operator()(size_t i, size_t j) { return cells_[i * columns_ + j]; }
+
+        size_t RowsInStructure() const { return rows_; }
+        size_t ColumnsInStructure() const { return columns_; }
+
+        void PushBottom(const CellMatrix& newRows) {
+            if (rows_ == 0) {
+                *this = newRows;
+                return;
+            }
+            if (newRows.columns_ != columns_)
+                throw("columns mismatch in PushBottom");
+            cells_.insert(cells_.end(), newRows.cells_.begin(), newRows.cells_.end());
+            rows_ += newRows.rows_;
+        }
+
+      private:
+        size_t rows_{0};
+        size_t columns_{0};
+        std::vector<impl::MJCellValue> cells_;
+    };
+
+} // namespace xlw
@@ -0,0 +1,85 @@
+#pragma once
+
+// in-memory stand-in for xlw's CellValue, so the library builds and runs without Excel
+// strings are returned by value, as in the xlw 5 the XLL is built against
+
+#include <string>
+
+namespace xlw {
+
+    class CellValue {
+      public:
+        struct error_type {
+            unsigned long value;
+            operator unsigned long() const { return value; }
+        };
+
+        CellValue() = default;
+        CellValue(const std::string& value) : type_(TYPE_STRING), string_(value) {}
+        CellValue(const char* value) : type_(TYPE_STRING), string_(value) {}
+        CellValue(double value) : type_(TYPE_NUMBER), number_(value) {}
+        CellValue(int value) : type_(TYPE_NUMBER), number_(value) {}
+        CellValue(unsigned long value) : type_(TYPE_NUMBER), number_(double(value)) {}
+        CellValue(bool value) : type_(TYPE_BOOLEAN), number_(value ? 1.0 : 0.0) {}
+        CellValue(const error_type& value) : type_(TYPE_ERROR), error_(value.value) {}
+        CellValue(unsigned long errorCode, bool) : type_(TYPE_ERROR), error_(errorCode) {}
+
+        bool IsAString() const { return type_ == TYPE_STRING; }
+        bool IsAWstring() const { return false; }
+        bool IsString() const { return type_ == TYPE_STRING; }
+        bool IsANumber() const { return type_ == TYPE_NUMBER; }
+        bool IsBoolean() const { return type_ == TYPE_BOOLEAN; }
+        bool IsError() const { return type_ == TYPE_ERROR; }
+        bool IsEmpty() const { return type_ == TYPE_EMPTY; }
+
+        operator std::string() const { return StringValue(); }
+        operator double() const { return NumericValue(); }
+        operator bool() const { return BooleanValue(); }
+
+        std::string StringValue() const {
+            if (type_ != TYPE_STRING)
+                throw("non string requested");
+            return string_;
+        }
+
+        double NumericValue() const {
+            if (type_ != TYPE_NUMBER)
+                throw("non number requested");
+            return number_;
+        }
+
+        bool BooleanValue() const {
+            if (type_ != TYPE_BOOLEAN)
+                throw("non boolean requested");
+            return number_ != 0.0;
+        }
+
+        unsigned long ErrorValue() const {
+            if (type_ != TYPE_ERROR)
+                throw("non error requested");
+            return error_;
+        }
+
+        void clear() { *this = CellValue(); }
+
+      private:
+        enum Type { TYPE_EMPTY, TYPE_NUMBER, TYPE_STRING, TYPE_BOOLEAN, TYPE_ERROR };
+
+        Type type_{TYPE_EMPTY};
+        std::string string_;
+        double number_{0.0};
+        unsigned long error_{0};
+    };
+
+    namespace impl {
+
+        class MJCellValue : public CellValue {
+          public:
+            using CellValue::CellValue;
+            MJCellValue() = default;
+            MJCellValue(const CellValue& value) : CellValue(value) {}
+        };
+
+    } // namespace impl
+
+} // namespace xlw
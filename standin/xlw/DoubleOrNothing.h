@@ -0,0 +1,5 @@
+#pragma once
+
+// in-memory stand-in for xlw: only the CellMatrix interface is used by the library
+
+#include <xlw/CellMatrix.h>
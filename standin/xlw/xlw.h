@@ -0,0 +1,10 @@
+#pragma once
+
+// in-memory stand-in for xlw, so the library builds and runs without Excel
+
+#include <map>
+#include <string>
+
+#include <xlw/CellMatrix.h>
+
+#define XLW_VERSION "in-memory stand-in"
@@ -0,0 +1,159 @@
+// JobEngine: submit, deduplication of identical submissions, cancellation in the middle of a scan, submission again after a
+// cancellation, and the results, through Wait rather than polling; then the same through the QFSubmit functions
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "cellhash.h"
+#include "cppinterface.h"
+#include "jobs.h"
+#include "parallel.h"
+
+namespace {
+
+    int failures = 0;
+
+    void Check(bool condition, const char* what) {
+        if (!condition) {
+            std::printf("failed: %s\n", what);
+            ++failures;
+        }
+    }
+
+    // the message thrown by call, nullptr if it throws none
+    const char* Thrown(const std::function<void()>& call) {
+        try {
+            call();
+        } catch (const char* message) {
+            return message;
+        }
+        return nullptr;
+    }
+
+    bool SameText(const char* lhs, const char* rhs) { return lhs && rhs && std::string(lhs) == rhs; }
+
+    JobState StateOf(const JobEngine& engine, const std::string& handle) { return engine.Status(handle)->state; }
+
+    // a scan of rows, one checkpoint per row; it holds at holdRow until it is cancelled, while hold is set
+    struct Scan {
+        std::atomic<bool> hold{false};
+        std::atomic<bool> holding{false};
+        std::atomic<int> made{0};
+        size_t rows{1000000};
+        size_t holdRow{100000};
+
+        std::function<xlw::CellMatrix()> Work() {
+            ++made;
+            return [this] {
+                double sum = 0.0;
+                for (size_t row = 0; row < rows; ++row) {
+                    JobCheckpoint(row);
+                    while (row == holdRow && hold) {
+                        holding = true;
+                        JobCheckpoint(JOB_CHECKPOINT_ROWS - 1);
+                        std::this_thread::yield();
+                    }
+                    sum += double(row);
+                }
+                return xlw::CellMatrix(sum);
+            };
+        }
+
+        double Sum() const { return double(rows) * double(rows - 1) / 2.0; }
+    };
+
+    void TestEngine() {
+        JobEngine engine(1);
+        Scan scan;
+        auto makeWork = [&] { return scan.Work(); };
+
+        // submit, then the same handle again while the job is queued or running
+        scan.hold = true;
+        std::string handle = engine.Submit("scan", scan.rows, makeWork);
+        Check(handle == "scan", "the handle of a job is the one submitted");
+        Check(engine.Submit("scan", scan.rows, makeWork) == handle, "an identical submission gets the job of the first one");
+        Check(scan.made == 1, "an identical submission makes no new work");
+        Check(SameText(Thrown([&] { engine.Result(handle); }), "The job is not finished yet."), "no result before the job is done");
+
+        // cancel in the middle of the scan
+        while (!scan.holding) {
+            std::this_thread::yield();
+        }
+        Check(StateOf(engine, handle) == JOB_RUNNING, "a job in its scan is running");
+        JobStatus status = *engine.Status(handle);
+        Check(status.rows > 0 && status.progress > 0.0 && status.progress < 1.0, "a running job reports part of its rows");
+        Check(engine.Cancel(handle), "a running job can be cancelled");
+        engine.Wait(handle);
+        Check(StateOf(engine, handle) == JOB_CANCELLED, "a cancelled job stops at its next checkpoint");
+        Check(SameText(Thrown([&] { engine.Result(handle); }), "The job has been cancelled."), "a cancelled job has no result");
+
+        // submitted again after the cancellation, the job runs again to its end
+        scan.hold = false;
+        Check(engine.Submit("scan", scan.rows, makeWork) == handle, "a cancelled job is submitted again under its handle");
+        Check(scan.made == 2, "a cancelled job is submitted again with new work");
+        engine.Wait(handle);
+        Check(StateOf(engine, handle) == JOB_DONE, "the job submitted again is done");
+        Check(engine.Status(handle)->progress == 1.0, "a done job is complete");
+        Check(engine.Result(handle)(0, 0).NumericValue() == scan.Sum(), "the result of the job submitted again");
+        Check(engine.Submit("scan", scan.rows, makeWork) == handle && scan.made == 2, "a done job is not submitted again");
+
+        // a queued job is cancelled at once, a finished one is dropped
+        scan.hold = true;
+        scan.holding = false;
+        engine.Submit("first", scan.rows, makeWork);
+        engine.Submit("second", scan.rows, makeWork);
+        Check(StateOf(engine, "second") == JOB_QUEUED, "a job waits for the engine thread");
+        Check(engine.Cancel("second") && StateOf(engine, "second") == JOB_CANCELLED, "a queued job is cancelled at once");
+        engine.Cancel("first");
+        engine.Wait("first");
+        Check(engine.Cancel(handle) && !engine.Status(handle), "a finished job is dropped");
+        Check(!engine.Cancel(handle), "a dropped job is unknown");
+        Check(SameText(Thrown([&] { engine.Result(handle); }), "Unknown or dropped job handle, recalculate its QFSubmit call."),
+              "a dropped job has no result");
+
+        // a failing job keeps its message
+        auto failingWork = [] { return std::function<xlw::CellMatrix()>([]() -> xlw::CellMatrix { throw("Bad input."); }); };
+        std::string failing = engine.Submit("failing", 1, failingWork);
+        engine.Wait(failing);
+        Check(StateOf(engine, failing) == JOB_FAILED, "a job that throws fails");
+        Check(SameText(Thrown([&] { engine.Result(failing); }), "Bad input."), "a failed job throws its message");
+    }
+
+    void TestSubmit() {
+        size_t rows = 50000;
+        CellMatrix values{rows, 1}, horizontal{rows, 1}, vertical{rows, 1};
+        for (size_t row = 0; row < rows; ++row) {
+            values(row, 0) = double(row % 97);
+            horizontal(row, 0) = "k" + std::to_string(row % 1000);
+            vertical(row, 0) = double(row % 3);
+        }
+        std::string handle = QFSubmitPivotSum(values, horizontal, vertical);
+        Check(QFSubmitPivotSum(values, horizontal, vertical) == handle, "an identical call gets the job of the first one");
+        Jobs().Wait(handle);
+        CellMatrix result = QFJobResult(handle);
+        CellMatrix expected = QFPivotSum(values, horizontal, vertical);
+        bool same = result.RowsInStructure() == expected.RowsInStructure() && result.ColumnsInStructure() == expected.ColumnsInStructure();
+        for (size_t row = 0; same && row < result.RowsInStructure(); ++row) {
+            for (size_t col = 0; same && col < result.ColumnsInStructure(); ++col) {
+                same = EqualCell(result(row, col), expected(row, col));
+            }
+        }
+        Check(same, "the result of a job is that of the call");
+    }
+
+} // namespace
+
+int main() {
+    try {
+        TestEngine();
+        TestSubmit();
+    } catch (const char* error) {
+        std::printf("error: %s\n", error);
+        return 1;
+    }
+    std::printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+// the three join strategies against a nested loop join, for each of the six join types: hash joins built on either side over keys in
+// table order, and the merge join over sorted keys, called directly and through Join on inputs shaped to make it choose each one
+//
+// the keys hold cells of every type, -0.0 and 0.0, and NaN, which is equal to itself as a key; every strategy must return the
+// pairs the nested loop finds, in its order
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cellitem.h"
+#include "columnartable.h"
+#include "cppinterface.h"
+#include "join.h"
+
+namespace {
+
+    std::mt19937_64 generator(11);
+
+    const JoinType JOIN_TYPES[] = {JOIN_INNER, JOIN_LEFT, JOIN_RIGHT, JOIN_FULL, JOIN_SEMI, JOIN_ANTI};
+    const char* const JOIN_NAMES[] = {"inner", "left", "right", "full", "semi", "anti"};
+
+    CellValue RandomCell(size_t cardinality) {
+        size_t key = size_t(generator() % cardinality);
+        switch (key % 8) {
+        case 0:
+            return CellValue("k" + std::to_string(key));
+        case 1:
+            return CellValue(key % 16 == 1);
+        case 2:
+            return CellValue(CellValue::error_type{uint32_t(key % 3 == 0 ? 7 : 42)});
+        case 3:
+            return key % 3 == 0 ? CellValue() : CellValue(std::numeric_limits<double>::quiet_NaN());
+        case 4:
+            return CellValue(key % 3 == 0 ? -0.0 : 0.0);
+        default:
+            return CellValue(double(key) / 2.0 - 10.0);
+        }
+    }
+
+    // negative if lhs sorts first, 0 for equal keys: types as in CellValueType, numbers by value with NaN after every other one
+    int CompareCells(const CellValue& lhs, const CellValue& rhs) {
+        CellValueType lType = GetType(lhs), rType = GetType(rhs);
+        if (lType != rType) {
+            return lType < rType ? -1 : 1;
+        }
+        switch (lType) {
+        case CVT_NUMBER: {
+            double lValue = lhs.NumericValue(), rValue = rhs.NumericValue();
+            if (std::isnan(lValue) || std::isnan(rValue)) {
+                return int(std::isnan(lValue)) - int(std::isnan(rValue));
+            }
+            return lValue < rValue ? -1 : (rValue < lValue ? 1 : 0);
+        }
+        case CVT_STRING:
+            return lhs.StringValue().compare(rhs.StringValue());
+        case CVT_BOOLEAN:
+            return int(lhs.BooleanValue()) - int(rhs.BooleanValue());
+        case CVT_ERROR:
+            return lhs.ErrorValue() < rhs.ErrorValue() ? -1 : (rhs.ErrorValue() < lhs.ErrorValue() ? 1 : 0);
+        default:
+            return 0;
+        }
+    }
+
+    int CompareRows(const CellMatrix& lhs, size_t lRow, const CellMatrix& rhs, size_t rRow) {
+        for (size_t col = 0; col < lhs.ColumnsInStructure(); ++col) {
+            if (int order = CompareCells(lhs(lRow, col), rhs(rRow, col))) {
+                return order;
+            }
+        }
+        return 0;
+    }
+
+    CellMatrix RandomKeys(size_t rows, size_t width, size_t cardinality, bool sorted) {
+        CellMatrix keys{rows, width};
+        for (size_t row = 0; row < rows; ++row) {
+            for (size_t col = 0; col < width; ++col) {
+                keys(row, col) = RandomCell(cardinality);
+            }
+        }
+        if (!sorted) {
+            return keys;
+        }
+        std::vector<size_t> order(rows);
+        for (size_t row = 0; row < rows; ++row) {
+            order[row] = row;
+        }
+        std::stable_sort(begin(order), end(order), [&](size_t lhs, size_t rhs) { return CompareRows(keys, lhs, keys, rhs) < 0; });
+        CellMatrix result{rows, width};
+        for (size_t row = 0; row < rows; ++row) {
+            for (size_t col = 0; col < width; ++col) {
+                result(row, col) = keys(order[row], col);
+            }
+        }
+        return result;
+    }
+
+    // left rows in order, each with its right rows in order, then the unmatched right rows
+    JoinPairs NestedLoopJoin(const CellMatrix& left, const CellMatrix& right, JoinType type) {
+        JoinPairs pairs;
+        std::vector<bool> matchedRight(right.RowsInStructure(), false);
+        for (size_t lRow = 0; lRow < left.RowsInStructure(); ++lRow) {
+            bool matched = false;
+            for (size_t rRow = 0; rRow < right.RowsInStructure(); ++rRow) {
+                if (CompareRows(left, lRow, right, rRow) != 0) {
+                    continue;
+                }
+                matched = true;
+                matchedRight[rRow] = true;
+                if (type != JOIN_SEMI && type != JOIN_ANTI) {
+                    pairs.emplace_back(lRow, rRow);
+                }
+            }
+            if (matched ? type == JOIN_SEMI : (KeepsUnmatchedLeft(type) || type == JOIN_ANTI)) {
+                pairs.emplace_back(lRow, NO_ROW);
+            }
+        }
+        for (size_t rRow = 0; KeepsUnmatchedRight(type) && rRow < right.RowsInStructure(); ++rRow) {
+            if (!matchedRight[rRow]) {
+                pairs.emplace_back(NO_ROW, rRow);
+            }
+        }
+        return pairs;
+    }
+
+    // the number of failures: 0 or 1
+    int CheckPairs(const char* strategy, JoinType type, const JoinPairs& pairs, const JoinPairs& expected, const char* shape) {
+        if (pairs != expected) {
+            std::printf("%s, %s join, %s: %zu pairs, %zu expected\n", strategy, JOIN_NAMES[type], shape, pairs.size(), expected.size());
+            return 1;
+        }
+        return 0;
+    }
+
+    // sorted keys are joined by MergeJoin, others by a hash join built on the smaller side, or on the right for semi and anti joins
+    int RunJoins(size_t leftRows, size_t rightRows, size_t width, bool sorted, const char* shape) {
+        int failures = 0;
+        size_t cardinality = 4 + generator() % 40;
+        CellMatrix leftKeys = RandomKeys(leftRows, width, cardinality, sorted);
+        CellMatrix rightKeys = RandomKeys(rightRows, width, cardinality, sorted);
+        StringPool pool;
+        ColumnarTable left(leftKeys, InternStrings{pool});
+        ColumnarTable right(rightKeys, InternStrings{pool});
+        if (IsSortedKeys(left, pool) != sorted || IsSortedKeys(right, pool) != sorted) {
+            std::printf("%s: the keys are not in the order expected\n", shape);
+            return 1;
+        }
+
+        for (JoinType type : JOIN_TYPES) {
+            JoinPairs expected = NestedLoopJoin(leftKeys, rightKeys, type);
+            failures += CheckPairs("Join", type, Join(left, right, pool, type), expected, shape);
+            failures += CheckPairs("HashJoinBuildRight", type, HashJoinBuildRight(left, right, type), expected, shape);
+            // Join never builds semi and anti joins on the left, whose pairs are one per left row
+            if (type != JOIN_SEMI && type != JOIN_ANTI) {
+                failures += CheckPairs("HashJoinBuildLeft", type, HashJoinBuildLeft(left, right, type), expected, shape);
+            }
+            if (sorted) {
+                failures += CheckPairs("MergeJoin", type, MergeJoin(left, right, pool, type), expected, shape);
+            }
+        }
+        return failures;
+    }
+
+} // namespace
+
+int main() {
+    int failures = 0;
+    try {
+        for (size_t round = 0; round < 20; ++round) {
+            size_t width = 1 + round % 2;
+            size_t small = 50 + generator() % 200, large = 300 + generator() % 500;
+            failures += RunJoins(small, large, width, false, "smaller left table");
+            failures += RunJoins(large, small, width, false, "smaller right table");
+            failures += RunJoins(small, large, width, true, "sorted tables");
+            failures += RunJoins(large, small, width, true, "sorted tables");
+        }
+        failures += RunJoins(0, 100, 1, true, "empty left table");
+        failures += RunJoins(100, 0, 1, true, "empty right table");
+    } catch (const char* error) {
+        std::printf("error: %s\n", error);
+        return 1;
+    }
+    std::printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+// QFLivePivot against QFPivot over random ticks, on tables large enough to be aggregated in several slices
+//
+// every tick changes a few values or keys, or many at once so that the state is built again; the live pivot must then return
+// exactly the cells of a full QFPivot of the same inputs
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <random>
+#include <string>
+
+#include "cppinterface.h"
+#include "parallel.h"
+#include "pivot.h"
+
+namespace {
+
+    std::mt19937_64 generator(42);
+
+    CellValue RandomKey(size_t cardinality) {
+        size_t key = size_t(generator() % cardinality);
+        if (key % 5 == 0) {
+            return CellValue("k" + std::to_string(key));
+        }
+        return CellValue(double(key));
+    }
+
+    CellValue RandomValue() { return CellValue(double(int64_t(generator() % 2000000) - 1000000) / 7.0); }
+
+    bool SameCell(const CellValue& lhs, const CellValue& rhs) {
+        if (lhs.IsANumber()) {
+            double lValue = lhs.NumericValue();
+            double rValue = rhs.IsANumber() ? rhs.NumericValue() : 0.0;
+            return rhs.IsANumber() && (std::memcmp(&lValue, &rValue, sizeof(double)) == 0 || (lValue != lValue && rValue != rValue));
+        } else if (lhs.IsString()) {
+            return rhs.IsString() && lhs.StringValue() == rhs.StringValue();
+        } else if (lhs.IsBoolean()) {
+            return rhs.IsBoolean() && lhs.BooleanValue() == rhs.BooleanValue();
+        } else if (lhs.IsError()) {
+            return rhs.IsError() && lhs.ErrorValue() == rhs.ErrorValue();
+        }
+        return rhs.IsEmpty();
+    }
+
+    bool SameMatrix(const CellMatrix& lhs, const CellMatrix& rhs) {
+        if (lhs.RowsInStructure() != rhs.RowsInStructure() || lhs.ColumnsInStructure() != rhs.ColumnsInStructure()) {
+            return false;
+        }
+        for (size_t row = 0; row < lhs.RowsInStructure(); ++row) {
+            for (size_t col = 0; col < lhs.ColumnsInStructure(); ++col) {
+                if (!SameCell(lhs(row, col), rhs(row, col))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    CellMatrix Aggregates(std::initializer_list<const char*> names) {
+        CellMatrix aggregates{1, names.size()};
+        size_t col = 0;
+        for (auto name : names) {
+            aggregates(0, col++) = name;
+        }
+        return aggregates;
+    }
+
+    // the number of failed ticks
+    int RunTicks(size_t rows, size_t ticks) {
+        CellMatrix values{rows, 1}, horizontal{rows, 1}, vertical{rows, 1}, empty;
+        for (size_t row = 0; row < rows; ++row) {
+            values(row, 0) = RandomValue();
+            horizontal(row, 0) = RandomKey(300);
+            vertical(row, 0) = RandomKey(4);
+        }
+        CellMatrix aggregates = Aggregates({"sum", "count", "min", "max", "mean", "variance", "first", "last", "distinct", "median", "p90",
+                                            "approxdistinct", "approxtop"});
+        std::string name = "livepivot" + std::to_string(rows);
+
+        int failures = 0;
+        for (size_t tick = 0; tick < ticks; ++tick) {
+            // a quarter of the rows changed at once makes the state be built again
+            size_t changes = tick == 0 ? 0 : (tick == ticks / 2 ? rows / 4 : 1 + generator() % 8);
+            for (size_t change = 0; change < changes; ++change) {
+                size_t row = size_t(generator() % rows);
+                switch (generator() % 3) {
+                case 0:
+                    values(row, 0) = RandomValue();
+                    break;
+                case 1:
+                    horizontal(row, 0) = RandomKey(310);
+                    break;
+                default:
+                    vertical(row, 0) = RandomKey(5);
+                    break;
+                }
+            }
+            if (!SameMatrix(QFLivePivot(name, values, horizontal, vertical, aggregates), QFPivot(values, horizontal, vertical, aggregates))) {
+                std::printf("%zu rows, tick %zu: QFLivePivot differs from QFPivot\n", rows, tick);
+                ++failures;
+            }
+            if (!SameMatrix(QFLivePivot(name + "total", values, horizontal, empty, aggregates), QFPivot(values, horizontal, empty, aggregates))) {
+                std::printf("%zu rows, tick %zu: QFLivePivot differs from QFPivot without column keys\n", rows, tick);
+                ++failures;
+            }
+        }
+        return failures;
+    }
+
+} // namespace
+
+int main() {
+    // several slices whatever the number of hardware threads
+    WorkerThreads() = 4;
+    int failures = 0;
+    try {
+        failures += RunTicks(1000, 10);
+        failures += RunTicks(3 * PIVOT_SLICE_ROWS + 123, 12);
+    } catch (const char* error) {
+        std::printf("error: %s\n", error);
+        return 1;
+    }
+    std::printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
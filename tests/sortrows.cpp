@@ -0,0 +1,168 @@
+// QFSortBy against std::stable_sort over random tables: numbers only, sorted by radix passes or by a partial sort for the top rows,
+// and cells of every type, sorted in slices on several threads and merged
+//
+// the keys hold -0.0 and 0.0, NaN and infinities, repeated often enough that the table order of equal keys is tested too; the first
+// column of every table is the row number, so the rows of any two sorts only compare equal if they are in the same order
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cellitem.h"
+#include "cppinterface.h"
+#include "parallel.h"
+
+namespace {
+
+    std::mt19937_64 generator(7);
+
+    CellValue RandomNumber() {
+        const double specials[] = {-0.0, 0.0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(),
+                                   -std::numeric_limits<double>::infinity(), 1e-300, -1e300};
+        if (generator() % 4 == 0) {
+            return CellValue(specials[generator() % 7]);
+        }
+        return CellValue(double(int64_t(generator() % 41) - 20) / 4.0);
+    }
+
+    CellValue RandomCell() {
+        switch (generator() % 6) {
+        case 0:
+            return CellValue("s" + std::to_string(generator() % 30));
+        case 1:
+            return CellValue(generator() % 2 == 0);
+        case 2:
+            return CellValue(CellValue::error_type{uint32_t(generator() % 3 == 0 ? 7 : 42)});
+        case 3:
+            return CellValue();
+        default:
+            return RandomNumber();
+        }
+    }
+
+    // the order QFSortBy documents: types as in CellValueType, numbers by value with -0.0 equal to 0.0 and NaN after every other
+    // number, strings by their bytes, FALSE before TRUE, errors by code; negative if lhs sorts first, 0 if the cells are equal
+    int CompareCells(const CellValue& lhs, const CellValue& rhs) {
+        CellValueType lType = GetType(lhs), rType = GetType(rhs);
+        if (lType != rType) {
+            return lType < rType ? -1 : 1;
+        }
+        switch (lType) {
+        case CVT_NUMBER: {
+            double lValue = lhs.NumericValue(), rValue = rhs.NumericValue();
+            if (std::isnan(lValue) || std::isnan(rValue)) {
+                return int(std::isnan(lValue)) - int(std::isnan(rValue));
+            }
+            return lValue < rValue ? -1 : (rValue < lValue ? 1 : 0);
+        }
+        case CVT_STRING:
+            return lhs.StringValue().compare(rhs.StringValue());
+        case CVT_BOOLEAN:
+            return int(lhs.BooleanValue()) - int(rhs.BooleanValue());
+        case CVT_ERROR:
+            return lhs.ErrorValue() < rhs.ErrorValue() ? -1 : (rhs.ErrorValue() < lhs.ErrorValue() ? 1 : 0);
+        default:
+            return 0;
+        }
+    }
+
+    // the row numbers of the table in the order of std::stable_sort on the key columns, 0-based, reversed where descending
+    std::vector<size_t> ExpectedOrder(const CellMatrix& table, const std::vector<size_t>& keys, const std::vector<bool>& descending,
+                                      size_t top) {
+        std::vector<size_t> rows(table.RowsInStructure());
+        for (size_t row = 0; row < rows.size(); ++row) {
+            rows[row] = row;
+        }
+        std::stable_sort(begin(rows), end(rows), [&](size_t lhs, size_t rhs) {
+            for (size_t key = 0; key < keys.size(); ++key) {
+                int order = CompareCells(table(lhs, keys[key]), table(rhs, keys[key]));
+                if (order != 0) {
+                    return descending[key] ? order > 0 : order < 0;
+                }
+            }
+            return false;
+        });
+        rows.resize(top == 0 ? rows.size() : std::min(top, rows.size()));
+        return rows;
+    }
+
+    // the number of failures: 0 or 1
+    int CheckSort(const char* what, const CellMatrix& table, const std::vector<size_t>& keys, const std::vector<bool>& descending,
+                  size_t top) {
+        CellMatrix keyColumns{1, keys.size()}, directions{1, keys.size()};
+        for (size_t key = 0; key < keys.size(); ++key) {
+            keyColumns(0, key) = double(keys[key] + 1);
+            directions(0, key) = descending[key] ? "desc" : "asc";
+        }
+        CellMatrix sorted = QFSortBy(table, keyColumns, directions, CellMatrix(double(top)));
+        std::vector<size_t> expected = ExpectedOrder(table, keys, descending, top);
+
+        bool same = sorted.RowsInStructure() == expected.size() && sorted.ColumnsInStructure() == table.ColumnsInStructure();
+        for (size_t row = 0; same && row < expected.size(); ++row) {
+            same = sorted(row, 0).NumericValue() == double(expected[row]);
+        }
+        if (!same) {
+            std::printf("%s, %zu rows, %zu threads, top %zu: QFSortBy differs from std::stable_sort\n", what, table.RowsInStructure(),
+                        size_t(WorkerThreads()), top);
+            return 1;
+        }
+        return 0;
+    }
+
+    CellMatrix RandomTable(size_t rows, size_t keys, bool numbers) {
+        CellMatrix table{rows, keys + 1};
+        for (size_t row = 0; row < rows; ++row) {
+            table(row, 0) = double(row);
+            for (size_t col = 1; col <= keys; ++col) {
+                table(row, col) = numbers ? RandomNumber() : RandomCell();
+            }
+        }
+        return table;
+    }
+
+    std::vector<bool> RandomDirections(size_t keys) {
+        std::vector<bool> descending(keys);
+        for (size_t key = 0; key < keys; ++key) {
+            descending[key] = generator() % 2 == 0;
+        }
+        return descending;
+    }
+
+} // namespace
+
+int main() {
+    int failures = 0;
+    try {
+        // numbers only: radix passes for all the rows, a partial sort for a few of them
+        for (size_t round = 0; round < 8; ++round) {
+            size_t keys = 1 + round % 3;
+            CellMatrix table = RandomTable(5000 + round, keys, true);
+            std::vector<size_t> columns{keys, 1};
+            std::vector<bool> descending = RandomDirections(keys);
+            std::vector<size_t> order(keys);
+            for (size_t key = 0; key < keys; ++key) {
+                order[key] = key + 1;
+            }
+            failures += CheckSort("numbers", table, order, descending, 0);
+            failures += CheckSort("numbers", table, order, descending, 1 + round * 20);
+            failures += CheckSort("numbers, a key twice", table, columns, {true, false}, 0);
+        }
+
+        // cells of every type, in several slices whatever the number of hardware threads, odd numbers of them included
+        for (size_t threads = 2; threads <= 7; ++threads) {
+            WorkerThreads() = threads;
+            CellMatrix table = RandomTable(threads * (size_t(1) << 15) + 17 * threads, 2, false);
+            failures += CheckSort("mixed types", table, {1, 2}, RandomDirections(2), 0);
+            failures += CheckSort("mixed types", table, {2}, {true}, 100);
+        }
+    } catch (const char* error) {
+        std::printf("error: %s\n", error);
+        return 1;
+    }
+    std::printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
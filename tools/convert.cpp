@@ -0,0 +1,24 @@
+// converts a CSV file with a header record into a table file for QFOpenTable, without Excel
+//
+// QFConvert input.csv output.qft [separator]
+
+#include <cstdio>
+#include <string>
+
+#include "csvtable.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 4) {
+        std::fprintf(stderr, "usage: QFConvert input.csv output.qft [separator]\n");
+        return 2;
+    }
+    char separator = (argc == 4 && argv[3][0] != '\0') ? argv[3][0] : ',';
+    try {
+        size_t rows = ConvertCsvTable(argv[1], argv[2], separator);
+        std::printf("%zu records written to %s\n", rows, argv[2]);
+    } catch (const char* error) {
+        std::fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    return 0;
+}